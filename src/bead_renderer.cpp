@@ -0,0 +1,284 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "bead_renderer.h"
+#include "shapes.h"
+
+#include <cstddef>
+#include <climits>
+#include <cfloat>
+#include <algorithm>
+
+// chunks where the beads are thinner (in pixels) are drawn simplified
+const float c_SimplifyBelowPixels = 2.0f;
+
+// --------------------------------------------------------------
+
+// appends a unit mesh, w is the part index read by the vertex shader
+static void append_mesh(TriangleMesh *mesh, float w, std::vector<v4f>& vertices, std::vector<uint>& indices)
+{
+  uint base = (uint)vertices.size();
+  ForIndex(v, mesh->numVertices()) {
+    const t_VertexData *vtx = static_cast<const t_VertexData*>(mesh->vertexDataAt(v));
+    vertices.push_back(v4f(vtx->pos[0], vtx->pos[1], vtx->pos[2], w));
+  }
+  ForIndex(t, mesh->numTriangles()) {
+    v3u tri = mesh->triangleAt(t);
+    ForIndex(i, 3) {
+      indices.push_back(base + tri[i]);
+    }
+  }
+  delete (mesh);
+}
+
+// --------------------------------------------------------------
+
+void BeadRenderer::createMesh(t_mesh& mesh, const std::vector<v4f>& vertices, const std::vector<uint>& indices)
+{
+  mesh.num_indices = (GLsizei)indices.size();
+  glGenVertexArrays(1, &mesh.vao);
+  glBindVertexArray(mesh.vao);
+  glGenBuffers(1, &mesh.vertices);
+  glBindBuffer(GL_ARRAY_BUFFER, mesh.vertices);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(v4f), vertices.data(), GL_STATIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(v4f), (const void*)0);
+  glGenBuffers(1, &mesh.indices);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indices);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint), indices.data(), GL_STATIC_DRAW);
+  // per instance attributes, pointers are set for each draw
+  for (GLuint a = 1; a <= 6; a++) {
+    glEnableVertexAttribArray(a);
+    glVertexAttribDivisor(a, 1);
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// --------------------------------------------------------------
+
+BeadRenderer::BeadRenderer()
+{
+  m_ProjView = m4x4f::identity();
+  setClip(INT_MIN, INT_MAX, INT_MIN, INT_MAX);
+}
+
+// --------------------------------------------------------------
+
+void BeadRenderer::init()
+{
+  std::vector<v4f>  vertices;
+  std::vector<uint> indices;
+  // bead: part 0 is a cylinder along z in [0,1], parts 1 and 2 are spheres at both ends
+  append_mesh(shape_cylinder(1.0f, 1.0f, 1.0f, 12), 0.0f, vertices, indices);
+  append_mesh(shape_sphere(1.0f, 12), 1.0f, vertices, indices);
+  append_mesh(shape_sphere(1.0f, 12), 2.0f, vertices, indices);
+  createMesh(m_Meshes[Mesh_Bead], vertices, indices);
+  // box: corners of the unit cube (corner i is at (i&1, (i>>1)&1, i>>2)), outward facing
+  vertices.clear();
+  ForIndex(i, 8) {
+    vertices.push_back(v4f((float)(i & 1), (float)((i >> 1) & 1), (float)(i >> 2), 0.0f));
+  }
+  indices = {
+    0,2,1, 1,2,3, // z = 0
+    4,5,6, 5,7,6, // z = 1
+    0,1,4, 1,5,4, // y = 0
+    2,6,3, 3,6,7, // y = 1
+    0,4,2, 2,4,6, // x = 0
+    1,3,5, 3,7,5  // x = 1
+  };
+  createMesh(m_Meshes[Mesh_Box], vertices, indices);
+}
+
+// --------------------------------------------------------------
+
+void BeadRenderer::terminate()
+{
+  if (!m_Buffers.empty()) {
+    glDeleteBuffers((GLsizei)m_Buffers.size(), m_Buffers.data());
+    m_Buffers.clear();
+  }
+  for (GLuint buf : m_SimplifiedBuffers) {
+    if (buf != 0) glDeleteBuffers(1, &buf);
+  }
+  m_SimplifiedBuffers.clear();
+  for (auto& mesh : m_Meshes) {
+    if (mesh.vao != 0) {
+      glDeleteBuffers(1, &mesh.vertices);
+      glDeleteBuffers(1, &mesh.indices);
+      glDeleteVertexArrays(1, &mesh.vao);
+      mesh = t_mesh();
+    }
+  }
+  m_Uploaded = 0;
+}
+
+// --------------------------------------------------------------
+
+void BeadRenderer::reset()
+{
+  m_Uploaded = 0;
+  // chunks will hold other segments
+  for (GLuint& buf : m_SimplifiedBuffers) {
+    if (buf != 0) glDeleteBuffers(1, &buf);
+    buf = 0;
+  }
+}
+
+// --------------------------------------------------------------
+
+void BeadRenderer::setView(const m4x4f& projview, float focal_pixels)
+{
+  m_Cull        = true;
+  m_ProjView    = projview;
+  m_FocalPixels = focal_pixels;
+}
+
+// --------------------------------------------------------------
+
+void BeadRenderer::setClip(int layer_min, int layer_max, int line_min, int line_max)
+{
+  m_Clip[0] = layer_min;
+  m_Clip[1] = layer_max;
+  m_Clip[2] = line_min;
+  m_Clip[3] = line_max;
+}
+
+// --------------------------------------------------------------
+
+float BeadRenderer::chunkDepth(const BeadStore::t_chunk_info& info) const
+{
+  if ( info.layer_max < m_Clip[0] || info.layer_min > m_Clip[1]
+    || info.line_max  < m_Clip[2] || info.line_min  > m_Clip[3]) {
+    return -1.0f;
+  }
+  if (!m_Cull) {
+    return 0.0f;
+  }
+  // box corners in clip space, culled if all are outside one of the frustum planes
+  uint  outside = 0x3F;
+  float depth   = FLT_MAX;
+  ForIndex(i, 8) {
+    v3f p(
+      (i & 1)        ? info.box.maxCorner()[0] : info.box.minCorner()[0],
+      ((i >> 1) & 1) ? info.box.maxCorner()[1] : info.box.minCorner()[1],
+      (i >> 2)       ? info.box.maxCorner()[2] : info.box.minCorner()[2]);
+    v4f c = m_ProjView * v4f(p[0], p[1], p[2], 1.0f);
+    uint out = 0;
+    ForIndex(a, 3) {
+      if (c[a] < -c[3]) out |= 1 << (a * 2);
+      if (c[a] >  c[3]) out |= 2 << (a * 2);
+    }
+    outside &= out;
+    depth    = std::min(depth, c[3]); // w is the view depth
+  }
+  if (outside != 0) {
+    return -1.0f;
+  }
+  return std::max(depth, 0.0f);
+}
+
+// --------------------------------------------------------------
+
+void BeadRenderer::drawRange(GLuint buffer, int first, int count)
+{
+  typedef BeadStore::t_segment t_segment;
+  const GLsizei stride = sizeof(t_segment);
+  const size_t  base   = (size_t)first * sizeof(t_segment);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (const void*)(base + offsetof(t_segment, a)));
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (const void*)(base + offsetof(t_segment, b)));
+  glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (const void*)(base + offsetof(t_segment, th)));       // th, r, rs
+  glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, stride, (const void*)(base + offsetof(t_segment, dangling))); // dangling, overlap
+  glVertexAttribPointer(5, 2, GL_SHORT, GL_FALSE, stride, (const void*)(base + offsetof(t_segment, extruder))); // extruder, bridge
+  glVertexAttribIPointer(6, 2, GL_INT, stride, (const void*)(base + offsetof(t_segment, line)));               // line, layer
+  glDrawElementsInstanced(GL_TRIANGLES, m_Meshes[m_Mesh].num_indices, GL_UNSIGNED_INT, (const void*)0, count);
+}
+
+// --------------------------------------------------------------
+
+void BeadRenderer::drawNew(const BeadStore& store)
+{
+  if (m_Meshes[m_Mesh].vao == 0) return;
+  glBindVertexArray(m_Meshes[m_Mesh].vao);
+  while (m_Uploaded < store.size()) {
+    int chunk = (int)(m_Uploaded / BeadStore::c_ChunkSize);
+    int first = (int)(m_Uploaded % BeadStore::c_ChunkSize);
+    int count = (int)store.chunk(chunk).size() - first;
+    if (chunk >= (int)m_Buffers.size()) {
+      GLuint buf;
+      glGenBuffers(1, &buf);
+      glBindBuffer(GL_ARRAY_BUFFER, buf);
+      glBufferData(GL_ARRAY_BUFFER, BeadStore::c_ChunkSize * sizeof(BeadStore::t_segment), nullptr, GL_DYNAMIC_DRAW);
+      m_Buffers.push_back(buf);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[chunk]);
+    glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(BeadStore::t_segment), count * sizeof(BeadStore::t_segment), &store.chunk(chunk)[first]);
+    drawRange(m_Buffers[chunk], first, count);
+    m_Uploaded += count;
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// --------------------------------------------------------------
+
+void BeadRenderer::drawAll(const BeadStore& store)
+{
+  if (m_Meshes[m_Mesh].vao == 0) return;
+  glBindVertexArray(m_Meshes[m_Mesh].vao);
+  // chunks already uploaded and not culled, front to back
+  std::vector<std::pair<float, int> > visible;
+  int num_chunks = (int)((m_Uploaded + BeadStore::c_ChunkSize - 1) / BeadStore::c_ChunkSize);
+  ForIndex(chunk, num_chunks) {
+    float depth = chunkDepth(store.info(chunk));
+    if (depth >= 0.0f) {
+      visible.push_back(std::make_pair(depth, chunk));
+    }
+  }
+  std::sort(visible.begin(), visible.end());
+  m_NumDrawn      = (int)visible.size();
+  m_NumSimplified = 0;
+  m_SimplifiedBuffers.resize(m_Buffers.size(), 0);
+  for (const auto& v : visible) {
+    int   chunk = v.second;
+    int   count = (int)std::min<size_t>(BeadStore::c_ChunkSize, m_Uploaded - (size_t)chunk * BeadStore::c_ChunkSize);
+    const std::vector<BeadStore::t_segment>& simplified = store.simplified(chunk);
+    bool  thin  = store.info(chunk).radius * m_FocalPixels < c_SimplifyBelowPixels * v.first;
+    if (thin && count == BeadStore::c_ChunkSize && !simplified.empty()) {
+      GLuint& buf = m_SimplifiedBuffers[chunk];
+      if (buf == 0) {
+        glGenBuffers(1, &buf);
+        glBindBuffer(GL_ARRAY_BUFFER, buf);
+        glBufferData(GL_ARRAY_BUFFER, simplified.size() * sizeof(BeadStore::t_segment), simplified.data(), GL_STATIC_DRAW);
+      }
+      drawRange(buf, 0, (int)simplified.size());
+      m_NumSimplified++;
+    } else {
+      drawRange(m_Buffers[chunk], 0, count);
+    }
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  // new ones
+  drawNew(store);
+}
+
+// --------------------------------------------------------------
@@ -0,0 +1,110 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+#include <LibSL_gl.h>
+
+#include "bead_store.h"
+
+// ----------------------------------------------------------------
+
+// Draws the segments of a BeadStore with instancing: each segment is an
+// instance of a unit bead mesh (a cylinder and its two end spheres), the
+// vertex shader (deposition.vp) places it from the per-instance data,
+// which is the t_segment itself. Each store chunk has its own instance
+// buffer, segments are uploaded once and drawn with one call per chunk.
+//
+// In impostor mode the instance is a box bounding the bead instead, the
+// fragment shader ray casts the squashed capsule and writes its depth
+// (deposition shader compiled with IMPOSTOR defined).
+//
+// When all segments are drawn again, chunks outside the view frustum or
+// the clipping range are skipped, the others are drawn front to back so
+// that hidden ones are mostly rejected by the depth test. Full chunks
+// where the beads are thinner than a couple of pixels are drawn from
+// their simplified segments.
+class BeadRenderer
+{
+public:
+
+  enum e_Mesh { Mesh_Bead = 0, Mesh_Box = 1 };
+
+private:
+
+  typedef struct
+  {
+    GLuint  vao = 0;
+    GLuint  vertices = 0;
+    GLuint  indices = 0;
+    GLsizei num_indices = 0;
+  } t_mesh;
+
+  t_mesh              m_Meshes[2];
+  e_Mesh              m_Mesh = Mesh_Bead;
+  std::vector<GLuint> m_Buffers;           // instance buffers, one per store chunk
+  std::vector<GLuint> m_SimplifiedBuffers; // simplified segments of the chunks, 0 until needed
+  size_t              m_Uploaded = 0;      // segments of the store already in the instance buffers
+
+  // culling
+  bool                m_Cull = false;       // set with the view
+  m4x4f               m_ProjView;
+  float               m_FocalPixels = 0.0f; // pixels per unit at unit depth, 0 disables simplification
+  int                 m_Clip[4];            // layer min, max, line min, max (inclusive)
+  int                 m_NumDrawn = 0;       // chunks drawn by the last drawAll
+  int                 m_NumSimplified = 0;  // among them, drawn simplified
+
+  void createMesh(t_mesh& mesh, const std::vector<v4f>& vertices, const std::vector<uint>& indices);
+  void drawRange(GLuint buffer, int first, int count);
+  // nearest depth of the chunk in view, < 0 if culled
+  float chunkDepth(const BeadStore::t_chunk_info& info) const;
+
+public:
+
+  BeadRenderer();
+
+  // creates the unit bead mesh, requires a GL context
+  void init();
+  void terminate();
+
+  // forgets the uploaded segments, to be called when the store is cleared
+  void reset();
+
+  // view used for culling by drawAll, focal is the number of pixels
+  // covered by a unit length at unit depth
+  void setView(const m4x4f& projview, float focal_pixels);
+  // clipping range, see deposition.vp
+  void setClip(int layer_min, int layer_max, int line_min, int line_max);
+
+  // mesh instanced per segment, the matching shader has to be bound
+  void   setMesh(e_Mesh m) { m_Mesh = m; }
+  e_Mesh mesh() const     { return m_Mesh; }
+
+  // uploads and draws the segments added to the store since the last call
+  void drawNew(const BeadStore& store);
+  // draws all the segments of the store, skipping culled chunks
+  void drawAll(const BeadStore& store);
+
+  int  numDrawn()      const { return m_NumDrawn; }
+  int  numSimplified() const { return m_NumSimplified; }
+};
+
+// ----------------------------------------------------------------
@@ -0,0 +1,99 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "bead_store.h"
+
+#include <climits>
+#include <cmath>
+
+// --------------------------------------------------------------
+
+void BeadStore::clear()
+{
+  // keeps the first chunk, a new print starts without allocating
+  if (m_Chunks.size() > 1) {
+    m_Chunks.resize(1);
+  }
+  if (!m_Chunks.empty()) {
+    m_Chunks.front()->segments.clear();
+    m_Chunks.front()->simplified.clear();
+    clearInfo(m_Chunks.front()->info);
+  }
+  m_Size           = 0;
+  m_SimplifiedSize = 0;
+}
+
+// --------------------------------------------------------------
+
+void BeadStore::clearInfo(t_chunk_info& _info)
+{
+  _info.box       = AAB<3>();
+  _info.radius    = 0.0f;
+  _info.layer_min = INT_MAX;
+  _info.layer_max = INT_MIN;
+  _info.line_min  = INT_MAX;
+  _info.line_max  = INT_MIN;
+}
+
+// --------------------------------------------------------------
+
+// true if s can extend a run of merged segments (last is the run end)
+static bool mergeable(const BeadStore::t_segment& last, const BeadStore::t_segment& s)
+{
+  return s.a == last.b // continuous
+    && s.extruder == last.extruder && s.bridge == last.bridge && s.layer == last.layer
+    && std::abs(s.th - last.th) <= 0.05f * last.th
+    && std::abs(s.rs - last.rs) <= 0.05f * last.rs
+    && std::abs(s.dangling - last.dangling) < 0.1f
+    && std::abs(s.overlap  - last.overlap)  < 0.1f;
+}
+
+// --------------------------------------------------------------
+
+void BeadStore::simplify(const std::vector<t_segment>& segments, std::vector<t_segment>& _simplified)
+{
+  _simplified.clear();
+  size_t i = 0;
+  while (i < segments.size()) {
+    // extends the run while all its points stay close to the merged segment
+    const t_segment& first = segments[i];
+    float  tol2 = (0.1f * first.rs) * (0.1f * first.rs);
+    size_t j    = i + 1; // run is [i,j)
+    while (j < segments.size() && j - i < c_MaxMerged && mergeable(segments[j - 1], segments[j])) {
+      v3f   d  = segments[j].b - first.a;
+      float l2 = dot(d, d);
+      bool  ok = true;
+      for (size_t k = i; k < j && ok; k++) {
+        v3f   p = segments[k].b - first.a;
+        float t = l2 > 0.0f ? std::clamp(dot(p, d) / l2, 0.0f, 1.0f) : 0.0f;
+        v3f   e = p - d * t;
+        ok      = dot(e, e) <= tol2;
+      }
+      if (!ok) break;
+      j++;
+    }
+    t_segment merged = first;
+    merged.b         = segments[j - 1].b;
+    _simplified.push_back(merged);
+    i = j;
+  }
+}
+
+// --------------------------------------------------------------
@@ -0,0 +1,131 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// ----------------------------------------------------------------
+
+// Bead segments drawn since the last reset, retained so that a change of
+// view draws them again instead of simulating the print again.
+// Segments are stored in fixed size chunks: growing never moves or copies
+// the segments already stored, whatever the size of the print.
+// A segment is also the per-instance data of the bead renderer
+// (see bead_renderer.h), its layout is mirrored by deposition.vp.
+//
+// Each chunk keeps its bounds and layer and line ranges, for culling.
+// Deposition order is spatially coherent (layer after layer), so chunks
+// are compact. Once full, a chunk also gets a simplified version where
+// runs of nearly aligned segments are merged, drawn when far away.
+class BeadStore
+{
+public:
+
+  typedef struct
+  {
+    v3f   a;
+    v3f   b;
+    float th;
+    float r;
+    float rs;       // radius squashed to th (see disk_squashed_radius)
+    float dangling;
+    float overlap;
+    short extruder;
+    short bridge;
+    int   line;     // gcode line, for clipping (see deposition.vp)
+    int   layer;
+  } t_segment;
+
+  typedef struct
+  {
+    AAB<3> box;       // bounds of the beads (radius and thickness included)
+    float  radius;    // largest squashed radius
+    int    layer_min;
+    int    layer_max;
+    int    line_min;
+    int    line_max;
+  } t_chunk_info;
+
+  static const int c_ChunkSize = 16384; // segments
+  static const int c_MaxMerged = 64;    // segments merged at most into one
+
+private:
+
+  typedef struct
+  {
+    std::vector<t_segment> segments;
+    std::vector<t_segment> simplified; // empty until the chunk is full
+    t_chunk_info           info;
+  } t_chunk;
+
+  std::vector<std::unique_ptr<t_chunk> > m_Chunks;
+  size_t                                 m_Size = 0;
+  size_t                                 m_SimplifiedSize = 0;
+
+  static void clearInfo(t_chunk_info& _info);
+  static void simplify(const std::vector<t_segment>& segments, std::vector<t_segment>& _simplified);
+
+public:
+
+  BeadStore() {}
+
+  void add(const t_segment& s)
+  {
+    if (m_Chunks.empty() || m_Chunks.back()->segments.size() == c_ChunkSize) {
+      m_Chunks.push_back(std::unique_ptr<t_chunk>(new t_chunk()));
+      m_Chunks.back()->segments.reserve(c_ChunkSize);
+      clearInfo(m_Chunks.back()->info);
+    }
+    t_chunk& c = *m_Chunks.back();
+    c.segments.push_back(s);
+    t_chunk_info& info = c.info;
+    // the bead is lowered by the squash and cut at th below the top (see deposition.vp)
+    info.box.addPoint(s.a - v3f(s.rs, s.rs, s.th));
+    info.box.addPoint(s.a + v3f(s.rs, s.rs, 0.0f));
+    info.box.addPoint(s.b - v3f(s.rs, s.rs, s.th));
+    info.box.addPoint(s.b + v3f(s.rs, s.rs, 0.0f));
+    info.radius    = std::max(info.radius, s.rs);
+    info.layer_min = std::min(info.layer_min, s.layer);
+    info.layer_max = std::max(info.layer_max, s.layer);
+    info.line_min  = std::min(info.line_min, s.line);
+    info.line_max  = std::max(info.line_max, s.line);
+    m_Size++;
+    if (c.segments.size() == c_ChunkSize) {
+      simplify(c.segments, c.simplified);
+      m_SimplifiedSize += c.simplified.size();
+    }
+  }
+
+  void   clear();
+
+  size_t size()      const { return m_Size; }
+  int    numChunks() const { return (int)m_Chunks.size(); }
+  const std::vector<t_segment>& chunk(int c)      const { return m_Chunks[c]->segments; }
+  const std::vector<t_segment>& simplified(int c) const { return m_Chunks[c]->simplified; }
+  const t_chunk_info&           info(int c)       const { return m_Chunks[c]->info; }
+  size_t byteSize()  const { return (m_Chunks.size() * c_ChunkSize + m_SimplifiedSize) * sizeof(t_segment); }
+};
+
+// ----------------------------------------------------------------
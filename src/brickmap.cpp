@@ -0,0 +1,345 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "brickmap.h"
+#include "disk_table.h"
+
+#include <climits>
+#include <algorithm>
+
+// --------------------------------------------------------------
+
+const float c_BrickMapEpsilon = 0.001f; // 1 um, as the height field thickness epsilon
+
+// --------------------------------------------------------------
+
+BrickMap::BrickMap()
+{
+  m_NumBricks = 0;
+  m_Saturated = false;
+}
+
+// --------------------------------------------------------------
+
+void BrickMap::allocate(const AAB<3>& box, float voxel, size_t max_bytes)
+{
+  m_Origin    = box.minCorner();
+  m_Voxel     = voxel;
+  int nx      = std::max(1, (int)ceil(box.extent()[0] / voxel) + 1);
+  int ny      = std::max(1, (int)ceil(box.extent()[1] / voxel) + 1);
+  m_ColsX     = (nx + c_BrickSize - 1) / c_BrickSize;
+  m_ColsY     = (ny + c_BrickSize - 1) / c_BrickSize;
+  m_MaxBricks = std::max(c_ChunkSize, (int)std::min<size_t>(max_bytes / sizeof(t_brick), (size_t)1 << 30));
+  m_Chunks    = std::vector<std::atomic<t_brick*> >((m_MaxBricks + c_ChunkSize - 1) / c_ChunkSize);
+  clear();
+}
+
+// --------------------------------------------------------------
+
+void BrickMap::clear()
+{
+  m_Columns.clear();
+  m_Columns.resize((size_t)m_ColsX * (size_t)m_ColsY);
+  ForIndex(c, m_Chunks.size()) {
+    m_Chunks[c] = nullptr;
+  }
+  m_ChunksStorage.clear();
+  m_NumBricks = 0;
+  m_Saturated = false;
+}
+
+// --------------------------------------------------------------
+
+int BrickMap::newBrick()
+{
+  int b = m_NumBricks.fetch_add(1);
+  if (b >= m_MaxBricks) {
+    m_NumBricks = m_MaxBricks;
+    if (!m_Saturated.exchange(true)) {
+      std::cerr << Console::yellow << "[brickmap] memory budget reached, new material is ignored" << Console::gray << std::endl;
+    }
+    return -1;
+  }
+  int c = b / c_ChunkSize;
+  if (m_Chunks[c].load() == nullptr) {
+    std::lock_guard<std::mutex> lock(m_ChunksMutex);
+    if (m_Chunks[c].load() == nullptr) {
+      std::unique_ptr<t_brick[]> chunk(new t_brick[c_ChunkSize]);
+      m_Chunks[c] = chunk.get();
+      m_ChunksStorage.push_back(std::move(chunk));
+    }
+  }
+  t_brick *brk = brick(b);
+  ForIndex(n, c_BrickSize * c_BrickSize) {
+    brk->cols[n].store(0, std::memory_order_relaxed);
+  }
+  return b;
+}
+
+// --------------------------------------------------------------
+
+int BrickMap::findOrAddBrick(int c, int bz)
+{
+  // caller holds the column stripe
+  std::vector<std::pair<int, int> >& bricks = m_Columns[c].bricks;
+  auto B = std::lower_bound(bricks.begin(), bricks.end(), std::make_pair(bz, -1));
+  if (B != bricks.end() && B->first == bz) {
+    return B->second;
+  }
+  int b = newBrick();
+  if (b < 0) return -1;
+  bricks.insert(B, std::make_pair(bz, b));
+  return b;
+}
+
+// --------------------------------------------------------------
+
+v2i BrickMap::cell(const v3f& a) const
+{
+  return v2i(
+    (int)round((a[0] - m_Origin[0]) / m_Voxel),
+    (int)round((a[1] - m_Origin[1]) / m_Voxel));
+}
+
+int BrickMap::voxelK(float z) const
+{
+  return (int)floor(z / m_Voxel);
+}
+
+// --------------------------------------------------------------
+
+bool BrickMap::columnSpan(int i, int j, int k0, int k1, t_span& _span) const
+{
+  i  = std::clamp(i, 0, m_ColsX * c_BrickSize - 1);
+  j  = std::clamp(j, 0, m_ColsY * c_BrickSize - 1);
+  k0 = std::max(k0, 0);
+  if (k1 < k0) return false;
+  _span.c  = (i / c_BrickSize) + (j / c_BrickSize) * m_ColsX;
+  _span.lc = (i % c_BrickSize) + (j % c_BrickSize) * c_BrickSize;
+  _span.k0 = k0;
+  _span.k1 = k1;
+  return true;
+}
+
+// --------------------------------------------------------------
+
+void BrickMap::setSpans(std::vector<t_span>& spans)
+{
+  // group by brick column, skipping duplicates
+  std::sort(spans.begin(), spans.end(), [](const t_span& a, const t_span& b) {
+    return a.c != b.c ? a.c < b.c : a.lc != b.lc ? a.lc < b.lc : a.k0 != b.k0 ? a.k0 < b.k0 : a.k1 < b.k1;
+  });
+  size_t n = 0;
+  while (n < spans.size()) {
+    int c = spans[n].c;
+    std::lock_guard<std::mutex> lock(stripe(c));
+    int last_bz = INT_MIN, last_b = -1;
+    for (; n < spans.size() && spans[n].c == c; n++) {
+      const t_span& sp = spans[n];
+      if (n > 0 && spans[n - 1].c == c && spans[n - 1].lc == sp.lc && spans[n - 1].k0 == sp.k0 && spans[n - 1].k1 == sp.k1) {
+        continue;
+      }
+      for (int bz = sp.k0 / c_BrickSize; bz <= sp.k1 / c_BrickSize; bz++) {
+        int b = (bz == last_bz) ? last_b : findOrAddBrick(c, bz);
+        if (b < 0) break; // budget reached
+        last_bz = bz;
+        last_b  = b;
+        int lo = std::max(sp.k0 - bz * c_BrickSize, 0);
+        int hi = std::min(sp.k1 - bz * c_BrickSize, c_BrickSize - 1);
+        uchar bits = (uchar)(((1 << (hi + 1)) - 1) & ~((1 << lo) - 1));
+        brick(b)->cols[sp.lc].fetch_or(bits, std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+// --------------------------------------------------------------
+
+float BrickMap::columnSurface(int i, int j, int k_max) const
+{
+  if (k_max < 0) return 0.0f;
+  i = std::clamp(i, 0, m_ColsX * c_BrickSize - 1);
+  j = std::clamp(j, 0, m_ColsY * c_BrickSize - 1);
+  int c  = (i / c_BrickSize) + (j / c_BrickSize) * m_ColsX;
+  int lc = (i % c_BrickSize) + (j % c_BrickSize) * c_BrickSize;
+  std::lock_guard<std::mutex> lock(stripe(c));
+  const std::vector<std::pair<int, int> >& bricks = m_Columns[c].bricks;
+  // start from the brick holding the voxel above k_max, to know whether k_max is a surface
+  auto B = std::upper_bound(bricks.begin(), bricks.end(), std::make_pair((k_max + 1) / c_BrickSize, INT_MAX));
+  int  above_bz = INT_MAX; // brick visited before (above)
+  uint above    = 0;       // its lowest voxel
+  while (B != bricks.begin()) {
+    --B;
+    int  bz   = B->first;
+    uint bits = brick(B->second)->cols[lc].load(std::memory_order_relaxed);
+    if (above_bz != bz + 1) {
+      above = 0; // gap between bricks: empty above
+    }
+    // occupied voxels with an empty voxel above
+    uint surf = bits & ~((bits >> 1) | (above << (c_BrickSize - 1)));
+    int  hi   = std::min(k_max - bz * c_BrickSize, c_BrickSize - 1);
+    if (hi >= 0) {
+      surf &= (1u << (hi + 1)) - 1;
+      if (surf != 0) {
+        int top = c_BrickSize - 1;
+        while (!(surf & (1u << top))) top--;
+        return (float)(bz * c_BrickSize + top + 1) * m_Voxel;
+      }
+    }
+    above_bz = bz;
+    above    = bits & 1u;
+  }
+  return 0.0f;
+}
+
+// --------------------------------------------------------------
+
+bool BrickMap::columnAny(int i, int j, int k0, int k1) const
+{
+  k0 = std::max(k0, 0);
+  if (k1 < k0) return false;
+  i = std::clamp(i, 0, m_ColsX * c_BrickSize - 1);
+  j = std::clamp(j, 0, m_ColsY * c_BrickSize - 1);
+  int c  = (i / c_BrickSize) + (j / c_BrickSize) * m_ColsX;
+  int lc = (i % c_BrickSize) + (j % c_BrickSize) * c_BrickSize;
+  std::lock_guard<std::mutex> lock(stripe(c));
+  const std::vector<std::pair<int, int> >& bricks = m_Columns[c].bricks;
+  auto B = std::lower_bound(bricks.begin(), bricks.end(), std::make_pair(k0 / c_BrickSize, -1));
+  for (; B != bricks.end() && B->first <= k1 / c_BrickSize; B++) {
+    int  bz   = B->first;
+    uint bits = brick(B->second)->cols[lc].load(std::memory_order_relaxed);
+    int  lo   = std::max(k0 - bz * c_BrickSize, 0);
+    int  hi   = std::min(k1 - bz * c_BrickSize, c_BrickSize - 1);
+    if (bits & ((1u << (hi + 1)) - 1) & ~((1u << lo) - 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// --------------------------------------------------------------
+
+void BrickMap::rasterizeSegment(const v3f& a, const v3f& b, float r, float th)
+{
+  v3f   cur  = a;
+  v3f   step = b - a;
+  float len  = length(v2f(step));
+  int   N    = (int)round(r / m_Voxel);
+  const t_disk_table& disk = diskTable(N);
+  step = len < 1e-6f ? v3f(0.0f) : step / len;
+  // spans of all the disks along the segment, then set at once
+  thread_local std::vector<t_span> spans;
+  spans.clear();
+  float l = 0.0f;
+  v2i   prev_p(INT_MIN / 2);
+  int   prev_k0 = 0, prev_k1 = -1;
+  do {
+    // voxels whose center is within the bead thickness
+    int k0 = (int)ceil((cur[2] - th) / m_Voxel - 0.5f);
+    int k1 = (int)floor(cur[2] / m_Voxel - 0.5f);
+    v2i p  = cell(cur);
+    // columns already covered by the previous disk, with the same span, are skipped
+    v2i d  = (k0 == prev_k0 && k1 == prev_k1) ? p - prev_p : v2i(INT_MAX / 2);
+    t_span sp;
+    ForRange(nj, -N, N) {
+      int w  = disk.spans[nj + N];
+      int pj = nj + d[1];
+      int pw = (pj >= -N && pj <= N) ? disk.spans[pj + N] : -1;
+      ForRange(ni, -w, w) {
+        int pi = ni + d[0];
+        if (pi >= -pw && pi <= pw) continue;
+        if (columnSpan(p[0] + ni, p[1] + nj, k0, k1, sp)) {
+          spans.push_back(sp);
+        }
+      }
+    }
+    prev_p  = p;
+    prev_k0 = k0;
+    prev_k1 = k1;
+    cur += step * m_Voxel;
+    l   += m_Voxel;
+  } while (l < len);
+  setSpans(spans);
+}
+
+// --------------------------------------------------------------
+
+float BrickMap::heightAt(const v3f& a, float r) const
+{
+  // top surfaces below the query, ignoring surfaces within half a voxel
+  // of the query height: these are due to aliasing (same as the thickness
+  // epsilon of the height field)
+  int   k_max = (int)ceil(a[2] / m_Voxel - 1.0f - c_BrickMapEpsilon / m_Voxel) - 1;
+  float h = 0.0f;
+  int   N = std::max(1, (int)round(r / m_Voxel));
+  v2i   p = cell(a);
+  ForRange(nj, -N, N) {
+    ForRange(ni, -N, N) {
+      h = std::max(h, columnSurface(p[0] + ni, p[1] + nj, k_max));
+    }
+  }
+  return h;
+}
+
+// --------------------------------------------------------------
+
+float BrickMap::danglingAt(float max_th, const v3f& a, float r) const
+{
+  // dangling where nothing lies within max_th (+50 um) below the query
+  int   k_max = (int)ceil(a[2] / m_Voxel - 1.0f - c_BrickMapEpsilon / m_Voxel) - 1;
+  int   k_min = voxelK(a[2] - max_th - 0.05f);
+  float d = 0.0f;
+  int   N = std::max(1, (int)round(r / m_Voxel));
+  v2i   p = cell(a);
+  const t_disk_table& disk = diskTable(N);
+  ForRange(nj, -N, N) {
+    int w = disk.spans[nj + N];
+    ForRange(ni, -w, w) {
+      if (!columnAny(p[0] + ni, p[1] + nj, k_min, k_max)) {
+        d += 1.0f;
+      }
+    }
+  }
+  return d / (float)(disk.num);
+}
+
+// --------------------------------------------------------------
+
+float BrickMap::overlapAt(float th, const v3f& a, float r) const
+{
+  // overlap where material already occupies the top of the bead
+  int   k0 = (int)floor(a[2] / m_Voxel - 0.5f);        // top voxel of a bead ending at a[2]
+  int   k1 = (int)floor(a[2] / m_Voxel);                // voxel of the nozzle tip
+  float o = 0.0f;
+  int   N = std::max(1, (int)round(r / m_Voxel));
+  v2i   p = cell(a);
+  const t_disk_table& disk = diskTable(N);
+  ForRange(nj, -N, N) {
+    int w = disk.spans[nj + N];
+    ForRange(ni, -w, w) {
+      if (columnAny(p[0] + ni, p[1] + nj, k0, k1)) {
+        o += 1.0f;
+      }
+    }
+  }
+  return o / (float)(disk.num);
+}
+
+// --------------------------------------------------------------
@@ -0,0 +1,122 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+
+// ----------------------------------------------------------------
+
+// Sparse voxel occupancy, made of 8^3 bricks allocated on demand.
+// Unlike the height field it does not assume z grows monotonically:
+// queries look for material below (or around) the query point only,
+// so z-hops, sequential printing and non-planar moves are supported.
+//
+// Bricks of a same 8x8 column footprint are kept sorted by z, so looking
+// down a column only visits existing bricks. Voxel bits are set atomically
+// and columns are guarded by striped locks: rasterization and queries
+// can run from several threads. A segment is rasterized as a list of voxel
+// spans, set under a single lock per brick column. The number of bricks is
+// capped by a memory budget, once reached new material is ignored (see
+// saturated(), reported with the stats and in the UI).
+class BrickMap
+{
+public:
+
+  static const int c_BrickSize = 8;
+
+private:
+
+  // 8x8 columns of 8 bits (one bit per voxel along z)
+  typedef struct {
+    std::atomic<uchar> cols[c_BrickSize * c_BrickSize];
+  } t_brick;
+
+  typedef struct {
+    std::vector<std::pair<int, int> > bricks; // (brick z, brick index) sorted by brick z
+  } t_column;
+
+  // occupied voxels [k0,k1] of voxel column lc (in the brick footprint) of brick column c
+  typedef struct {
+    int c, lc, k0, k1;
+  } t_span;
+
+  static const int c_ChunkSize  = 4096; // bricks per allocation
+  static const int c_NumStripes = 256;  // column locks
+
+  v3f                        m_Origin;
+  float                      m_Voxel = 0.04f;
+  int                        m_ColsX = 0; // number of brick columns
+  int                        m_ColsY = 0;
+  std::vector<t_column>      m_Columns;
+  std::vector<std::atomic<t_brick*> > m_Chunks;
+  std::mutex                 m_ChunksMutex;
+  std::atomic<int>           m_NumBricks;
+  int                        m_MaxBricks = 0;
+  std::atomic<bool>          m_Saturated;
+  mutable std::mutex         m_Stripes[c_NumStripes];
+
+  std::vector<std::unique_ptr<t_brick[]> > m_ChunksStorage;
+
+  std::mutex& stripe(int c) const { return m_Stripes[c & (c_NumStripes - 1)]; }
+
+  t_brick *brick(int b) const { return &m_Chunks[b / c_ChunkSize].load()[b % c_ChunkSize]; }
+  int      newBrick();
+  int      findOrAddBrick(int c, int bz);
+
+  int      voxelK(float z) const;
+  // span of voxel column (i,j), false if empty
+  bool     columnSpan(int i, int j, int k0, int k1, t_span& _span) const;
+  // sets the spans, sorted by brick column, locking each brick column once
+  void     setSpans(std::vector<t_span>& spans);
+  // height (in mm) of the highest top surface of column (i,j) whose voxel is at most k_max
+  // (an occupied voxel with an empty one above), returns 0 (the bed) if none
+  float    columnSurface(int i, int j, int k_max) const;
+  // true if any voxel of column (i,j) in [k0,k1] is occupied
+  bool     columnAny(int i, int j, int k0, int k1) const;
+
+public:
+
+  BrickMap();
+
+  // voxels are cubes of size voxel, box is the xy extent of the print
+  void   allocate(const AAB<3>& box, float voxel, size_t max_bytes);
+  void   clear();
+
+  // deposits a bead of radius r and thickness th along a segment (top at a,b)
+  void   rasterizeSegment(const v3f& a, const v3f& b, float r, float th);
+
+  // same semantics as the height field queries
+  float  heightAt(const v3f& a, float r) const;
+  float  danglingAt(float max_th, const v3f& a, float r) const;
+  float  overlapAt(float th, const v3f& a, float r) const;
+
+  v2i    cell(const v3f& a) const;
+  float  voxelSize() const { return m_Voxel; }
+  int    numBricks() const { return m_NumBricks; }
+  size_t byteSize()  const { return (size_t)m_NumBricks * sizeof(t_brick); }
+  bool   saturated() const { return m_Saturated; }
+};
+
+// ----------------------------------------------------------------
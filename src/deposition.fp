@@ -5,26 +5,139 @@ in vec3   v_pos;
 uniform float  u_ZNear;
 uniform float  u_ZFar;
 
-uniform float  u_extruder; // never 0, 1 for extruder 0
-
-uniform float  u_bridge;
-
 in float  v_dangling;
 in float  v_overlap;
+flat in float v_extruder; // never 0, 1 for extruder 0 (0 in the g-buffer: empty)
+flat in float v_bridge;
+flat in mat3  v_viewrot;
+
+#ifdef IMPOSTOR
+flat in vec3  v_eye;
+flat in vec3  v_a;
+flat in vec3  v_b;
+flat in vec3  v_size;
+flat in vec4  v_viewz;
+flat in vec4  v_clipz;
+flat in vec4  v_clipw;
+
+const float c_Far = 1e20;
+
+// entry and exit of a ray (rd normalized) in a sphere, empty if x > y
+vec2 raySphere(vec3 ro, vec3 rd, vec3 c, float r)
+{
+  vec3  oc = ro - c;
+  float b  = dot(oc, rd);
+  float h  = b * b - (dot(oc, oc) - r * r);
+  if (h < 0.0) return vec2(c_Far, -c_Far);
+  h = sqrt(h);
+  return vec2(-b - h, -b + h);
+}
+
+// entry and exit of a ray in the cylinder of axis a + w * [0,l], without caps
+vec2 rayCylinder(vec3 ro, vec3 rd, vec3 a, vec3 w, float l, float r)
+{
+  vec3  oc  = ro - a;
+  float ow  = dot(oc, w);
+  float dw  = dot(rd, w);
+  vec3  ocp = oc - w * ow;
+  vec3  rdp = rd - w * dw;
+  float A   = dot(rdp, rdp);
+  float B   = dot(ocp, rdp);
+  float C   = dot(ocp, ocp) - r * r;
+  vec2  t   = vec2(-c_Far, c_Far);
+  if (A > 0.0) {
+    float h = B * B - A * C;
+    if (h < 0.0) return vec2(c_Far, -c_Far);
+    h = sqrt(h);
+    t = vec2(-B - h, -B + h) / A;
+  } else if (C > 0.0) {
+    return vec2(c_Far, -c_Far);
+  }
+  // along the axis
+  if (dw != 0.0) {
+    vec2 s = vec2(-ow, l - ow) / dw;
+    t = vec2(max(t.x, min(s.x, s.y)), min(t.y, max(s.x, s.y)));
+  } else if (ow < 0.0 || ow > l) {
+    return vec2(c_Far, -c_Far);
+  }
+  return t;
+}
+#else
+in vec3       v_world;
+flat in vec3  v_a;
+flat in vec3  v_b;
+flat in vec2  v_cut;
+#endif
 
-out vec4 fragColor;
+// g-buffer (see g_GBuffer)
+layout(location = 0) out vec4 fragDepth; // normalized view depth, coverage (1)
+layout(location = 1) out vec4 fragAttr;  // view normal xy, stats, tool
 
 void main()
 {  
-  float z   = (-v_pos.z - u_ZNear) / (u_ZFar - u_ZNear); // normalize z coord wrt frustum
-  float z_h = floor(z * 256.0) / 255.0; // 8 second bits, integer part of z mapped to the 0-255 range (i.e., 1 byte range) then normalized to 0-1 range
-  float z_l = fract(z * 256.0); // 8 first bits, fractional part of z mapped to the 0-255 range (i.e., 1 byte range). it's always in the 0-1 range
+#ifdef IMPOSTOR
+  // ray cast the capsule, cut by the bead bottom and top planes
+  vec3  ro = v_eye;
+  vec3  rd = normalize(v_pos - v_eye);
+  float rs = v_size.x;
+  vec3  ax = v_b - v_a;
+  float l  = length(ax);
+  // capsule is convex: union of the spans of its parts
+  vec2  s  = raySphere(ro, rd, v_a, rs);
+  vec2  s1 = raySphere(ro, rd, v_b, rs);
+  s        = vec2(min(s.x, s1.x), max(s.y, s1.y));
+  if (l > 0.0) {
+    vec2 c = rayCylinder(ro, rd, v_a, ax / l, l, rs);
+    if (c.x <= c.y) {
+      s = vec2(min(s.x, c.x), max(s.y, c.y));
+    }
+  }
+  // z planes
+  bool on_plane = false;
+  if (rd.z != 0.0) {
+    vec2 z = (vec2(v_size.y, v_size.z) - ro.z) / rd.z;
+    on_plane = min(z.x, z.y) > s.x;
+    s = vec2(max(s.x, min(z.x, z.y)), min(s.y, max(z.x, z.y)));
+  } else if (ro.z < v_size.y || ro.z > v_size.z) {
+    discard;
+  }
+  s.x = max(s.x, 0.0);
+  if (s.x > s.y) {
+    discard;
+  }
+  vec4  hit    = vec4(ro + rd * s.x, 1.0);
+  float view_z = dot(v_viewz, hit);
+  gl_FragDepth = 0.5 * dot(v_clipz, hit) / dot(v_clipw, hit) + 0.5;
+  vec3  nrm;
+  if (on_plane) {
+    nrm = vec3(0.0, 0.0, rd.z < 0.0 ? 1.0 : -1.0);
+  } else {
+    float t = l > 0.0 ? clamp(dot(hit.xyz - v_a, ax) / (l * l), 0.0, 1.0) : 0.0;
+    nrm = normalize(hit.xyz - (v_a + ax * t));
+  }
+#else
+  float view_z = v_pos.z;
+  // normal of the capsule rather than of its parts, so that the
+  // sphere and cylinder meshes agree where they overlap
+  vec3  ax     = v_b - v_a;
+  float l2     = dot(ax, ax);
+  float t      = l2 > 0.0 ? clamp(dot(v_world - v_a, ax) / l2, 0.0, 1.0) : 0.0;
+  vec3  nrm    = normalize(v_world - (v_a + ax * t));
+  if (v_world.z >= v_cut.y - 1e-4) {
+    nrm = vec3(0.0, 0.0, 1.0);  // flat top
+  } else if (v_world.z <= v_cut.x + 1e-4) {
+    nrm = vec3(0.0, 0.0, -1.0); // flat bottom
+  }
+#endif
+  nrm = v_viewrot * nrm;
+  float z   = (-view_z - u_ZNear) / (u_ZFar - u_ZNear); // normalize z coord wrt frustum
   float d   = clamp(v_dangling * 0.5, 0.0 ,0.45);
   float o   = clamp(v_overlap  * 0.5, 0.0, 0.45);
 
-  if (u_bridge == 1.0) { // special case for bridges
-    fragColor = vec4(z_l, z_h, 1.0, u_extruder / 255.0);
+  fragDepth = vec4(z, 1.0, 0.0, 0.0);
+  if (v_bridge == 1.0) { // special case for bridges
+    fragAttr = vec4(nrm.xy, 1.0, v_extruder);
   } else {
-    fragColor = vec4(z_l, z_h, (o == 0.0 ? d : 0.5 + o), u_extruder / 255.0);
+    fragAttr = vec4(nrm.xy, (o == 0.0 ? d : 0.5 + o), v_extruder);
   }
 }
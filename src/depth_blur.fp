@@ -0,0 +1,23 @@
+#string settings
+
+in vec2      v_uv;
+
+uniform sampler2D u_depth;  // g-buffer depth (deposition.fp)
+uniform vec3      u_pixsz;  // see final.fp
+
+uniform int       u_step;   // 1 all taps, 2 every other, ...
+
+out vec4 fragColor;
+
+// horizontal pass of the local depth average used by final.fp:
+// sum of the depths of the covered pixels and their number
+void main()
+{
+  const int N = 11;
+  int  M   = N / u_step;
+  vec2 acc = vec2(0.0);
+  for (int k = -M; k <= M; k++) {
+    acc += texture(u_depth, v_uv + u_pixsz.xz * float(k * u_step)).xy; // (0,0) where empty
+  }
+  fragColor = vec4(acc, 0.0, 0.0);
+}
@@ -0,0 +1,84 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <algorithm>
+
+// ----------------------------------------------------------------
+
+// Rasterized disks, as rows of cells: cell (ni,nj) is covered if ni^2 + nj^2 < N^2
+// Tables only depend on the radius in cells, the cell size is applied by the callers.
+
+typedef struct
+{
+  std::vector<int> spans; // half width of each row, from -N to N (-1 for an empty row)
+  int              num;   // number of cells covered
+} t_disk_table;
+
+const int c_MaxDiskRadius = 256; // cells, larger tables are built on demand
+
+inline t_disk_table makeDiskTable(int n)
+{
+  t_disk_table tbl;
+  tbl.spans.resize(2 * n + 1);
+  tbl.num = 0;
+  int w = -1;
+  for (int nj = 0; nj <= n; nj++) { // rows shrink away from the center
+    w = (nj == 0) ? n : w;
+    while (w >= 0 && w * w + nj * nj >= n * n) {
+      w--;
+    }
+    tbl.spans[n + nj] = w;
+    tbl.spans[n - nj] = w;
+    if (w >= 0) {
+      tbl.num += (nj == 0 ? 1 : 2) * (2 * w + 1);
+    }
+  }
+  return tbl;
+}
+
+// returns the table for a disk of radius N (in cells), covering rows -N to N
+// tables up to c_MaxDiskRadius are built once, on first use, and are read-only
+// afterwards (safe across threads), larger ones (very fine cells, squashed radii)
+// are built on demand and kept per thread
+inline const t_disk_table& diskTable(int N)
+{
+  static const std::vector<t_disk_table> tables = []() {
+    std::vector<t_disk_table> tbls(c_MaxDiskRadius + 1);
+    for (int n = 0; n <= c_MaxDiskRadius; n++) {
+      tbls[n] = makeDiskTable(n);
+    }
+    return tbls;
+  }();
+  if (N <= c_MaxDiskRadius) {
+    return tables[std::max(N, 0)];
+  }
+  thread_local std::map<int, t_disk_table> large;
+  auto it = large.find(N);
+  if (it == large.end()) {
+    it = large.emplace(N, makeDiskTable(N)).first;
+  }
+  return it->second;
+}
+
+// ----------------------------------------------------------------
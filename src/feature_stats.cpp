@@ -0,0 +1,108 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "feature_stats.h"
+#include "gcode.h"
+
+// --------------------------------------------------------------
+
+void FeatureStats::clear()
+{
+  m_Entries.clear();
+  m_LastKey   = t_key(-1, -1);
+  m_LastEntry = nullptr;
+}
+
+// --------------------------------------------------------------
+
+void FeatureStats::merge(const FeatureStats& s)
+{
+  for (const auto& kv : s.m_Entries) {
+    t_entry& e = m_Entries[kv.first];
+    e.deposition     += kv.second.deposition;
+    e.time           += kv.second.time;
+    e.dangling       += kv.second.dangling;
+    e.overlap        += kv.second.overlap;
+    e.dangling_spans += kv.second.dangling_spans;
+    e.overlap_spans  += kv.second.overlap_spans;
+    e.bridges        += kv.second.bridges;
+    e.flow_sum       += kv.second.flow_sum;
+    e.flow_max        = std::max(e.flow_max, kv.second.flow_max);
+  }
+}
+
+// --------------------------------------------------------------
+
+static std::string role_label(int role)
+{
+  std::string name = gcode_role_name(role);
+  return name.empty() ? std::string("(none)") : name;
+}
+
+// --------------------------------------------------------------
+
+void FeatureStats::print(std::ostream& out) const
+{
+  out << sprint("%-4s %-24s %12s %10s %12s %12s %8s %10s", "tool", "role", "deposit (mm)", "time (s)",
+                "dangling(mm)", "overlap (mm)", "bridges", "flow mean") << std::endl;
+  for (const auto& kv : m_Entries) {
+    const t_entry& e = kv.second;
+    if (e.deposition <= 0.0) continue; // travels only
+    out << sprint("T%-3d %-24s %12.1f %10.1f %12.1f %12.1f %8u %10.2f",
+                  kv.first.first, role_label(kv.first.second).c_str(), e.deposition, e.time / 1000.0,
+                  e.dangling, e.overlap, e.bridges, e.flow_sum / e.deposition) << std::endl;
+  }
+}
+
+// --------------------------------------------------------------
+
+void FeatureStats::writeCSVHeader(std::ostream& out)
+{
+  out << "label,tool,role,deposition_mm,time_s,dangling_mm,dangling_count,overlap_mm,overlap_count,bridges,flow_mean,flow_max" << std::endl;
+}
+
+// --------------------------------------------------------------
+
+void FeatureStats::writeCSV(std::ostream& out, const std::string& label) const
+{
+  for (const auto& kv : m_Entries) {
+    const t_entry& e = kv.second;
+    out << csv_quote(label) << ',' << kv.first.first << ',' << csv_quote(role_label(kv.first.second))
+        << ',' << e.deposition << ',' << e.time / 1000.0
+        << ',' << e.dangling << ',' << e.dangling_spans
+        << ',' << e.overlap << ',' << e.overlap_spans
+        << ',' << e.bridges
+        << ',' << (e.deposition > 0.0 ? e.flow_sum / e.deposition : 0.0) << ',' << e.flow_max << std::endl;
+  }
+}
+
+// --------------------------------------------------------------
+
+std::string csv_quote(const std::string& s)
+{
+  std::string q = "\"";
+  for (char c : s) {
+    if (c == '"') q += '"';
+    q += c;
+  }
+  return q + '"';
+}
+
+// --------------------------------------------------------------
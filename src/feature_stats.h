@@ -0,0 +1,107 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+
+#include <iostream>
+#include <map>
+
+// ----------------------------------------------------------------
+
+// Statistics broken down by tool and feature role (see gcode_role).
+// Each simulation thread fills its own table, tables of several threads
+// or files are merged exactly. The entry of the last key is cached, keys
+// only change at tool changes and role comments.
+class FeatureStats
+{
+public:
+
+  typedef std::pair<int, int> t_key; // (tool, role)
+
+  typedef struct {
+    double deposition = 0.0; // mm
+    double time       = 0.0; // ms, simulated, print moves only
+    double dangling   = 0.0; // mm
+    double overlap    = 0.0; // mm
+    uint   dangling_spans = 0;
+    uint   overlap_spans  = 0;
+    uint   bridges    = 0;
+    double flow_sum   = 0.0; // flow x length, for the mean
+    double flow_max   = 0.0; // mm^3/s
+  } t_entry;
+
+private:
+
+  std::map<t_key, t_entry> m_Entries;
+  t_key                    m_LastKey   = t_key(-1, -1);
+  t_entry                 *m_LastEntry = nullptr;
+
+public:
+
+  FeatureStats() {}
+  FeatureStats(const FeatureStats& s) : m_Entries(s.m_Entries) {}
+  FeatureStats& operator=(const FeatureStats& s)
+  {
+    m_Entries   = s.m_Entries;
+    m_LastKey   = t_key(-1, -1);
+    m_LastEntry = nullptr;
+    return *this;
+  }
+
+  t_entry& at(int tool, int role)
+  {
+    t_key k(tool, role);
+    if (m_LastEntry == nullptr || k != m_LastKey) {
+      m_LastKey   = k;
+      m_LastEntry = &m_Entries[k]; // map entries do not move
+    }
+    return *m_LastEntry;
+  }
+
+  // print move of length len (mm) lasting ms, at a given flow (mm^3/s)
+  void addDeposition(int tool, int role, double len, double ms, double flow)
+  {
+    t_entry& e = at(tool, role);
+    e.deposition += len;
+    e.time       += ms;
+    e.flow_sum   += flow * len;
+    e.flow_max    = std::max(e.flow_max, flow);
+  }
+
+  void clear();
+  void merge(const FeatureStats& s);
+  bool empty() const { return m_Entries.empty(); }
+  const std::map<t_key, t_entry>& entries() const { return m_Entries; }
+
+  // one line per (tool, role)
+  void print(std::ostream& out) const;
+  // csv rows, prefixed with a label column (eg. the file name)
+  static void writeCSVHeader(std::ostream& out);
+  void        writeCSV(std::ostream& out, const std::string& label) const;
+};
+
+// ----------------------------------------------------------------
+
+// a CSV field between quotes, inner quotes doubled (file names may hold quotes or commas)
+std::string csv_quote(const std::string& s);
+
+// ----------------------------------------------------------------
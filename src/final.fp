@@ -2,54 +2,42 @@
 
 in vec2      v_uv;
 
-uniform sampler2D u_texpts;
-uniform vec3      u_pixsz; // v(1/w, 1/h, 0) size pixel screen space // texture space (u,v) - screen space
-uniform vec2      u_texscl; // remapping from squared texture (g-buffer, deposition.fp) to screen space
-
-uniform float  u_ZNear;
-uniform float  u_ZFar;
+uniform sampler2D u_depth;    // g-buffer (deposition.fp): normalized view depth, coverage
+uniform sampler2D u_attr;     // g-buffer: view normal xy, stats, tool
+uniform vec3      u_pixsz;    // v(1/w, 1/h, 0) size of a pixel in texture space
 
 uniform int    u_color_overhangs;
 
-out vec4 fragColor;
+uniform sampler2D u_depthavg; // horizontal depth sums (depth_blur.fp)
+uniform int       u_ao_step;  // ambient occlusion taps spacing, 0 disables it
 
-float decode_float(vec4 v) { return (v.x*256.0 + v.y*255.0*256.0) / 65536.0; } // it could be vec2 // reconstruct screen-space z
-float decode_tool(vec4 v) { return v.w * 255.0; }
+out vec4 fragColor;
 
 void main()
 {
-  vec4 tex = texture(u_texpts, v_uv * u_texscl); // current pixel
+  vec2 z_c = texture(u_depth, v_uv).xy; // current pixel
 
-  if (tex.w == 0.0) discard; // texture was cleared before, then z=0 means we didn't write to it
+  if (z_c.y == 0.0) discard; // nothing was drawn there
 
-  float z_00 = decode_float(tex); // current z of texture
-  float z_01 = decode_float(texture(u_texpts, v_uv * u_texscl + u_pixsz.xz)); // z pixel to the right (should be called z_10)
-  float z_10 = decode_float(texture(u_texpts, v_uv * u_texscl + u_pixsz.zy)); // z pixel below (should be called z_01)
+  vec4  attr = texture(u_attr, v_uv);
+  float z_00 = z_c.x;
+  float tool = attr.w;
 
-  float tool = decode_tool(tex);
-
-  // loca average (squared window) of depth
-  // this could be optimized
-  const int N = 11;
-  float z_avg = 0.0;
-  float num = 0.0;
-  for (int j = -N; j <= N; j++) {
-    for (int i = -N; i <= N; i++) {
-      vec4 zhl = texture(u_texpts, v_uv * u_texscl + u_pixsz.xy * vec2(i, j));
-      if (zhl.w > 0.0) {
-        float z_ij = decode_float(zhl);
-        z_avg = z_avg + z_ij;
-        num += 1.0;
-      }
+  // local average (squared window) of depth, vertical pass over the
+  // horizontal sums of depth_blur.fp
+  float z_avg = z_00;
+  if (u_ao_step > 0) {
+    const int N = 11;
+    int  M   = N / u_ao_step;
+    vec2 acc = vec2(0.0);
+    for (int k = -M; k <= M; k++) {
+      acc += texture(u_depthavg, v_uv + u_pixsz.zy * float(k * u_ao_step)).xy;
     }
+    z_avg = acc.x / acc.y; // the current pixel is always counted
   }
-  z_avg = z_avg / num;
 
-  vec3 p = vec3(0.3 * u_pixsz.xz / u_texscl, z_01 - z_00); // current - right
-  vec3 q = vec3(0.3 * u_pixsz.zy / u_texscl, z_10 - z_00); // current - below
+  vec3 nrm = vec3(attr.xy, sqrt(max(0.0, 1.0 - dot(attr.xy, attr.xy)))); // view space normal, facing the camera
 
-  vec3 nrm = normalize(cross(p, q)); // screen space normal normal
-  
   // ambient occlusion (ssao)
   float ao = 1.0;  // ambient occlusion factor
   if (z_avg < z_00) {// z average behind of current z (i.e., concave region) -- darken color
@@ -58,7 +46,7 @@ void main()
   } // no else because z in front of current z (i.e., convex region) -- color is kept as is
 
   if (u_color_overhangs == 1) { // overhang in red
-    float d = tex.z;
+    float d = attr.z;
     float o = 0.0;
     vec3 clr;
     if (d == 1.0) {
@@ -87,5 +75,4 @@ void main()
 
     fragColor = vec4(ao * nrm.z * final_clr, 1.0); // ssao * diffuse * color
   }
-  //gl_FragColor = tex;
 }
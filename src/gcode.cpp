@@ -20,52 +20,109 @@
 
 #include "gcode.h"
 
+#include <mutex>
+
 // --------------------------------------------------------------
 
-typedef LibSL::BasicParser::BufferStream t_stream;
-typedef LibSL::BasicParser::Parser<LibSL::BasicParser::BufferStream> t_parser;
-typedef AutoPtr<t_stream> t_stream_ptr;
-typedef AutoPtr<t_parser> t_parser_ptr;
+// feature roles, named by slicer comments, shared by all threads
+std::mutex                 g_RolesMutex;
+std::vector<std::string>   g_RoleNames(1, std::string());
+
+// interpreter of the calling thread
+static thread_local t_gcode_context *g_Ctx = NULL;
 
 // --------------------------------------------------------------
 
-t_stream_ptr g_Stream;
-t_parser_ptr g_Parser;
+void gcode_bind(t_gcode_context *ctx)
+{
+  g_Ctx = ctx;
+}
 
-std::set<int> g_Extruders;
-int           g_CurrentExtruder = 0;
+// --------------------------------------------------------------
 
-bool         g_RelativeExMode = false; // false -> absolute extrusion | true - > relative extrusion 
-bool         g_VolumetricMode = false;
+static void set_extruder(int extruder) {
+  g_Ctx->extruders.insert(extruder);
+  g_Ctx->current_extruder = extruder;
+}
 
-double       g_FilDiameter = 1.75; // used when volumetric extrusion is detected
+// --------------------------------------------------------------
 
-v4d          g_Pos(0.0);
-v4d          g_Offset(0.0); // TODO : rework to have offset per extruder/tool
-double       g_Speed = 20.0;
-int          g_Line = 0;
-const char  *g_GCode = NULL;
-bool         g_GCodeError = false;
+static int role_id(const std::string& name)
+{
+  // roles are few, each thread keeps its own copy of the names it met
+  thread_local std::vector<std::pair<std::string, int> > known;
+  for (const auto& k : known) {
+    if (k.first == name) return k.second;
+  }
+  int id = -1;
+  {
+    std::lock_guard<std::mutex> lock(g_RolesMutex);
+    ForIndex(r, g_RoleNames.size()) {
+      if (g_RoleNames[r] == name) { id = r; break; }
+    }
+    if (id < 0) {
+      g_RoleNames.push_back(name);
+      id = (int)g_RoleNames.size() - 1;
+    }
+  }
+  known.push_back(std::make_pair(name, id));
+  return id;
+}
 
 // --------------------------------------------------------------
 
-static void set_extruder(int extruder) {
-  g_Extruders.insert(extruder);
-  g_CurrentExtruder = extruder;
+// reads the rest of the current line, past the newline
+static std::string read_comment()
+{
+  std::string s;
+  while (!g_Ctx->parser->eof()) {
+    int c = g_Ctx->parser->readChar(false);
+    if (c == '\n' || c == '\0' || c == -1) break;
+    s.push_back((char)c);
+  }
+  size_t b = s.find_first_not_of(" \t");
+  size_t e = s.find_last_not_of(" \t\r");
+  return b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+}
+
+// --------------------------------------------------------------
+
+// reads a feature role comment ('TYPE:name' or 'feature name', past the ';')
+static void read_role(const std::string& comment)
+{
+  if (comment.compare(0, 5, "TYPE:") == 0) {
+    g_Ctx->role = role_id(comment.substr(5));
+  } else if (comment.compare(0, 8, "feature ") == 0) {
+    g_Ctx->role = role_id(comment.substr(8));
+  }
 }
 
 // --------------------------------------------------------------
 
 static double e_from_volumetric(double e_vol)
 {
-  return e_vol / (pow(g_FilDiameter / 2, 2) * M_PI);
+  return e_vol / (pow(g_Ctx->fil_diameter / 2, 2) * M_PI);
+}
+
+// --------------------------------------------------------------
+
+void gcode_load(t_gcode_source& _source, std::string text)
+{
+  _source.text.swap(text);
+  _source.line_starts.clear();
+  _source.line_starts.push_back(0);
+  ForIndex(c, _source.text.size()) {
+    if (_source.text[c] == '\n') {
+      _source.line_starts.push_back(c + 1);
+    }
+  }
 }
 
 // --------------------------------------------------------------
 
-void gcode_start(const char *gcode)
+void gcode_start(const t_gcode_source& source)
 {
-  g_GCode  = gcode;
+  g_Ctx->source = &source;
   gcode_reset();
 }
 
@@ -73,60 +130,83 @@ void gcode_start(const char *gcode)
 
 void gcode_reset()
 {
-  sl_assert(g_GCode != NULL);
-  g_Stream = t_stream_ptr(new t_stream(g_GCode, (uint)strlen(g_GCode) + 1));
-  g_Parser = t_parser_ptr(new t_parser(*g_Stream, false));
+  sl_assert(g_Ctx->source != NULL);
+  const std::string& text = g_Ctx->source->text;
+  g_Ctx->stream = AutoPtr<t_gcode_stream>(new t_gcode_stream(text.c_str(), (uint)text.size() + 1));
+  g_Ctx->parser = AutoPtr<t_gcode_parser>(new t_gcode_parser(*g_Ctx->stream, false));
 
-  //g_Extruders.clear();
+  //g_Ctx->extruders.clear();
   //set_extruder(0);
-  g_CurrentExtruder = 0;
-  g_FilDiameter = 1.75;
-  g_RelativeExMode = false;
-  g_VolumetricMode = false;
-
-  g_Line = 0;
-  g_GCodeError = false;
-
-  g_Pos = 0.0f;
-  g_Offset = 0.0f;
-  g_Speed = 20.0f;  
+  g_Ctx->current_extruder = 0;
+  g_Ctx->role = 0;
+  g_Ctx->fil_diameter = 1.75;
+  g_Ctx->relative_ex_mode = false;
+  g_Ctx->volumetric_mode = false;
+
+  g_Ctx->line = 0;
+  g_Ctx->skipped_lines = 0;
+  g_Ctx->error = false;
+
+  g_Ctx->pos = 0.0f;
+  g_Ctx->offset = 0.0f;
+  g_Ctx->speed = 20.0f;  
 }
 
 // --------------------------------------------------------------
 
 bool gcode_advance()
 {
-  if (g_GCodeError) return false;
+  if (g_Ctx->error) return false;
+  if (g_Ctx->feed != NULL) {
+    t_gcode_move m;
+    if (!g_Ctx->feed->pop(m)) {
+      return false; // feed closed
+    }
+    g_Ctx->pos              = m.pos;
+    g_Ctx->speed            = m.speed;
+    g_Ctx->line             = m.line;
+    g_Ctx->role             = m.role;
+    g_Ctx->error            = m.error;
+    g_Ctx->skipped_lines    = m.skipped;
+    g_Ctx->relative_ex_mode = m.relative;
+    g_Ctx->volumetric_mode  = m.volumetric;
+    g_Ctx->fil_diameter     = m.fil_diameter;
+    g_Ctx->offset           = m.offset;
+    if (m.extruder != g_Ctx->current_extruder) {
+      set_extruder(m.extruder);
+    }
+    return m.more;
+  }
   int c;
-  while (!g_Parser->eof()) {
-    g_Line ++;
-    c = g_Parser->readChar();
+  while (!g_Ctx->parser->eof()) {
+    g_Ctx->line ++;
+    c = g_Ctx->parser->readChar();
     c = tolower(c);
     if (c == 'g') { // G gcode
-      int n = g_Parser->readInt();
+      int n = g_Ctx->parser->readInt();
       if (n == 0 || n == 1) { // G0 G1
-        while (!g_Parser->eof()) {
-          c = g_Parser->readChar();
+        while (!g_Ctx->parser->eof()) {
+          c = g_Ctx->parser->readChar();
           if (c == '\n') break;
           if (c == ';') {
-            g_Parser->reachChar('\n');
+            g_Ctx->parser->reachChar('\n');
             break;
           }
           c = tolower(c);
-          double f = g_Parser->readDouble();
+          double f = g_Ctx->parser->readDouble();
           if (c >= 'x' && c <= 'z') { // XYZ coordinates
-            g_Pos[c - 'x'] = f + g_Offset[c - 'x'];
+            g_Ctx->pos[c - 'x'] = f + g_Ctx->offset[c - 'x'];
           } else if (c == 'e') { // E extrusion value
             double e = f;
-            if (g_VolumetricMode) { // convert the e_value back to a length
+            if (g_Ctx->volumetric_mode) { // convert the e_value back to a length
               e = e_from_volumetric(f);
             }
-            if (g_RelativeExMode) { // if relative extrusion is detected, individual extrusion steps are merged to behave like absolute extrusion
-              e = g_Pos[3] + f;
+            if (g_Ctx->relative_ex_mode) { // if relative extrusion is detected, individual extrusion steps are merged to behave like absolute extrusion
+              e = g_Ctx->pos[3] + f;
             }
-            g_Pos[3] = e + g_Offset[3];
+            g_Ctx->pos[3] = e + g_Ctx->offset[3];
           } else if (c == 'f') { // F feedrate
-            g_Speed = f / 60.0f;
+            g_Ctx->speed = f / 60.0f;
           } else if ((c >= 'a' && c <= 'd') || c == 'h') { // ABCDH mixing ratios
             // TODO mixing ratios
             /*
@@ -142,17 +222,17 @@ bool gcode_advance()
               //TODO
             }
             */
-            g_Parser->reachChar('\n');
+            g_Ctx->parser->reachChar('\n');
           } else {
-            g_GCodeError = true;
+            g_Ctx->error = true;
             return false;
           }
         }
 #if 0
         // flow check (DEBUG)
-        double ln = length(v3d(g_Pos) - v3d(pos_before));
+        double ln = length(v3d(g_Ctx->pos) - v3d(pos_before));
         if (ln > 1e-6f) {
-          double ex = g_Pos[3] - pos_before[3];
+          double ex = g_Ctx->pos[3] - pos_before[3];
           std::cerr << ex / ln << ' ';
           if (ex / ln > 0.3f) {
             std::cerr << ex / ln << ' ';
@@ -161,128 +241,154 @@ bool gcode_advance()
 #endif
         break; // done advancing
       } else if (n == 92) { // G92 reset axis values
-        while (!g_Parser->eof()) {
-          c = g_Parser->readChar();
+        while (!g_Ctx->parser->eof()) {
+          c = g_Ctx->parser->readChar();
           if (c == '\n') break;
           c = tolower(c);
-          double d = g_Parser->readDouble();
+          double d = g_Ctx->parser->readDouble();
           if (c >= 'x' && c <= 'z') {
-            g_Offset[c - 'x'] = g_Pos[c - 'x'] - d;
+            g_Ctx->offset[c - 'x'] = g_Ctx->pos[c - 'x'] - d;
           } else if (c == 'e') { // G92 E0 extruder values reset
-            g_Offset[3] = g_Pos[3] - d;
+            g_Ctx->offset[3] = g_Ctx->pos[3] - d;
           }
         }        
         if (gcode_extruders() > 2) { // Dirty fix
-          g_Parser->reachChar('\n'); // PB NOTE: fixes the latence when switching between multiple extruders (when more than 2 extruders are present) but breaks dual extrusion managment?
+          g_Ctx->skipped_lines++;
+          g_Ctx->parser->reachChar('\n'); // PB NOTE: fixes the latence when switching between multiple extruders (when more than 2 extruders are present) but breaks dual extrusion managment?
         }
       } else if (n == 10) { // G10
-        g_Parser->reachChar('\n');
+        g_Ctx->parser->reachChar('\n');
       } else if (n == 11) { // G11
-        g_Parser->reachChar('\n');
+        g_Ctx->parser->reachChar('\n');
       } else { // other => ignore
-        g_Parser->reachChar('\n');
+        g_Ctx->parser->reachChar('\n');
       }
     } else if (c == 'm') { // M gcode
-      int n = g_Parser->readInt();
+      int n = g_Ctx->parser->readInt();
       if (n == 82) { // M82: absolute extrusion
-        g_RelativeExMode = false;
-        g_Parser->reachChar('\n');
+        g_Ctx->relative_ex_mode = false;
+        g_Ctx->parser->reachChar('\n');
       } else if (n == 83) { // M83 relative extrusion
-        g_RelativeExMode = true;
-        g_Parser->reachChar('\n');
+        g_Ctx->relative_ex_mode = true;
+        g_Ctx->parser->reachChar('\n');
       } else if (n == 200) { // M200 set filament diameter & enable volumetric extrusion
-        g_VolumetricMode = true;
-        while (!g_Parser->eof()) {
-          c = g_Parser->readChar();
+        g_Ctx->volumetric_mode = true;
+        while (!g_Ctx->parser->eof()) {
+          c = g_Ctx->parser->readChar();
           if (c == '\n') break;
           c = tolower(c);
-          double d = g_Parser->readDouble();
+          double d = g_Ctx->parser->readDouble();
           if (c == 'd') {
-            g_FilDiameter = d; // update the filament diameter with the one provided by M200
+            g_Ctx->fil_diameter = d; // update the filament diameter with the one provided by M200
           }
         }
-        g_Parser->reachChar('\n');
+        g_Ctx->parser->reachChar('\n');
       } else { // other => ignore
-        g_Parser->reachChar('\n');
+        g_Ctx->parser->reachChar('\n');
       }
     } else if (c == 't') { // T tool selection
-      int e = g_Parser->readInt();
+      int e = g_Ctx->parser->readInt();
       set_extruder(e);
-      g_Parser->reachChar('\n');
+      g_Ctx->parser->reachChar('\n');
     } else if (c == ';') { // comments
-      if (g_Line == 1) {
-        std::string s = g_Parser->readString();
-        if (s == "FLAVOR:UltiGCode") { // detecting UltiGcode to enable volumetric extrusion
-          g_VolumetricMode = true;
-          g_FilDiameter = 2.85;
-          //std::cerr << Console::blue << "UM2 detected" << Console::gray << std::endl;
-        }
-      } else if (g_Line == 3) {
-        std::string s = g_Parser->readString();
-        if (s == "FLAVOR:Griffin") { // detecting UltiGcode (Ultimaker 3 or newer) to enable volumetric extrusion
-          g_VolumetricMode = false;
-          g_FilDiameter = 2.85;
-          //std::cerr << Console::blue << "UM3 detected" << Console::gray << std::endl;
-        }
+      std::string s = read_comment();
+      if (g_Ctx->line == 1 && s == "FLAVOR:UltiGCode") { // detecting UltiGcode to enable volumetric extrusion
+        g_Ctx->volumetric_mode = true;
+        g_Ctx->fil_diameter = 2.85;
+        //std::cerr << Console::blue << "UM2 detected" << Console::gray << std::endl;
+      } else if (g_Ctx->line == 3 && s == "FLAVOR:Griffin") { // detecting UltiGcode (Ultimaker 3 or newer) to enable volumetric extrusion
+        g_Ctx->volumetric_mode = false;
+        g_Ctx->fil_diameter = 2.85;
+        //std::cerr << Console::blue << "UM3 detected" << Console::gray << std::endl;
+      } else {
+        read_role(s);
       }
-      g_Parser->reachChar('\n');
     } else if (c == '<') {
-      g_Parser->reachChar('\n');
+      g_Ctx->parser->reachChar('\n');
     } else if (c == '\r') {
-      g_Parser->reachChar('\n');
+      g_Ctx->parser->reachChar('\n');
     } else if (c == '\n') {
       // do nothing
     } else if (c == '\0' || c == -1) {
       return false;
     } else {
-      std::cerr << Console::red <<  "Error parsing GCode line " << g_Line << Console::gray << std::endl;
-      g_GCodeError = true;
+      std::cerr << Console::red <<  "Error parsing GCode line " << g_Ctx->line << Console::gray << std::endl;
+      g_Ctx->error = true;
       return false;
     }
   }
-  return !g_Parser->eof();
+  return !g_Ctx->parser->eof();
 }
 
 // --------------------------------------------------------------
 
 v4d gcode_next_pos()
 {
-  return g_Pos;
+  return g_Ctx->pos;
 }
 
 // --------------------------------------------------------------
 
 double gcode_speed()
 {
-  return g_Speed;
+  return g_Ctx->speed;
 }
 
 // --------------------------------------------------------------
 
 size_t gcode_extruders()
 {
-  return g_Extruders.size();
+  return g_Ctx->extruders.size();
+}
+
+// --------------------------------------------------------------
+
+std::set<int> gcode_used_extruders()
+{
+  return g_Ctx->extruders;
+}
+
+// --------------------------------------------------------------
+
+void gcode_set_used_extruders(const std::set<int>& extruders)
+{
+  g_Ctx->extruders = extruders;
 }
 
 // --------------------------------------------------------------
 
 int gcode_current_extruder()
 {
-  return g_CurrentExtruder;
+  return g_Ctx->current_extruder;
+}
+
+// --------------------------------------------------------------
+
+int gcode_role()
+{
+  return g_Ctx->role;
+}
+
+// --------------------------------------------------------------
+
+std::string gcode_role_name(int role)
+{
+  std::lock_guard<std::mutex> lock(g_RolesMutex);
+  return role >= 0 && role < (int)g_RoleNames.size() ? g_RoleNames[role] : std::string();
 }
 
 // --------------------------------------------------------------
 
 int gcode_line()
 {
-  return g_Line;
+  return g_Ctx->line;
 }
 
 // --------------------------------------------------------------
 
 bool gcode_error() 
 {
-  return g_GCodeError;
+  return g_Ctx->error;
 }
 
 // --------------------------------------------------------------
@@ -290,7 +396,90 @@ bool gcode_error()
 
 double gcode_filament_dia()
 {
-  return g_FilDiameter;
+  return g_Ctx->fil_diameter;
+}
+
+// --------------------------------------------------------------
+
+void gcode_save(t_gcode_state& _state)
+{
+  _state.line         = g_Ctx->line;
+  _state.skipped      = g_Ctx->skipped_lines;
+  _state.extruder     = g_Ctx->current_extruder;
+  _state.relative     = g_Ctx->relative_ex_mode;
+  _state.volumetric   = g_Ctx->volumetric_mode;
+  _state.fil_diameter = g_Ctx->fil_diameter;
+  _state.pos          = g_Ctx->pos;
+  _state.offset       = g_Ctx->offset;
+  _state.speed        = g_Ctx->speed;
+  _state.role         = g_Ctx->role;
+}
+
+// --------------------------------------------------------------
+
+void gcode_restore(const t_gcode_state& state)
+{
+  sl_assert(g_Ctx->source != NULL);
+  // lines are always fully consumed, resume at the start of the next one
+  const std::string& text = g_Ctx->source->text;
+  const std::vector<size_t>& starts = g_Ctx->source->line_starts;
+  size_t l = std::min<size_t>(state.line + state.skipped, starts.size() - 1);
+  g_Ctx->stream           = AutoPtr<t_gcode_stream>(new t_gcode_stream(text.c_str() + starts[l], (uint)(text.size() - starts[l]) + 1));
+  g_Ctx->parser           = AutoPtr<t_gcode_parser>(new t_gcode_parser(*g_Ctx->stream, false));
+  g_Ctx->line             = state.line;
+  g_Ctx->skipped_lines    = state.skipped;
+  g_Ctx->current_extruder = state.extruder;
+  g_Ctx->relative_ex_mode = state.relative;
+  g_Ctx->volumetric_mode  = state.volumetric;
+  g_Ctx->fil_diameter     = state.fil_diameter;
+  g_Ctx->pos              = state.pos;
+  g_Ctx->offset           = state.offset;
+  g_Ctx->speed            = state.speed;
+  g_Ctx->role             = state.role;
+  g_Ctx->error            = false;
+}
+
+// --------------------------------------------------------------
+
+void gcode_move(bool more, t_gcode_move& _move)
+{
+  _move.pos          = g_Ctx->pos;
+  _move.speed        = g_Ctx->speed;
+  _move.extruder     = g_Ctx->current_extruder;
+  _move.role         = g_Ctx->role;
+  _move.line         = g_Ctx->line;
+  _move.more         = more;
+  _move.error        = g_Ctx->error;
+  _move.skipped      = g_Ctx->skipped_lines;
+  _move.relative     = g_Ctx->relative_ex_mode;
+  _move.volumetric   = g_Ctx->volumetric_mode;
+  _move.fil_diameter = g_Ctx->fil_diameter;
+  _move.offset       = g_Ctx->offset;
+}
+
+// --------------------------------------------------------------
+
+void gcode_feed_start(t_gcode_feed *feed, const t_gcode_state& state)
+{
+  g_Ctx->feed             = feed;
+  g_Ctx->line             = state.line;
+  g_Ctx->skipped_lines    = state.skipped;
+  g_Ctx->current_extruder = state.extruder;
+  g_Ctx->relative_ex_mode = state.relative;
+  g_Ctx->volumetric_mode  = state.volumetric;
+  g_Ctx->fil_diameter     = state.fil_diameter;
+  g_Ctx->pos              = state.pos;
+  g_Ctx->offset           = state.offset;
+  g_Ctx->speed            = state.speed;
+  g_Ctx->role             = state.role;
+  g_Ctx->error            = false;
+}
+
+// --------------------------------------------------------------
+
+void gcode_feed_stop()
+{
+  g_Ctx->feed = NULL;
 }
 
 // --------------------------------------------------------------
\ No newline at end of file
@@ -23,8 +23,73 @@
 
 #include <LibSL.h>
 
-// start interpreting the gcode
-void gcode_start(const char *gcode);
+#include <set>
+
+#include "spsc_queue.h"
+
+// move reached by gcode_advance, decoded on a thread and interpreted on another
+typedef struct
+{
+  v4d    pos;
+  double speed;
+  int    extruder;
+  int    role;
+  int    line;
+  bool   more;  // value returned by gcode_advance
+  bool   error;
+  // rest of the interpreter state, so that gcode_save is exact on a feed
+  int    skipped;
+  bool   relative;
+  bool   volumetric;
+  double fil_diameter;
+  v4d    offset;
+} t_gcode_move;
+
+typedef SpscQueue<t_gcode_move> t_gcode_feed;
+
+// gcode text, with the offset of each line (indexed once per load, see gcode_load)
+typedef struct
+{
+  std::string         text;
+  std::vector<size_t> line_starts;
+} t_gcode_source;
+
+typedef LibSL::BasicParser::BufferStream t_gcode_stream;
+typedef LibSL::BasicParser::Parser<LibSL::BasicParser::BufferStream> t_gcode_parser;
+
+// interpreter state, one per simulation: the gcode_ functions work on the
+// context bound to the calling thread (see gcode_bind)
+struct t_gcode_context
+{
+  AutoPtr<t_gcode_stream> stream;
+  AutoPtr<t_gcode_parser> parser;
+
+  std::set<int> extruders;
+  int           current_extruder = 0;
+  int           role = 0;
+
+  bool          relative_ex_mode = false; // false -> absolute extrusion | true - > relative extrusion
+  bool          volumetric_mode = false;
+  double        fil_diameter = 1.75; // used when volumetric extrusion is detected
+
+  v4d           pos = v4d(0.0);
+  v4d           offset = v4d(0.0); // TODO : rework to have offset per extruder/tool
+  double        speed = 20.0;
+  int           line = 0;
+  int           skipped_lines = 0; // lines consumed without incrementing line
+  const t_gcode_source *source = NULL;
+  bool          error = false;
+  t_gcode_feed *feed = NULL; // moves decoded by another thread, when not NULL
+};
+
+// binds an interpreter context to the calling thread
+void gcode_bind(t_gcode_context *ctx);
+
+// sets the text of a source and indexes its lines
+void gcode_load(t_gcode_source& _source, std::string text);
+
+// start interpreting the gcode, the source is kept by the caller
+void gcode_start(const t_gcode_source& source);
 
 // advances to the next position
 // return false if none exists (end of gcode)
@@ -39,9 +104,23 @@ double gcode_speed();
 // return the number of used extruders
 size_t gcode_extruders();
 
+// returns the extruders used so far
+std::set<int> gcode_used_extruders();
+
+// sets the extruders used so far, they change the interpretation of G92
+// (call after gcode_start to interpret as another thread having seen them)
+void gcode_set_used_extruders(const std::set<int>& extruders);
+
 // returns the current extruder
 int gcode_current_extruder();
 
+// returns the current feature role, from slicer comments (;TYPE: or ; feature)
+// 0 if none was given
+int gcode_role();
+
+// returns the name of a role, ids are shared by all threads
+std::string gcode_role_name(int role);
+
 // return current line in gcode stream
 int gcode_line();
 
@@ -56,3 +135,34 @@ bool gcode_volumetric_mode();
 
 // returns the filament diameter provided by M200 (volumetric extrusion)
 double gcode_filament_dia();
+
+// interpreter state, used to resume interpretation at a given line
+typedef struct
+{
+  int    line;
+  int    skipped;   // lines skipped without being counted
+  int    extruder;
+  bool   relative;
+  bool   volumetric;
+  double fil_diameter;
+  v4d    pos;
+  v4d    offset;
+  double speed;
+  int    role;
+} t_gcode_state;
+
+// saves the interpreter state
+void gcode_save(t_gcode_state& _state);
+
+// restores a state previously saved on the same gcode
+void gcode_restore(const t_gcode_state& state);
+
+// returns the current move, more is the value returned by the last gcode_advance
+void gcode_move(bool more, t_gcode_move& _move);
+
+// gcode_advance pops moves from a feed instead of parsing, starting from state
+// (the feed is filled from another thread, see gcode_move)
+void gcode_feed_start(t_gcode_feed *feed, const t_gcode_state& state);
+
+// back to parsing
+void gcode_feed_stop();
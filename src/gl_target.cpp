@@ -0,0 +1,104 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "gl_target.h"
+
+// --------------------------------------------------------------
+
+GLTarget::GLTarget(const std::vector<GLenum>& formats, bool depth)
+  : m_Formats(formats), m_HasDepth(depth)
+{
+}
+
+// --------------------------------------------------------------
+
+GLTarget::~GLTarget()
+{
+  release();
+}
+
+// --------------------------------------------------------------
+
+void GLTarget::release()
+{
+  if (m_FBO == 0) return;
+  glDeleteFramebuffers(1, &m_FBO);
+  glDeleteTextures((GLsizei)m_Textures.size(), m_Textures.data());
+  if (m_Depth != 0) {
+    glDeleteRenderbuffers(1, &m_Depth);
+  }
+  m_FBO   = 0;
+  m_Depth = 0;
+  m_Textures.clear();
+}
+
+// --------------------------------------------------------------
+
+void GLTarget::allocate(int w, int h)
+{
+  release();
+  m_W = std::max(1, w);
+  m_H = std::max(1, h);
+  glGenFramebuffers(1, &m_FBO);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+  std::vector<GLenum> draw_buffers;
+  ForIndex(i, (int)m_Formats.size()) {
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexStorage2D(GL_TEXTURE_2D, 1, m_Formats[i], m_W, m_H);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, tex, 0);
+    m_Textures.push_back(tex);
+    draw_buffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glDrawBuffers((GLsizei)draw_buffers.size(), draw_buffers.data());
+  if (m_HasDepth) {
+    glGenRenderbuffers(1, &m_Depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_Depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, m_W, m_H);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_Depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  }
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << Console::red << "GLTarget: incomplete framebuffer" << Console::gray << std::endl;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// --------------------------------------------------------------
+
+void GLTarget::bind()
+{
+  glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+}
+
+// --------------------------------------------------------------
+
+void GLTarget::unbind()
+{
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// --------------------------------------------------------------
@@ -0,0 +1,65 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+#include <LibSL_gl.h>
+
+#include <vector>
+
+// ----------------------------------------------------------------
+
+// Offscreen target with any number of color textures of given internal
+// formats (e.g. GL_RG32F), and optionally a depth buffer.
+// Textures are sampled with nearest filtering and clamped.
+class GLTarget
+{
+private:
+
+  std::vector<GLenum> m_Formats;
+  std::vector<GLuint> m_Textures;
+  bool                m_HasDepth = false;
+  GLuint              m_FBO = 0;
+  GLuint              m_Depth = 0;
+  int                 m_W = 0;
+  int                 m_H = 0;
+
+  void release();
+
+public:
+
+  GLTarget(const std::vector<GLenum>& formats, bool depth);
+  ~GLTarget();
+
+  // (re)allocates the textures, contents are undefined
+  void   allocate(int w, int h);
+
+  void   bind();
+  void   unbind();
+
+  GLuint texture(int i) const { return m_Textures[i]; }
+  int    w() const { return m_W; }
+  int    h() const { return m_H; }
+};
+
+typedef AutoPtr<GLTarget> GLTarget_Ptr;
+
+// ----------------------------------------------------------------
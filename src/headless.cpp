@@ -0,0 +1,151 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "headless.h"
+
+#ifdef HEADLESS_EGL
+
+#include <LibSL_gl.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// --------------------------------------------------------------
+
+static EGLDisplay g_EGLDisplay = EGL_NO_DISPLAY;
+static EGLContext g_EGLContext = EGL_NO_CONTEXT;
+static EGLSurface g_EGLSurface = EGL_NO_SURFACE;
+
+// --------------------------------------------------------------
+
+static EGLDisplay headless_display()
+{
+  // surfaceless platform first, needs neither a display server nor a GPU
+  auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (get_platform_display != nullptr) {
+    EGLDisplay dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (dpy != EGL_NO_DISPLAY && eglInitialize(dpy, nullptr, nullptr)) {
+      return dpy;
+    }
+  }
+  EGLDisplay dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if (dpy != EGL_NO_DISPLAY && eglInitialize(dpy, nullptr, nullptr)) {
+    return dpy;
+  }
+  return EGL_NO_DISPLAY;
+}
+
+// --------------------------------------------------------------
+
+bool headless_context_create(std::string& _error)
+{
+  g_EGLDisplay = headless_display();
+  if (g_EGLDisplay == EGL_NO_DISPLAY) {
+    _error = "no EGL display";
+    return false;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    _error = "EGL without desktop OpenGL";
+    headless_context_destroy();
+    return false;
+  }
+  const EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE
+  };
+  EGLConfig config = nullptr;
+  EGLint    num_configs = 0;
+  eglChooseConfig(g_EGLDisplay, config_attribs, &config, 1, &num_configs);
+  // same version as the shaders (see main), compatibility profile as the
+  // GUI context; core profile if the driver only has this one
+  const EGLint profiles[] = { EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT };
+  for (EGLint profile : profiles) {
+    const EGLint context_attribs[] = {
+      EGL_CONTEXT_MAJOR_VERSION,       4,
+      EGL_CONTEXT_MINOR_VERSION,       3,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK, profile,
+      EGL_NONE
+    };
+    g_EGLContext = eglCreateContext(g_EGLDisplay, num_configs > 0 ? config : nullptr, EGL_NO_CONTEXT, context_attribs);
+    if (g_EGLContext != EGL_NO_CONTEXT) break;
+  }
+  if (g_EGLContext == EGL_NO_CONTEXT) {
+    _error = "cannot create an OpenGL 4.3 context";
+    headless_context_destroy();
+    return false;
+  }
+  // no default framebuffer is needed, a tiny pbuffer if surfaceless is not supported
+  if (!eglMakeCurrent(g_EGLDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, g_EGLContext)) {
+    const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    if (num_configs > 0) {
+      g_EGLSurface = eglCreatePbufferSurface(g_EGLDisplay, config, pbuffer_attribs);
+    }
+    if (g_EGLSurface == EGL_NO_SURFACE || !eglMakeCurrent(g_EGLDisplay, g_EGLSurface, g_EGLSurface, g_EGLContext)) {
+      _error = "cannot make the OpenGL context current";
+      headless_context_destroy();
+      return false;
+    }
+  }
+#ifdef USE_GLUX
+  gluxInit();
+#endif
+  return true;
+}
+
+// --------------------------------------------------------------
+
+void headless_context_destroy()
+{
+  if (g_EGLDisplay == EGL_NO_DISPLAY) return;
+  eglMakeCurrent(g_EGLDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (g_EGLSurface != EGL_NO_SURFACE) {
+    eglDestroySurface(g_EGLDisplay, g_EGLSurface);
+  }
+  if (g_EGLContext != EGL_NO_CONTEXT) {
+    eglDestroyContext(g_EGLDisplay, g_EGLContext);
+  }
+  eglTerminate(g_EGLDisplay);
+  g_EGLDisplay = EGL_NO_DISPLAY;
+  g_EGLContext = EGL_NO_CONTEXT;
+  g_EGLSurface = EGL_NO_SURFACE;
+}
+
+// --------------------------------------------------------------
+
+#else
+
+// --------------------------------------------------------------
+
+bool headless_context_create(std::string& _error)
+{
+  _error = "built without EGL (HEADLESS_EGL)";
+  return false;
+}
+
+// --------------------------------------------------------------
+
+void headless_context_destroy()
+{
+}
+
+// --------------------------------------------------------------
+
+#endif
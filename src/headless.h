@@ -0,0 +1,38 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <string>
+
+// ----------------------------------------------------------------
+
+// Offscreen OpenGL context for the headless render mode (--render): no
+// window and no display, the context is created with EGL on the surfaceless
+// platform (e.g. Mesa llvmpipe on render nodes without GPU), rendering goes
+// to framebuffer objects only. Only available with HEADLESS_EGL defined.
+
+// creates the context and makes it current on the calling thread
+// returns false with a message in _error if no context can be created
+bool headless_context_create(std::string& _error);
+// releases the context
+void headless_context_destroy();
+
+// ----------------------------------------------------------------
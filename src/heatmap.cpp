@@ -0,0 +1,132 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "heatmap.h"
+#include "png16.h"
+
+// --------------------------------------------------------------
+
+bool StatsHeatmap::open(const std::string& base, const AAB<3>& box, float cell, bool per_layer)
+{
+  close();
+  m_File.open(base + ".bin", std::ios::binary);
+  if (!m_File) {
+    std::cerr << Console::red << "Unable to write " << base << ".bin" << Console::gray << std::endl;
+    return false;
+  }
+  m_Base     = base;
+  m_PerLayer = per_layer;
+  m_Cell     = std::max(cell, 0.01f);
+  m_Origin   = v2f(box.minCorner()[0], box.minCorner()[1]);
+  m_W        = std::max(1, (int)ceil(box.extent()[0] / m_Cell));
+  m_H        = std::max(1, (int)ceil(box.extent()[1] / m_Cell));
+  m_Dangling.assign((size_t)m_W * m_H, 0.0f);
+  m_Overlap .assign((size_t)m_W * m_H, 0.0f);
+  m_Layer    = -1; // before the first layer
+  m_Z        = 0.0;
+  m_Empty    = true;
+  // header
+  uint version = 1;
+  m_File.write("VRHM", 4);
+  m_File.write((const char*)&version, sizeof(uint));
+  m_File.write((const char*)&m_W, sizeof(int));
+  m_File.write((const char*)&m_H, sizeof(int));
+  m_File.write((const char*)&m_Cell, sizeof(float));
+  m_File.write((const char*)&m_Origin[0], sizeof(float));
+  m_File.write((const char*)&m_Origin[1], sizeof(float));
+  return true;
+}
+
+// --------------------------------------------------------------
+
+void StatsHeatmap::close()
+{
+  if (!m_File.is_open()) return;
+  if (!m_PerLayer || !m_Empty) {
+    writeRecord();
+  }
+  m_File.close();
+}
+
+// --------------------------------------------------------------
+
+void StatsHeatmap::add(const v3d& p, double len, float dangling, float overlap)
+{
+  if (dangling <= 0.0f && overlap <= 0.0f) return;
+  int i = std::clamp((int)((p[0] - m_Origin[0]) / m_Cell), 0, m_W - 1);
+  int j = std::clamp((int)((p[1] - m_Origin[1]) / m_Cell), 0, m_H - 1);
+  m_Dangling[i + (size_t)j * m_W] += (float)(dangling * len);
+  m_Overlap [i + (size_t)j * m_W] += (float)(overlap * len);
+  m_Empty = false;
+}
+
+// --------------------------------------------------------------
+
+void StatsHeatmap::newLayer(double z)
+{
+  if (!m_File.is_open()) return;
+  if (m_PerLayer) {
+    if (!m_Empty) {
+      writeRecord(); // layers without problems are skipped
+    }
+    std::fill(m_Dangling.begin(), m_Dangling.end(), 0.0f);
+    std::fill(m_Overlap.begin(), m_Overlap.end(), 0.0f);
+    m_Empty = true;
+    m_Layer++;
+  }
+  m_Z = z;
+}
+
+// --------------------------------------------------------------
+
+void StatsHeatmap::writeRecord()
+{
+  float z = (float)m_Z;
+  m_File.write((const char*)&z, sizeof(float));
+  m_File.write((const char*)m_Dangling.data(), m_Dangling.size() * sizeof(float));
+  m_File.write((const char*)m_Overlap.data(), m_Overlap.size() * sizeof(float));
+  m_File.flush();
+  writeImages(m_PerLayer ? sprint("_%04d", std::max(0, m_Layer)) : "");
+}
+
+// --------------------------------------------------------------
+
+void StatsHeatmap::writeImages(const std::string& suffix) const
+{
+  const std::vector<float> *maps[2]  = { &m_Dangling, &m_Overlap };
+  const char               *names[2] = { "_dangling", "_overlap" };
+  std::vector<ushort> px(m_Dangling.size());
+  ForIndex(m, 2) {
+    float vmax = 0.0f;
+    for (float v : *maps[m]) {
+      vmax = std::max(vmax, v);
+    }
+    float scl = vmax > 0.0f ? 65535.0f / vmax : 0.0f;
+    ForIndex(n, (int)px.size()) {
+      px[n] = (ushort)std::clamp((*maps[m])[n] * scl + 0.5f, 0.0f, 65535.0f);
+    }
+    std::string fname = m_Base + names[m] + suffix + ".png";
+    if (!write_png16(fname, px, m_W, m_H)) {
+      std::cerr << Console::red << "Unable to write " << fname << Console::gray << std::endl;
+    }
+  }
+}
+
+// --------------------------------------------------------------
@@ -0,0 +1,78 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+
+#include <fstream>
+#include <vector>
+
+// ----------------------------------------------------------------
+
+// Top-down maps of the dangling and overlapping lengths (mm) deposited
+// in each cell, for locating problem regions offline.
+// Written as a compact binary file and as 16 bits png images (normalized
+// by the image max, the binary file holds the actual lengths).
+// In per layer mode the maps are written and cleared at each new layer:
+// the binary file then holds one record per layer and one pair of images
+// is written per layer.
+//
+// binary layout (little endian):
+//   header   'VRHM', uint version, int width, int height, float cell (mm), float origin x, float origin y
+//   records  float z, float dangling[width*height], float overlap[width*height]  (row 0 at origin y)
+class StatsHeatmap
+{
+private:
+
+  std::string         m_Base;
+  bool                m_PerLayer = false;
+  v2f                 m_Origin;
+  float               m_Cell = 1.0f;
+  int                 m_W = 0;
+  int                 m_H = 0;
+  std::vector<float>  m_Dangling;
+  std::vector<float>  m_Overlap;
+  std::ofstream       m_File;
+  int                 m_Layer = 0;
+  double              m_Z = 0.0;
+  bool                m_Empty = true;
+
+  void writeImages(const std::string& suffix) const;
+  void writeRecord();
+
+public:
+
+  StatsHeatmap() {}
+
+  // files are named from base (base.bin, base_dangling.png, base_overlap.png)
+  bool open(const std::string& base, const AAB<3>& box, float cell, bool per_layer);
+  // writes the pending maps and closes
+  void close();
+  bool isOpen() const { return m_File.is_open(); }
+
+  // accumulates a print step of length len ending at p
+  // dangling and overlap are the fractions (0-1) computed by the simulation
+  void add(const v3d& p, double len, float dangling, float overlap);
+  // a new layer starts at height z (per layer mode: writes and clears the maps)
+  void newLayer(double z);
+};
+
+// ----------------------------------------------------------------
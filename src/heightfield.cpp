@@ -0,0 +1,91 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "heightfield.h"
+
+#include <unordered_set>
+
+// --------------------------------------------------------------
+
+void TiledHeightField::allocate(int w, int h)
+{
+  m_W      = std::max(1, w);
+  m_H      = std::max(1, h);
+  m_TilesX = (m_W + c_TileSize - 1) / c_TileSize;
+  m_TilesY = (m_H + c_TileSize - 1) / c_TileSize;
+  m_Tiles.assign((size_t)m_TilesX * m_TilesY, t_tile());
+  m_Stamps.assign((size_t)m_TilesX * m_TilesY, 0);
+  fill(0.0f, 0);
+}
+
+// --------------------------------------------------------------
+
+void TiledHeightField::touch(int i0, int j0, int i1, int j1, int epoch)
+{
+  int ti0 = std::clamp(i0, 0, m_W - 1) / c_TileSize;
+  int tj0 = std::clamp(j0, 0, m_H - 1) / c_TileSize;
+  int ti1 = std::clamp(i1, 0, m_W - 1) / c_TileSize;
+  int tj1 = std::clamp(j1, 0, m_H - 1) / c_TileSize;
+  for (int tj = tj0; tj <= tj1; tj++) {
+    for (int ti = ti0; ti <= ti1; ti++) {
+      int t = ti + tj * m_TilesX;
+      if (m_Tiles[t].use_count() > 1) {
+        // shared with a snapshot or with other tiles: copy on write
+        m_Tiles[t] = std::make_shared<std::vector<float> >(*m_Tiles[t]);
+      }
+      m_Stamps[t] = epoch;
+    }
+  }
+}
+
+// --------------------------------------------------------------
+
+void TiledHeightField::fill(float z, int epoch)
+{
+  t_tile tile = std::make_shared<std::vector<float> >(c_TileSize * c_TileSize, z);
+  for (auto& t : m_Tiles) {
+    t = tile;
+  }
+  std::fill(m_Stamps.begin(), m_Stamps.end(), epoch);
+}
+
+// --------------------------------------------------------------
+
+void TiledHeightField::restore(const t_tiles& tiles, int epoch)
+{
+  sl_assert(tiles.size() == m_Tiles.size());
+  m_Tiles = tiles;
+  std::fill(m_Stamps.begin(), m_Stamps.end(), epoch);
+}
+
+// --------------------------------------------------------------
+
+size_t TiledHeightField::byteSize(const std::vector<const t_tiles*>& snapshots)
+{
+  std::unordered_set<const std::vector<float>*> distinct;
+  for (auto s : snapshots) {
+    for (const auto& t : *s) {
+      distinct.insert(t.get());
+    }
+  }
+  return distinct.size() * c_TileSize * c_TileSize * sizeof(float);
+}
+
+// --------------------------------------------------------------
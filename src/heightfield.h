@@ -0,0 +1,103 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+
+#include <memory>
+
+// ----------------------------------------------------------------
+
+// Height field stored as square tiles shared copy-on-write.
+// Tiles can be referenced by snapshots (see tiles()), a tile is only
+// duplicated when written to while still referenced elsewhere, so a
+// snapshot costs the tiles modified after it was taken.
+// Each tile also records the epoch of its last modification.
+class TiledHeightField
+{
+public:
+
+  static const int c_TileSize = 64; // cells, power of two
+
+  typedef std::shared_ptr<std::vector<float> > t_tile;
+  typedef std::vector<t_tile>                  t_tiles;
+
+private:
+
+  int              m_W = 0;
+  int              m_H = 0;
+  int              m_TilesX = 0;
+  int              m_TilesY = 0;
+  t_tiles          m_Tiles;
+  std::vector<int> m_Stamps;
+
+  int tileOf(int i, int j) const { return (i / c_TileSize) + (j / c_TileSize) * m_TilesX; }
+  int cellOf(int i, int j) const { return (i & (c_TileSize - 1)) + (j & (c_TileSize - 1)) * c_TileSize; }
+
+public:
+
+  TiledHeightField() {}
+
+  void allocate(int w, int h);
+
+  int  xsize()  const { return m_W; }
+  int  ysize()  const { return m_H; }
+  int  tilesX() const { return m_TilesX; }
+  int  tilesY() const { return m_TilesY; }
+
+  // clamped read
+  float at(int i, int j) const
+  {
+    i = std::clamp(i, 0, m_W - 1);
+    j = std::clamp(j, 0, m_H - 1);
+    return (*m_Tiles[tileOf(i, j)])[cellOf(i, j)];
+  }
+
+  // clamped write access, the tile has to be made writable with touch() first
+  float& ref(int i, int j)
+  {
+    i = std::clamp(i, 0, m_W - 1);
+    j = std::clamp(j, 0, m_H - 1);
+    return (*m_Tiles[tileOf(i, j)])[cellOf(i, j)];
+  }
+
+  // makes the tiles covering the (clamped, inclusive) cell range writable
+  // and stamps them with epoch
+  // distinct tiles can be touched from different threads
+  void touch(int i0, int j0, int i1, int j1, int epoch);
+
+  // sets all cells to z, all tiles share a single constant tile
+  void fill(float z, int epoch);
+
+  // epoch of the last modification of a tile
+  int  tileStamp(int ti, int tj) const { return m_Stamps[ti + tj * m_TilesX]; }
+
+  // references to the current tiles (cheap, tiles are shared)
+  const t_tiles& tiles() const { return m_Tiles; }
+
+  // restores tiles previously obtained with tiles(), all tiles are stamped with epoch
+  void restore(const t_tiles& tiles, int epoch);
+
+  // memory used by the distinct tiles of a set of snapshots
+  static size_t byteSize(const std::vector<const t_tiles*>& snapshots);
+};
+
+// ----------------------------------------------------------------
@@ -0,0 +1,218 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "hfield_export.h"
+#include "png16.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <deque>
+
+// --------------------------------------------------------------
+
+typedef struct
+{
+  std::vector<float>     heights;
+  int                    w = 0;
+  int                    h = 0;
+  int                    stamp = -1; // epoch of the last capture (-1: never filled)
+  int                    index = 0;
+  t_hfield_snapshot_info info;
+} t_snapshot;
+
+const int c_NumSnapshotBuffers = 3;
+
+std::string             g_ExportFolder;
+e_HFieldExportFormat    g_ExportFormat = HFieldExport_PNG16;
+std::thread             g_ExportThread;
+std::mutex              g_ExportMutex;
+std::condition_variable g_ExportCond;
+bool                    g_ExportRunning = false;
+bool                    g_ExportQuit = false;
+int                     g_ExportCount = 0;   // snapshots queued since start
+int                     g_ExportWritten = 0; // snapshots written since start
+
+std::vector<t_snapshot> g_Snapshots;   // all buffers
+std::deque<int>         g_FreeBuffers; // buffers ready to be filled
+std::deque<int>         g_Pending;     // buffers waiting to be written
+
+// --------------------------------------------------------------
+
+static void write_snapshot(const t_snapshot& s, std::ofstream& idx)
+{
+  std::string fname;
+  if (g_ExportFormat == HFieldExport_PNG16) {
+    fname = sprint("hfield_%04d.png", s.index);
+    std::vector<ushort> px((size_t)s.w * s.h);
+    float scl = s.info.zmax > 0.0f ? 65535.0f / s.info.zmax : 0.0f;
+    ForIndex(n, (int)px.size()) {
+      px[n] = (ushort)std::clamp(s.heights[n] * scl + 0.5f, 0.0f, 65535.0f);
+    }
+    if (!write_png16(g_ExportFolder + "/" + fname, px, s.w, s.h)) {
+      std::cerr << Console::red << "Unable to write " << fname << Console::gray << std::endl;
+    }
+  } else {
+    fname = sprint("hfield_%04d.raw", s.index);
+    std::ofstream f(g_ExportFolder + "/" + fname, std::ios::binary);
+    f.write((const char*)s.heights.data(), s.heights.size() * sizeof(float));
+  }
+  // index, one line per snapshot, flushed so that it is usable during the export
+  idx << fname << ',' << s.info.line << ',' << s.info.deplength << ',' << s.info.z
+      << ',' << s.w << ',' << s.h << ',' << s.info.step << ',' << s.info.zmax << std::endl;
+}
+
+static void writer_thread()
+{
+  // index, open for the whole export
+  std::ofstream idx(g_ExportFolder + "/index.csv");
+  idx << "file,line,deposition_mm,z_mm,width,height,step_mm,zmax_mm" << std::endl;
+  while (true) {
+    int b;
+    {
+      std::unique_lock<std::mutex> lock(g_ExportMutex);
+      g_ExportCond.wait(lock, [] { return g_ExportQuit || !g_Pending.empty(); });
+      if (g_Pending.empty()) {
+        return; // quit requested and nothing left to write
+      }
+      b = g_Pending.front();
+      g_Pending.pop_front();
+    }
+    // the buffer is not touched by the simulation until released
+    write_snapshot(g_Snapshots[b], idx);
+    {
+      std::unique_lock<std::mutex> lock(g_ExportMutex);
+      g_FreeBuffers.push_back(b);
+      g_ExportWritten++;
+    }
+    g_ExportCond.notify_all();
+  }
+}
+
+// --------------------------------------------------------------
+
+bool hfield_export_start(const std::string& folder, e_HFieldExportFormat fmt)
+{
+  hfield_export_stop();
+  std::error_code err;
+  std::filesystem::create_directories(folder, err);
+  if (!std::filesystem::is_directory(folder)) {
+    std::cerr << Console::red << "Unable to create folder " << folder << Console::gray << std::endl;
+    return false;
+  }
+  g_ExportFolder  = folder;
+  g_ExportFormat  = fmt;
+  g_ExportQuit    = false;
+  g_ExportCount   = 0;
+  g_ExportWritten = 0;
+  g_Snapshots.clear();
+  g_Snapshots.resize(c_NumSnapshotBuffers);
+  g_FreeBuffers.clear();
+  g_Pending.clear();
+  ForIndex(b, c_NumSnapshotBuffers) {
+    g_FreeBuffers.push_back(b);
+  }
+  g_ExportThread  = std::thread(writer_thread);
+  g_ExportRunning = true;
+  std::cerr << "Height fields exported to : " << folder << std::endl;
+  return true;
+}
+
+// --------------------------------------------------------------
+
+void hfield_export_snapshot(const TiledHeightField& hfield, int epoch, const t_hfield_snapshot_info& info)
+{
+  if (!g_ExportRunning) return;
+  // get a free buffer
+  int b;
+  {
+    std::unique_lock<std::mutex> lock(g_ExportMutex);
+    g_ExportCond.wait(lock, [] { return !g_FreeBuffers.empty(); });
+    b = g_FreeBuffers.front();
+    g_FreeBuffers.pop_front();
+  }
+  t_snapshot& s = g_Snapshots[b];
+  int w = (int)hfield.xsize();
+  int h = (int)hfield.ysize();
+  if (s.w != w || s.h != h) {
+    // (re)allocated height field, copy everything
+    s.heights.resize((size_t)w * h);
+    s.w     = w;
+    s.h     = h;
+    s.stamp = -1;
+  }
+  // copy tiles modified since this buffer was last filled
+  const int tile_size = TiledHeightField::c_TileSize;
+  ForIndex(tj, hfield.tilesY()) {
+    ForIndex(ti, hfield.tilesX()) {
+      if (hfield.tileStamp(ti, tj) <= s.stamp) continue;
+      int j_end = std::min(h, (tj + 1) * tile_size);
+      int i_end = std::min(w, (ti + 1) * tile_size);
+      for (int j = tj * tile_size; j < j_end; j++) {
+        for (int i = ti * tile_size; i < i_end; i++) {
+          s.heights[i + (size_t)j * w] = hfield.at(i, j);
+        }
+      }
+    }
+  }
+  s.stamp = epoch;
+  s.info  = info;
+  {
+    std::unique_lock<std::mutex> lock(g_ExportMutex);
+    s.index = g_ExportCount++;
+    g_Pending.push_back(b);
+  }
+  g_ExportCond.notify_all();
+}
+
+// --------------------------------------------------------------
+
+void hfield_export_stop()
+{
+  if (!g_ExportRunning) return;
+  {
+    std::unique_lock<std::mutex> lock(g_ExportMutex);
+    g_ExportQuit = true;
+  }
+  g_ExportCond.notify_all();
+  g_ExportThread.join();
+  g_ExportRunning = false;
+  g_Snapshots.clear();
+  std::cerr << "Height fields export done (" << g_ExportWritten << " snapshot(s))" << std::endl;
+}
+
+// --------------------------------------------------------------
+
+bool hfield_export_running()
+{
+  return g_ExportRunning;
+}
+
+// --------------------------------------------------------------
+
+int hfield_export_written()
+{
+  std::unique_lock<std::mutex> lock(g_ExportMutex);
+  return g_ExportWritten;
+}
+
+// --------------------------------------------------------------
@@ -0,0 +1,58 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+
+#include "heightfield.h"
+
+// Height field snapshots, written to disk from a background thread.
+// Snapshot buffers are recycled: only the tiles modified since a buffer
+// was last filled are copied, the rest of the buffer is already up to date.
+
+enum e_HFieldExportFormat { HFieldExport_PNG16 = 0, HFieldExport_RawFloat = 1 };
+
+typedef struct
+{
+  int    line;      // gcode line at capture time
+  double deplength; // deposited length (mm) at capture time
+  double z;         // nozzle height (mm) at capture time
+  float  step;      // height field cell size (mm)
+  float  zmax;      // height (mm) mapped to 65535 in 16 bits png
+} t_hfield_snapshot_info;
+
+// starts the writer thread, files go to folder (created if needed)
+// returns false if the folder cannot be created
+bool hfield_export_start(const std::string& folder, e_HFieldExportFormat fmt);
+
+// takes a snapshot of the height field and queues it for writing
+// epoch is the current epoch: the caller should increment it after the call
+// blocks only if all snapshot buffers are waiting to be written
+void hfield_export_snapshot(const TiledHeightField& hfield, int epoch, const t_hfield_snapshot_info& info);
+
+// waits for all pending snapshots to be written and stops the writer thread
+void hfield_export_stop();
+
+// returns true if the writer thread is running
+bool hfield_export_running();
+
+// returns the number of snapshots written since start
+int  hfield_export_written();
@@ -18,7 +18,8 @@
   * along with this program.  If not, see <https://www.gnu.org/licenses/>.
 **/
 
-// NOTE: we assume there is no curved printing, eg z grows monotically
+// NOTE: the height field assumes there is no curved printing, eg z grows monotically
+//       use the sparse voxels (--voxels) for z-hops, sequential or non-planar printing
 
 #include <iostream>
 #include <fstream>
@@ -31,6 +32,14 @@
 #include "shapes.h"
 #include "gcode.h"
 #include "motion.h"
+#include "hfield_export.h"
+#include "work_pool.h"
+#include "headless.h"
+#include "png16.h"
+
+#include <filesystem>
+#include <sstream>
+#include <chrono>
 
 #ifndef WIN32
   #include <unistd.h>
@@ -46,8 +55,31 @@ GPUBead g_Bead;
 
 // ----------------------------------------------------------------
 
+#ifndef EMSCRIPTEN
+
+// comma separated integers, e.g. "1,5,12"
+static std::vector<int> parse_int_list(const std::string& str)
+{
+  std::vector<int> values;
+  std::stringstream ss(str);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) {
+      values.push_back(atoi(item.c_str()));
+    }
+  }
+  return values;
+}
+
+#endif
+
+// ----------------------------------------------------------------
+
 int main(int argc, const char* argv[])
 {
+  /// the viewer simulation, settings from the command line apply to it
+  sim_bind(&g_ViewerSim);
+
 #ifndef EMSCRIPTEN
   /// prepare cmd line arguments
   TCLAP::CmdLine   cmd(" Analyse Gcode and produce statistics", ' ', "1.0");
@@ -56,11 +88,40 @@ int main(int argc, const char* argv[])
   TCLAP::SwitchArg statsArg("s", "stats", "compute stats and return", false);
   TCLAP::ValueArg<float> export_statsArg("e", "export", "export and filter (percent to keep: 0.0 to 1.0) computed stats to a latex file", false, -1.0f, "float");
   TCLAP::ValueArg<int> viewArg("v", "view", "use a predefined view for trackballUI", false, -1, "int");
+  TCLAP::SwitchArg voxelsArg("x", "voxels", "use sparse voxels instead of the height field (z-hops, sequential or non-planar printing)", false);
+  TCLAP::ValueArg<float> hfstepArg("r", "resolution", "height field cell size in mm (default: a fraction of the nozzle diameter)", false, -1.0f, "float");
+  TCLAP::ValueArg<std::string> batchArg("b", "batch", "compute stats for all gcodes of a folder, or listed in a text file (one per line), and return", false, "", "path");
+  TCLAP::ValueArg<std::string> outputArg("", "output", "results file of the batch mode", false, "stats.csv", "filename");
+  TCLAP::ValueArg<std::string> diffOutputArg("", "diff-output", "per layer differences of the compare mode", false, "diff.csv", "filename");
+  TCLAP::ValueArg<std::string> diffArg("d", "diff", "compare the stats of the gcode with the ones of another gcode, and return", false, "", "filename");
+  TCLAP::ValueArg<std::string> diffSettingsArg("", "diff-settings", "settings of the compared simulation (nozzle, resolution, filament, threshold, voxels), eg. \"nozzle=0.6,voxels=1\", without --diff the gcode is compared with itself", false, "", "key=value,...");
+  TCLAP::ValueArg<std::string> layersArg("", "layers", "stream per layer stats to a file (.csv, JSON Lines otherwise), in batch mode written next to each gcode with the same extension", false, "", "filename");
+  TCLAP::ValueArg<std::string> heatmapArg("", "heatmap", "export top-down maps of the dangling and overlap lengths (base name, in batch mode written next to each gcode)", false, "", "basename");
+  TCLAP::ValueArg<float> heatmapCellArg("", "heatmap-cell", "cell size of the heatmaps in mm", false, 1.0f, "float");
+  TCLAP::SwitchArg heatmapLayersArg("", "heatmap-layers", "one heatmap per layer instead of a single top-down map", false);
+  TCLAP::ValueArg<std::string> telemetryArg("", "telemetry", "export flow, speed and simulation rate over simulated time to a .csv file (with --stats)", false, "", "filename");
+  TCLAP::ValueArg<std::string> featuresArg("", "features", "export stats per tool and feature role (slicer ;TYPE: comments) to a .csv file, in batch mode one file for all gcodes", false, "", "filename");
+  TCLAP::ValueArg<int> jobsArg("", "jobs", "number of gcodes simulated concurrently in batch mode (default: one per core)", false, 0, "int");
+  TCLAP::ValueArg<std::string> renderArg("g", "render", "render png snapshots of the print to a folder without opening the GUI (offscreen, no display needed), and return", false, "", "folder");
+  TCLAP::ValueArg<std::string> renderViewsArg("", "render-views", "views of the snapshots, predefined views (trackball.F0N files) or 0 for the default view", false, "0", "N,N,...");
+  TCLAP::ValueArg<std::string> renderLinesArg("", "render-lines", "snapshots of the beads deposited up to these gcode lines", false, "", "N,N,...");
+  TCLAP::ValueArg<std::string> renderLayersArg("", "render-layers", "snapshots of the beads deposited up to these layers (first is 1)", false, "", "N,N,...");
+  TCLAP::ValueArg<std::string> renderSizeArg("", "render-size", "size of the snapshots in pixels", false, "800x600", "WxH");
 
   std::string cmd_gcode = "";
   bool cmd_stats = false;
   float cmd_export_stats = 1.0f;
   int cmd_view = -1;
+  float cmd_hfstep = -1.0f;
+  std::string cmd_batch = "";
+  std::string cmd_output = "";
+  std::string cmd_diff_output = "";
+  std::string cmd_telemetry = "";
+  std::string cmd_diff = "";
+  std::string cmd_diff_settings = "";
+  int cmd_jobs = 0;
+  t_stats_outputs cmd_outputs;
+  t_render_request cmd_render;
 
   try
   {
@@ -68,12 +129,57 @@ int main(int argc, const char* argv[])
     cmd.add(statsArg);
     cmd.add(export_statsArg);
     cmd.add(viewArg);
+    cmd.add(hfstepArg);
+    cmd.add(voxelsArg);
+    cmd.add(batchArg);
+    cmd.add(outputArg);
+    cmd.add(jobsArg);
+    cmd.add(layersArg);
+    cmd.add(heatmapArg);
+    cmd.add(heatmapCellArg);
+    cmd.add(heatmapLayersArg);
+    cmd.add(telemetryArg);
+    cmd.add(featuresArg);
+    cmd.add(diffArg);
+    cmd.add(diffSettingsArg);
+    cmd.add(diffOutputArg);
+    cmd.add(renderArg);
+    cmd.add(renderViewsArg);
+    cmd.add(renderLinesArg);
+    cmd.add(renderLayersArg);
+    cmd.add(renderSizeArg);
     cmd.parse(argc, argv);
 
-    cmd_gcode = gcArg.getValue();
-    cmd_stats = statsArg.getValue();
-    cmd_export_stats = export_statsArg.getValue();
-    cmd_view = viewArg.getValue();
+    cmd_gcode                  = gcArg.getValue();
+    cmd_stats                  = statsArg.getValue();
+    cmd_export_stats           = export_statsArg.getValue();
+    cmd_view                   = viewArg.getValue();
+    cmd_hfstep                 = hfstepArg.getValue();
+    g_Sim->use_brickmap        = voxelsArg.getValue();
+    cmd_batch                  = batchArg.getValue();
+    cmd_output                 = outputArg.getValue();
+    cmd_jobs                   = jobsArg.getValue();
+    cmd_outputs.layers         = layersArg.getValue();
+    cmd_outputs.heatmap        = heatmapArg.getValue();
+    cmd_outputs.heatmap_cell   = heatmapCellArg.getValue();
+    cmd_outputs.heatmap_layers = heatmapLayersArg.getValue();
+    cmd_outputs.features       = featuresArg.getValue();
+    cmd_telemetry              = telemetryArg.getValue();
+    cmd_diff                   = diffArg.getValue();
+    cmd_diff_settings          = diffSettingsArg.getValue();
+    cmd_diff_output            = diffOutputArg.getValue();
+    cmd_render.folder          = renderArg.getValue();
+    cmd_render.views           = parse_int_list(renderViewsArg.getValue());
+    if (!renderViewsArg.isSet() && cmd_view > 0) {
+      cmd_render.views = { cmd_view }; // --view
+    }
+    cmd_render.lines  = parse_int_list(renderLinesArg.getValue());
+    cmd_render.layers = parse_int_list(renderLayersArg.getValue());
+    if (sscanf(renderSizeArg.getValue().c_str(), "%dx%d", &cmd_render.width, &cmd_render.height) != 2
+      || cmd_render.width <= 0 || cmd_render.height <= 0) {
+      std::cerr << Console::red << "Invalid render size " << renderSizeArg.getValue() << Console::gray << std::endl;
+      exit(1);
+    }
   }
   catch (const TCLAP::ArgException & e)
   {
@@ -87,42 +193,88 @@ int main(int argc, const char* argv[])
   if (!cmd_gcode.empty()) {
     g_GCode_path = cmd_gcode.c_str();
   }
+  if (cmd_hfstep > 0.0f) {
+    g_Sim->auto_hfield_step = false;
+    g_Sim->hfield_step = cmd_hfstep;
+  }
+
+  /// batch mode (stats of many gcodes without opening GUI)
+  if (!cmd_batch.empty()) {
+    batch_stats(cmd_batch, cmd_output, cmd_jobs, cmd_export_stats, cmd_outputs);
+    exit(0);
+  }
+
+  /// compare mode (stats of two gcodes, or of a gcode under two settings)
+  if (!cmd_diff.empty() || !cmd_diff_settings.empty()) {
+    if (cmd_gcode.empty()) {
+      std::cerr << Console::red << "No gcode to compare" << Console::gray << std::endl;
+      exit(1);
+    }
+    compare_stats(cmd_gcode, cmd_diff, cmd_diff_settings, cmd_diff_output);
+    exit(0);
+  }
 #endif
 
   /// load gcode
   load_gcode(g_GCode_path);
-  g_GCode_string = loadFileIntoString(g_GCode_path.c_str());
+  gcode_load(g_Sim->gcode_source, loadFileIntoString(g_GCode_path.c_str()));
   session_start();
 
 #ifndef EMSCRIPTEN
   /// stats mode (generate stats without opening GUI)
   if (cmd_stats) {
-    Console::progressTextInit(g_LastLine);
-    while (!step_simulation(false)) {
-      Console::progressTextUpdate(gcode_line());
-    }
+    g_Sim->checkpoint_every_layers = 0; // no scrubbing
+    g_Sim->telemetry_record = !cmd_telemetry.empty();
+    printer_reset();
+    stats_outputs_open(cmd_outputs);
+    Console::progressTextInit(g_Sim->last_line);
+    // decoding and motion run ahead on their own threads
+    sim_pipeline_run(g_Sim->gcode_source, g_Sim->filament_diameter, g_Sim->mm_step,
+      [](const t_motion_sample& s, bool end_of_step) {
+        if (end_of_step) {
+          Console::progressTextUpdate(s.line);
+        }
+        return deposit_sample(s, false);
+      });
     Console::progressTextEnd();
+    stats_outputs_close();
+    if (!cmd_telemetry.empty()) {
+      telemetry_export_csv(cmd_telemetry);
+    }
+    if (g_Sim->use_brickmap && g_Sim->brickmap.saturated()) {
+      std::cerr << Console::red << "voxel memory budget (" << g_Sim->brickmap_budget_mb << " MB) reached, material deposited afterwards is missing from the stats" << Console::gray << std::endl;
+    }
 
-    Histogram hd, ho;
-    gen_histogram(g_DanglingHisto, hd);
-    gen_histogram(g_OverlapHisto, ho);
     std::cout << Console::green << "\n== unsupported ==" << Console::gray << std::endl;
-    hd.print();
+    g_Sim->dangling_histo.print(std::cout);
     std::cout << Console::green << "==  overlaps   ==" << Console::gray << std::endl;
-    ho.print();
+    g_Sim->overlap_histo.print(std::cout);
+    std::cout << Console::green << "== per tool and feature ==" << Console::gray << std::endl;
+    g_Sim->feature_stats.print(std::cout);
+    if (!cmd_outputs.features.empty()) {
+      std::ofstream f(cmd_outputs.features);
+      FeatureStats::writeCSVHeader(f);
+      g_Sim->feature_stats.writeCSV(f, g_GCode_path);
+    }
 
     // export as a .tex histogram
     if (cmd_export_stats != -1.0f) {
-      gen_histogram(g_DanglingHisto, hd, cmd_export_stats);
-      gen_histogram(g_OverlapHisto, ho, cmd_export_stats);
-      export_histogram("dangling", hd);
-      export_histogram("overlap", ho);
+      export_histogram("dangling", g_Sim->dangling_histo, cmd_export_stats);
+      export_histogram("overlap", g_Sim->overlap_histo, cmd_export_stats);
     }
 
     exit(0);
   }
+
+  /// render mode (png snapshots without opening GUI)
+  if (!cmd_render.folder.empty()) {
+    exit(render_snapshots(cmd_render) ? 0 : 1);
+  }
 #endif
 
+  /// the viewer simulation records the graphs of the UI
+  g_Sim->telemetry_record = true;
+
   /// init TrackballUI UI
   TrackballUI::onRender = mainRender;
   TrackballUI::onKeyPressed = mainKeyboard;
@@ -132,67 +284,18 @@ int main(int argc, const char* argv[])
 
   TrackballUI::init(g_ScreenWidth, g_ScreenHeight);
 
-  // GL init
-  glEnable(GL_DEPTH_TEST);
-
   // imgui binding with SimpleUI
   SimpleUI::bindImGui();
 
-  // quad for shader invocation
-  g_GPUMesh_quad = AutoPtr<SimpleMesh>(new SimpleMesh());
-  g_GPUMesh_quad->begin(GPUMESH_TRIANGLELIST);
-  g_GPUMesh_quad->vertex_3(0, 0, 0);
-  g_GPUMesh_quad->vertex_3(1, 0, 0);
-  g_GPUMesh_quad->vertex_3(0, 1, 0);
-
-  g_GPUMesh_quad->vertex_3(0, 1, 0);
-  g_GPUMesh_quad->vertex_3(1, 0, 0);
-  g_GPUMesh_quad->vertex_3(1, 1, 0);
-  g_GPUMesh_quad->end();
-
-  // mesh for axes
-  makeAxisMesh();
-
-  // bed rendering
-  bed_init();
-
-  /// shaders init
-#ifdef EMSCRIPTEN
-  g_ShaderSimple.settings = "#version 300 es\nprecision mediump float;\nprecision mediump int;\n";
-  g_ShaderDeposition.settings = "#version 300 es\nprecision mediump float;\n";
-  g_ShaderFinal.settings = "#version 300 es\nprecision mediump float;\nprecision mediump int;\n";
-#else
-  g_ShaderSimple.settings = "#version 430 core\n";
-  g_ShaderDeposition.settings = "#version 430 core\n";
-  g_ShaderFinal.settings = "#version 430 core\n";
-#endif
-  g_ShaderSimple.init(); // shader for simple drawing
-  g_ShaderDeposition.init(); // shader for drawing deposited material
-  g_ShaderFinal.init(); // final shader
-
-  g_RT = RenderTarget2DRGBA_Ptr(new RenderTarget2DRGBA(g_RTWidth, g_RTHeight, GPUTEX_AUTOGEN_MIPMAP));
-  g_RT->bind();
-  glViewport(g_UIWidth, 0, g_RenderWidth, g_RenderHeight);
-  LibSL::GPUHelpers::clearScreen(LIBSL_COLOR_BUFFER | LIBSL_DEPTH_BUFFER, 0.0f, 0.0f, 0.0f);
-  g_RT->unbind();
-
-  g_GPUMesh_sphere   = AutoPtr<MeshRenderer<mvf_mesh> >(new MeshRenderer<mvf_mesh>(shape_sphere(1.0f, 12)));
-  g_GPUMesh_cylinder = AutoPtr<MeshRenderer<mvf_mesh> >(new MeshRenderer<mvf_mesh>(shape_cylinder(1.0f, 1.0f, 1.0f, 12)));
-
-  /// default view init
-  TrackballUI::trackball().set(v3f(-g_BedSize[0] / 2.0f, -g_BedSize[1] / 2.0f, -300.0f), v3f(0), quatf(v3f(1, 0, 0), -1.0f) * quatf(v3f(0, 0, 1), 0.0f));
-  TrackballUI::trackball().setCenter(v3f(g_BedSize[0] / 2.0f, g_BedSize[1] / 2.0f, 10.0f));
-  TrackballUI::trackball().setBallSpeed(0.0f);
-  TrackballUI::trackball().setAllowRoll(false);
-  TrackballUI::trackball().setUp(Trackball::Z_neg);
+  render_init();
 
-  /// view selection
+  /// default view, or a predefined one
 #ifndef EMSCRIPTEN
-  if (cmd_view > 0 && cmd_view <= 7) {
-    std::string view_file = "trackball.F0";
-    view_file += to_string(cmd_view);
-    TrackballUI::trackballLoad(view_file.c_str());
+  if (!view_select(cmd_view)) {
+    std::cerr << Console::red << "view " << cmd_view << " not found" << Console::gray << std::endl;
   }
+#else
+  view_select(0);
 #endif
 
   SimpleUI::initImGui();
@@ -231,7 +334,7 @@ int main(int argc, const char* argv[])
   emscripten_async_wget("https://icesl.loria.fr/webprinter/report.php", "/reportresult", onLoadedData, onErrorData);
 #endif
 
-  motion_start(g_FilamentDiameter);
+  motion_start(g_Sim->filament_diameter);
 
   printer_reset();
 
@@ -240,6 +343,11 @@ int main(int argc, const char* argv[])
   /// main loop
   TrackballUI::loop();
 
+  sim_thread_stop();
+  hfield_export_stop();
+
+  g_Bead.terminate();
+
   style->pop();
 
   SimpleUI::terminateImGui();
@@ -250,6 +358,84 @@ int main(int argc, const char* argv[])
 
 // ----------------------------------------------------------------
 
+void render_init()
+{
+  // GL init
+  glEnable(GL_DEPTH_TEST);
+
+  // quad for shader invocation
+  g_GPUMesh_quad = AutoPtr<SimpleMesh>(new SimpleMesh());
+  g_GPUMesh_quad->begin(GPUMESH_TRIANGLELIST);
+  g_GPUMesh_quad->vertex_3(0, 0, 0);
+  g_GPUMesh_quad->vertex_3(1, 0, 0);
+  g_GPUMesh_quad->vertex_3(0, 1, 0);
+
+  g_GPUMesh_quad->vertex_3(0, 1, 0);
+  g_GPUMesh_quad->vertex_3(1, 0, 0);
+  g_GPUMesh_quad->vertex_3(1, 1, 0);
+  g_GPUMesh_quad->end();
+
+  // mesh for axes
+  makeAxisMesh();
+
+  // bed rendering
+  bed_init();
+
+  /// shaders init
+#ifdef EMSCRIPTEN
+  g_ShaderSimple.settings = "#version 300 es\nprecision mediump float;\nprecision mediump int;\n";
+  g_ShaderDeposition.settings = "#version 300 es\nprecision mediump float;\n";
+  g_ShaderDepositionImpostor.settings = "#version 300 es\nprecision highp float;\n#define IMPOSTOR\n"; // ray casting needs highp
+  g_ShaderFinal.settings = "#version 300 es\nprecision highp float;\nprecision mediump int;\n"; // sums of depths
+  g_ShaderDepthBlur.settings = "#version 300 es\nprecision highp float;\nprecision mediump int;\n";
+#else
+  g_ShaderSimple.settings = "#version 430 core\n";
+  g_ShaderDeposition.settings = "#version 430 core\n";
+  g_ShaderDepositionImpostor.settings = "#version 430 core\n#define IMPOSTOR\n";
+  g_ShaderFinal.settings = "#version 430 core\n";
+  g_ShaderDepthBlur.settings = "#version 430 core\n";
+#endif
+  g_ShaderSimple.init(); // shader for simple drawing
+  g_ShaderDeposition.init(); // shader for drawing deposited material
+  g_ShaderDepositionImpostor.init(); // same, beads are ray cast
+  g_ShaderFinal.init(); // final shader
+  g_ShaderDepthBlur.init(); // local depth average, horizontal pass
+
+  // render targets, allocated at the render size on first frame
+  g_GBuffer   = GLTarget_Ptr(new GLTarget({ GL_RG32F, GL_RGBA16F }, true));
+  g_DepthBlur = GLTarget_Ptr(new GLTarget({ GL_RG32F }, false));
+
+  g_GPUMesh_cylinder = AutoPtr<MeshRenderer<mvf_mesh> >(new MeshRenderer<mvf_mesh>(shape_cylinder(1.0f, 1.0f, 1.0f, 12)));
+  g_Bead.init(); // instanced bead rendering
+}
+
+// ----------------------------------------------------------------
+
+bool view_select(int view)
+{
+  /// default view init
+  TrackballUI::trackball().set(v3f(-g_Sim->bed_size[0] / 2.0f, -g_Sim->bed_size[1] / 2.0f, -300.0f), v3f(0), quatf(v3f(1, 0, 0), -1.0f) * quatf(v3f(0, 0, 1), 0.0f));
+  TrackballUI::trackball().setCenter(v3f(g_Sim->bed_size[0] / 2.0f, g_Sim->bed_size[1] / 2.0f, 10.0f));
+  TrackballUI::trackball().setBallSpeed(0.0f);
+  TrackballUI::trackball().setAllowRoll(false);
+  TrackballUI::trackball().setUp(Trackball::Z_neg);
+
+  /// view selection
+#ifndef EMSCRIPTEN
+  if (view > 0 && view <= 7) {
+    std::string view_file = "trackball.F0";
+    view_file += to_string(view);
+    if (!LibSL::System::File::exists(view_file.c_str())) {
+      return false;
+    }
+    TrackballUI::trackballLoad(view_file.c_str());
+  }
+#endif
+  return true;
+}
+
+// ----------------------------------------------------------------
+
 void load_gcode(std::string file) {
   if (file.empty()) {
 #ifdef EMSCRIPTEN
@@ -272,41 +458,7 @@ void load_gcode(std::string file) {
 
 // ----------------------------------------------------------------
 
-void gen_histogram(std::map<int, float> &map, Histogram &histo, float filter) {
-  std::map<int, float> t_map = map;
-  std::map<int, float> data_percent;
-  std::map<int, float>::iterator it;
-  // computing summ
-  int summ = 0;
-  for (auto _m : t_map) {
-    summ += _m.second;
-  }
-  // computing percentages
-  for (auto _m : t_map) {
-    float p = (_m.second / summ);
-    data_percent.emplace(std::pair<int, float>(_m.first, p));
-  }
-  // filter out too low values based on the filter
-  for (auto _m : data_percent) {
-    if (_m.second <= 1.0f - filter) {
-      it = t_map.find(_m.first);
-      t_map.erase(it);
-    }
-  }
-
-  histo;
-  int n = 0; // re-do the indexing, since we delete some entries when filtering
-  for (auto _m : t_map) {
-    ForIndex(i, _m.second) { // totally stupid loop, but hey, no consequence and we reuse what we have
-      histo << n;
-    }
-    n++;
-  }
-}
-
-// ----------------------------------------------------------------
-
-void export_histogram(std::string fname, Histogram &h) {
+void export_histogram(std::string fname, const LengthHistogram &h, float filter) {
   // prepare additionnal informations for the histogram
   std::string y_label = fname;
   // prepare full file name
@@ -318,7 +470,7 @@ void export_histogram(std::string fname, Histogram &h) {
   ofstream file (fname);
   if (file.is_open()) {
     std::cout << Console::blue << "Generate statistics file : " << fname << Console::gray << std::endl;
-    h.printAsTex(file, "", "", y_label.c_str());
+    h.exportTex(file, y_label, filter);
     file.close();
   }
   else {
@@ -342,82 +494,1035 @@ string getFileName(const string& s) {
 
 // ----------------------------------------------------------------
 
+#ifndef EMSCRIPTEN
+
+typedef struct
+{
+  std::string          file;
+  bool                 ok = false;
+  std::string          error;
+  int                  lines = 0;
+  int                  layers = 0;
+  double               deposition = 0.0; // mm
+  double               print_time = 0.0; // s, simulated
+  double               wall_time  = 0.0; // s, spent simulating
+  LengthHistogram      dangling;
+  LengthHistogram      overlap;
+  FeatureStats         features;
+} t_batch_result;
+
+static void batch_write_record(std::ofstream& f, const t_batch_result& r)
+{
+  f << csv_quote(r.file) << ',' << (r.ok ? "ok" : "error") << ',' << r.lines << ',' << r.layers
+    << ',' << r.deposition << ',' << r.print_time
+    << ',' << r.dangling.total() << ',' << r.dangling.count() << ',' << r.dangling.percentile(0.9) << ',' << r.dangling.maxLength()
+    << ',' << r.overlap.total() << ',' << r.overlap.count() << ',' << r.overlap.percentile(0.9) << ',' << r.overlap.maxLength()
+    << ',' << r.wall_time << ',' << csv_quote(r.error) << std::endl;
+}
+
+// gcodes of a folder (recursively) or listed in a text file
+static std::vector<std::string> batch_files(const std::string& input)
+{
+  std::vector<std::string> files;
+  std::error_code err;
+  if (std::filesystem::is_directory(input)) {
+    for (const auto& e : std::filesystem::recursive_directory_iterator(input, err)) {
+      if (!e.is_regular_file()) continue;
+      std::string ext = e.path().extension().string();
+      std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+      if (ext == ".gcode" || ext == ".gco" || ext == ".g") {
+        files.push_back(e.path().string());
+      }
+    }
+  } else {
+    std::ifstream list(input);
+    std::string   line;
+    while (std::getline(list, line)) {
+      line.erase(line.find_last_not_of(" \t\r") + 1);
+      if (!line.empty() && line[0] != '#') {
+        files.push_back(line);
+      }
+    }
+  }
+  // largest first, small ones fill the gaps at the end
+  std::vector<std::pair<uintmax_t, std::string> > sized;
+  for (const auto& f : files) {
+    sized.push_back(std::make_pair(std::filesystem::file_size(f, err), f));
+  }
+  std::sort(sized.begin(), sized.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+  files.clear();
+  for (const auto& s : sized) {
+    files.push_back(s.second);
+  }
+  return files;
+}
+
+void stats_outputs_open(const t_stats_outputs& outputs, const std::string& batch_file)
+{
+  if (!outputs.layers.empty()) {
+    std::string fname = outputs.layers;
+    if (!batch_file.empty()) {
+      // next to the gcode, same extension as requested
+      std::string ext = std::filesystem::path(outputs.layers).extension().string();
+      fname = batch_file + "_layers" + (ext.empty() ? ".jsonl" : ext);
+    }
+    g_Sim->layer_stats.open(fname);
+  }
+  if (!outputs.heatmap.empty()) {
+    std::string base = batch_file.empty() ? outputs.heatmap : batch_file + "_heatmap";
+    g_Sim->heatmap.open(base, g_Sim->hfield_box, outputs.heatmap_cell, outputs.heatmap_layers);
+  }
+}
+
+void stats_outputs_close()
+{
+  g_Sim->layer_stats.close();
+  g_Sim->heatmap.close();
+}
+
+void batch_stats(const std::string& input, const std::string& output, int num_threads, float export_filter, const t_stats_outputs& outputs)
+{
+  std::vector<std::string> files = batch_files(input);
+  if (files.empty()) {
+    std::cerr << Console::red << "No gcode found in " << input << Console::gray << std::endl;
+    return;
+  }
+  std::ofstream f(output);
+  if (!f) {
+    std::cerr << Console::red << "Unable to write " << output << Console::gray << std::endl;
+    return;
+  }
+  f << "file,status,lines,layers,deposition_mm,print_time_s,dangling_mm,dangling_count,dangling_p90_mm,dangling_max_mm,overlap_mm,overlap_count,overlap_p90_mm,overlap_max_mm,wall_time_s,error" << std::endl;
+
+  // per tool and feature role, rows of all files in a single table
+  std::ofstream ff;
+  if (!outputs.features.empty()) {
+    ff.open(outputs.features);
+    FeatureStats::writeCSVHeader(ff);
+  }
+
+  // settings of the jobs, each job simulates in its own context
+  t_sim_settings settings          = *g_Sim;
+  settings.verbose                 = false;
+  settings.show_trajectory         = false;
+  settings.start_at_line           = 0;
+  settings.checkpoint_every_layers = 0; // no scrubbing
+  settings.telemetry_record        = false;
+
+  WorkStealingPool pool(num_threads);
+  std::cout << "Simulating " << files.size() << " gcode(s) on " << pool.numThreads() << " thread(s)" << std::endl;
+
+  // aggregate, histograms merge exactly
+  std::mutex                  mutex;
+  t_batch_result              total;
+  int                         done = 0, failed = 0;
+  total.file = "*total*";
+  total.ok   = true;
+  t_time                      tm_start = milliseconds();
+  for (const auto& file : files) {
+    pool.add([&, file](int) {
+      t_batch_result r;
+      r.file = file;
+      t_time tm = milliseconds();
+      // released once the record is written, the thread is reused
+      std::unique_ptr<t_sim_context> sim(new t_sim_context(settings));
+      sim_bind(sim.get());
+      try {
+        gcode_load(g_Sim->gcode_source, loadFileIntoString(file.c_str()));
+        session_start();
+        printer_reset();
+        stats_outputs_open(outputs, file);
+        while (!step_simulation(false)) { }
+        stats_outputs_close();
+        r.ok         = !gcode_error();
+        r.error      = gcode_error() ? sprint("parse error line %d", gcode_line()) : "";
+        if (r.ok && g_Sim->use_brickmap && g_Sim->brickmap.saturated()) {
+          r.error    = "voxel memory budget reached, stats incomplete";
+        }
+        r.lines      = g_Sim->last_line;
+        r.layers     = g_Sim->num_layers;
+        r.deposition = g_Sim->deposition_length;
+        r.print_time = g_Sim->simulated_time / 1000.0;
+        r.dangling   = g_Sim->dangling_histo;
+        r.overlap    = g_Sim->overlap_histo;
+        r.features   = g_Sim->feature_stats;
+      } catch (std::exception& e) {
+        r.error = e.what();
+      } catch (...) {
+        r.error = "unable to load";
+      }
+      r.wall_time = (double)(milliseconds() - tm) / 1000.0;
+      stats_outputs_close();
+      sim_bind(NULL);
+      // one record per file, as soon as done
+      std::unique_lock<std::mutex> lock(mutex);
+      batch_write_record(f, r);
+      if (ff.is_open()) {
+        r.features.writeCSV(ff, file);
+      }
+      if (r.ok) {
+        total.lines      += r.lines;
+        total.layers     += r.layers;
+        total.deposition += r.deposition;
+        total.print_time += r.print_time;
+        total.wall_time  += r.wall_time;
+        total.dangling.merge(r.dangling);
+        total.overlap.merge(r.overlap);
+        total.features.merge(r.features);
+      } else {
+        failed++;
+      }
+      std::cout << "[" << ++done << "/" << files.size() << "] "
+                << (r.ok ? "" : "FAILED ") << file << std::endl;
+    });
+  }
+  pool.run();
+
+  // aggregate summary
+  total.error = sprint("%d failed", failed);
+  batch_write_record(f, total);
+  if (ff.is_open()) {
+    total.features.writeCSV(ff, total.file);
+  }
+
+  std::cout << Console::green << "\n== summary ==" << Console::gray << std::endl;
+  std::cout << files.size() - failed << " gcode(s) simulated, " << failed << " failed, in "
+            << (double)(milliseconds() - tm_start) / 1000.0 << " s" << std::endl;
+  std::cout << "results written to " << output << std::endl;
+  std::cout << Console::green << "== unsupported ==" << Console::gray << std::endl;
+  total.dangling.print(std::cout);
+  std::cout << Console::green << "==  overlaps   ==" << Console::gray << std::endl;
+  total.overlap.print(std::cout);
+  std::cout << Console::green << "== per tool and feature ==" << Console::gray << std::endl;
+  total.features.print(std::cout);
+  if (export_filter != -1.0f) {
+    std::ofstream fd(output + "_dangling.tex"), fo(output + "_overlap.tex");
+    total.dangling.exportTex(fd, "dangling", export_filter);
+    total.overlap.exportTex(fo, "overlap", export_filter);
+  }
+}
+
+// ----------------------------------------------------------------
+
+typedef struct
+{
+  double z;
+  double time;       // ms, simulated
+  double deposition; // mm
+  double dangling;   // mm
+  double overlap;    // mm
+} t_compare_layer;
+
+typedef struct
+{
+  std::string                  file;
+  std::string                  settings;
+  bool                         ok = false;
+  std::string                  error;
+  int                          lines = 0;
+  double                       deposition = 0.0; // mm
+  double                       print_time = 0.0; // s, simulated
+  double                       wall_time  = 0.0; // s
+  LengthHistogram              dangling;
+  LengthHistogram              overlap;
+  std::vector<t_compare_layer> layers;
+} t_compare_side;
+
+// applies a list of key=value settings: nozzle, resolution (height field cell),
+// filament, threshold (stats height), voxels (0/1)
+// with filament_only, the other keys are checked but not applied
+static bool compare_apply_settings(const std::string& settings, std::string& _error, bool filament_only = false)
+{
+  std::stringstream str(settings);
+  std::string       kv;
+  while (std::getline(str, kv, ',')) {
+    if (kv.empty()) continue;
+    size_t eq = kv.find('=');
+    if (eq == std::string::npos) {
+      _error = "expected key=value in '" + kv + "'";
+      return false;
+    }
+    std::string key = kv.substr(0, eq);
+    float       val = (float)atof(kv.substr(eq + 1).c_str());
+    if (filament_only && key != "filament") {
+      continue;
+    }
+    if (key == "nozzle") {
+      g_Sim->nozzle_diameter = val;
+    } else if (key == "resolution") {
+      g_Sim->auto_hfield_step = false;
+      g_Sim->hfield_step      = val;
+    } else if (key == "filament") {
+      g_Sim->filament_diameter = val;
+    } else if (key == "threshold") {
+      g_Sim->stats_height_thres = val;
+    } else if (key == "voxels") {
+      g_Sim->use_brickmap = (val != 0.0f);
+    } else {
+      _error = "unknown setting '" + key + "'";
+      return false;
+    }
+  }
+  return true;
+}
+
+// totals so far
+static t_compare_layer compare_totals()
+{
+  t_compare_layer l;
+  l.z          = g_Sim->current_layer_z;
+  l.time       = g_Sim->simulated_time;
+  l.deposition = g_Sim->deposition_length;
+  l.dangling   = g_Sim->dangling_histo.total();
+  l.overlap    = g_Sim->overlap_histo.total();
+  return l;
+}
+
+// simulates from the current state, totals are recorded at the start of each layer
+static void compare_simulate(t_compare_side& _side)
+{
+  // same steps as step_simulation, the layer change is checked after each sample
+  // so that the samples of a step following it count in the new layer
+  auto deposit = [&_side](const t_motion_sample& s, bool) {
+    t_compare_layer before = compare_totals();
+    bool done = deposit_sample(s, false);
+    // the sample started a layer: totals before it
+    while (g_Sim->num_layers > (int)_side.layers.size()) {
+      before.z = g_Sim->current_layer_z;
+      _side.layers.push_back(before);
+    }
+    return done;
+  };
+  while (!motion_simulation_step(g_Sim->mm_step, deposit)) { }
+  // totals at layer start -> amounts per layer
+  ForIndex(i, _side.layers.size()) {
+    t_compare_layer& l = _side.layers[i];
+    bool last = (i + 1 == (int)_side.layers.size());
+    l.time       = (last ? g_Sim->simulated_time          : _side.layers[i + 1].time)       - l.time;
+    l.deposition = (last ? g_Sim->deposition_length : _side.layers[i + 1].deposition) - l.deposition;
+    l.dangling   = (last ? g_Sim->dangling_histo.total()  : _side.layers[i + 1].dangling)   - l.dangling;
+    l.overlap    = (last ? g_Sim->overlap_histo.total()   : _side.layers[i + 1].overlap)    - l.overlap;
+  }
+  _side.ok         = !gcode_error();
+  _side.error      = gcode_error() ? sprint("parse error line %d", gcode_line()) : "";
+  _side.lines      = g_Sim->last_line;
+  _side.deposition = g_Sim->deposition_length;
+  _side.print_time = g_Sim->simulated_time / 1000.0;
+  _side.dangling   = g_Sim->dangling_histo;
+  _side.overlap    = g_Sim->overlap_histo;
+}
+
+static void compare_write_layers(const std::string& output, const t_compare_side& a, const t_compare_side& b)
+{
+  std::ofstream f(output);
+  if (!f) {
+    std::cerr << Console::red << "Unable to write " << output << Console::gray << std::endl;
+    return;
+  }
+  f << "z_mm,a_time_s,b_time_s,a_deposition_mm,b_deposition_mm,a_dangling_mm,b_dangling_mm,dangling_delta_mm,a_overlap_mm,b_overlap_mm,overlap_delta_mm" << std::endl;
+  // layers are matched by height, a layer missing on one side has empty fields
+  const double tol = 0.01; // mm
+  t_compare_layer none = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+  size_t i = 0, j = 0;
+  while (i < a.layers.size() || j < b.layers.size()) {
+    bool has_a = i < a.layers.size() && (j == b.layers.size() || a.layers[i].z <= b.layers[j].z + tol);
+    bool has_b = j < b.layers.size() && (i == a.layers.size() || b.layers[j].z <= a.layers[i].z + tol);
+    const t_compare_layer& la = has_a ? a.layers[i] : none;
+    const t_compare_layer& lb = has_b ? b.layers[j] : none;
+    auto field = [&f](bool has, double v) { f << ','; if (has) f << v; };
+    f << (has_a ? la.z : lb.z);
+    field(has_a, la.time / 1000.0);       field(has_b, lb.time / 1000.0);
+    field(has_a, la.deposition);          field(has_b, lb.deposition);
+    field(has_a, la.dangling);            field(has_b, lb.dangling);
+    field(true,  lb.dangling - la.dangling);
+    field(has_a, la.overlap);             field(has_b, lb.overlap);
+    field(true,  lb.overlap - la.overlap);
+    f << std::endl;
+    if (has_a) i++;
+    if (has_b) j++;
+  }
+}
+
+static void compare_report(const t_compare_side& a, const t_compare_side& b)
+{
+  auto row = [](const char *name, double va, double vb) {
+    double pc = va != 0.0 ? 100.0 * (vb - va) / va : 0.0;
+    std::cout << sprint("%-22s %14.3f %14.3f %+14.3f %+9.1f%%", name, va, vb, vb - va, pc) << std::endl;
+  };
+  std::cout << Console::green << "\n== compare ==" << Console::gray << std::endl;
+  std::cout << "A: " << a.file << (a.settings.empty() ? "" : " [" + a.settings + "]") << std::endl;
+  std::cout << "B: " << b.file << (b.settings.empty() ? "" : " [" + b.settings + "]") << std::endl;
+  std::cout << sprint("%-22s %14s %14s %14s %10s", "", "A", "B", "B-A", "") << std::endl;
+  row("print time (s)",      a.print_time,              b.print_time);
+  row("deposition (mm)",     a.deposition,              b.deposition);
+  row("layers",              (double)a.layers.size(),   (double)b.layers.size());
+  row("dangling (mm)",       a.dangling.total(),        b.dangling.total());
+  row("dangling count",      a.dangling.count(),        b.dangling.count());
+  row("dangling median (mm)",a.dangling.percentile(0.5),b.dangling.percentile(0.5));
+  row("dangling p90 (mm)",   a.dangling.percentile(0.9),b.dangling.percentile(0.9));
+  row("dangling max (mm)",   a.dangling.maxLength(),    b.dangling.maxLength());
+  row("overlap (mm)",        a.overlap.total(),         b.overlap.total());
+  row("overlap count",       a.overlap.count(),         b.overlap.count());
+  row("overlap median (mm)", a.overlap.percentile(0.5), b.overlap.percentile(0.5));
+  row("overlap p90 (mm)",    a.overlap.percentile(0.9), b.overlap.percentile(0.9));
+  row("overlap max (mm)",    a.overlap.maxLength(),     b.overlap.maxLength());
+}
+
+void compare_stats(const std::string& file_a, const std::string& file_b, const std::string& settings_b, const std::string& output)
+{
+  t_compare_side sides[2];
+  sides[0].file     = file_a;
+  sides[1].file     = file_b.empty() ? file_a : file_b;
+  sides[1].settings = settings_b;
+  std::error_code err;
+  bool same_file = std::filesystem::equivalent(sides[0].file, sides[1].file, err);
+
+  // each side simulates in its own context, from the settings of the caller
+  t_sim_settings base          = *g_Sim;
+  base.verbose                 = false;
+  base.show_trajectory         = false;
+  base.start_at_line           = 0;
+  base.checkpoint_every_layers = 0;
+  base.telemetry_record        = false;
+  std::unique_ptr<t_sim_context> sims[2];
+  auto settings = [&](int s) {
+    sims[s].reset(new t_sim_context(base));
+    sim_bind(sims[s].get());
+    std::string error;
+    if (!compare_apply_settings(sides[s].settings, error)) {
+      throw std::runtime_error(error);
+    }
+  };
+  // overrides the filament read from the gcode, the other settings are kept as
+  // the height field was allocated with them (session_start, session_prepare)
+  auto filament = [&](const t_compare_side& side) {
+    std::string error;
+    if (!compare_apply_settings(side.settings, error, true)) {
+      throw std::runtime_error(error);
+    }
+  };
+
+  t_time tm_start = milliseconds();
+  std::thread workers[2];
+  if (!same_file) {
+    // two gcodes, two independent simulations
+    ForIndex(s, 2) {
+      workers[s] = std::thread([&, s]() {
+        t_compare_side& side = sides[s];
+        t_time tm = milliseconds();
+        try {
+          settings(s);
+          gcode_load(g_Sim->gcode_source, loadFileIntoString(side.file.c_str()));
+          session_start();
+          filament(side);
+          printer_reset();
+          compare_simulate(side);
+        } catch (std::exception& e) {
+          side.error = e.what();
+        } catch (...) {
+          side.error = "unable to load";
+        }
+        side.wall_time = (double)(milliseconds() - tm) / 1000.0;
+      });
+    }
+    ForIndex(s, 2) {
+      workers[s].join();
+    }
+  } else {
+    // same gcode: decoded once, the moves feed both simulations
+    std::cout << "Same gcode, decoded once for both simulations" << std::endl;
+    try {
+      g_Sim->verbose      = false;
+      gcode_load(g_Sim->gcode_source, loadFileIntoString(file_a.c_str()));
+    } catch (...) {
+      std::cerr << Console::red << "Unable to load " << file_a << Console::gray << std::endl;
+      return;
+    }
+    // bounding box and extruders, from a first pass as in session_start
+    gcode_start(g_Sim->gcode_source);
+    AAB<3> box;
+    while (gcode_advance()) {
+      box.addPoint(v3f(gcode_next_pos()));
+    }
+    int           last_line = gcode_line();
+    float         filament_dia = (float)gcode_filament_dia();
+    std::set<int> extruders = gcode_used_extruders();
+    gcode_reset();
+    t_gcode_state start;
+    gcode_save(start);
+
+    t_gcode_feed               feeds[2];
+    std::vector<t_gcode_feed*> outs = { &feeds[0], &feeds[1] };
+    const t_gcode_source& gcode = g_Sim->gcode_source;
+    std::thread decoder(sim_pipeline_decode, std::cref(gcode), std::cref(start), std::cref(extruders), std::cref(outs));
+    ForIndex(s, 2) {
+      workers[s] = std::thread([&, s]() {
+        t_compare_side& side = sides[s];
+        t_time tm = milliseconds();
+        try {
+          settings(s);
+          gcode_start(gcode);
+          gcode_set_used_extruders(extruders);
+          g_Sim->hfield_box        = box;
+          g_Sim->last_line         = last_line;
+          g_Sim->filament_diameter = filament_dia;
+          session_prepare();
+          filament(side);
+          printer_reset();
+          // the interpreter now pops the moves decoded by the decoder thread
+          gcode_feed_start(&feeds[s], start);
+          compare_simulate(side);
+        } catch (std::exception& e) {
+          side.error = e.what();
+        } catch (...) {
+          side.error = "simulation failed";
+        }
+        gcode_feed_stop();
+        feeds[s].close(); // lets the decoder go on with the other simulation
+        side.wall_time = (double)(milliseconds() - tm) / 1000.0;
+      });
+    }
+    ForIndex(s, 2) {
+      workers[s].join();
+    }
+    decoder.join();
+  }
+
+  ForIndex(s, 2) {
+    if (!sides[s].ok) {
+      std::cerr << Console::red << (s == 0 ? "A" : "B") << " failed: " << sides[s].error << Console::gray << std::endl;
+    }
+  }
+  compare_report(sides[0], sides[1]);
+  std::cout << "simulated in " << (double)(milliseconds() - tm_start) / 1000.0 << " s" << std::endl;
+  compare_write_layers(output, sides[0], sides[1]);
+  std::cout << "per layer differences written to " << output << std::endl;
+}
+
+// ----------------------------------------------------------------
+
+// draws the beads of the store in clip and reads back the shaded image
+static void render_snapshot(const m4x4f& proj, const m4x4f& view, float fov, const int clip[4], GLTarget& image, std::vector<uchar>& _px)
+{
+  int w = image.w(), h = image.h();
+  // g-buffer
+  g_GBuffer->bind();
+  glViewport(0, 0, w, h);
+  LibSL::GPUHelpers::clearScreen(LIBSL_COLOR_BUFFER | LIBSL_DEPTH_BUFFER, 0.0f, 0.0f, 0.0f);
+  glEnable(GL_CULL_FACE);
+  AutoBindShader::deposition& shader_deposition = deposition_begin(proj, view, fov, h, clip);
+  g_Bead.redraw();
+  shader_deposition.end();
+  g_GBuffer->unbind();
+  // shading and bed
+  image.bind();
+  glViewport(0, 0, w, h);
+  LibSL::GPUHelpers::clearScreen(LIBSL_COLOR_BUFFER | LIBSL_DEPTH_BUFFER, 0.1f, 0.1f, 0.1f);
+  gbuffer_shade(0, w, h, &image);
+  bed_render(proj, view, g_Sim->bed_size[0], g_Sim->bed_size[1]);
+  // read back
+  _px.resize(4 * (size_t)w * (size_t)h);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, _px.data());
+  image.unbind();
+}
+
+// ----------------------------------------------------------------
+
+bool render_snapshots(const t_render_request& request)
+{
+  // output folder first, not to simulate for nothing
+  std::error_code ec;
+  std::filesystem::create_directories(request.folder, ec);
+  if (ec) {
+    std::cerr << Console::red << "Cannot create " << request.folder << ": " << ec.message() << Console::gray << std::endl;
+    return false;
+  }
+  std::string error;
+  if (!headless_context_create(error)) {
+    std::cerr << Console::red << "Cannot render offscreen: " << error << Console::gray << std::endl;
+    return false;
+  }
+  std::cerr << Console::blue << "Rendering with " << (const char*)glGetString(GL_RENDERER) << Console::gray << std::endl;
+
+  render_init();
+  g_RenderWidth  = request.width;
+  g_RenderHeight = request.height;
+  g_GBuffer->allocate(request.width, request.height);
+  g_DepthBlur->allocate(request.width, request.height);
+  GLTarget_Ptr image(new GLTarget({ GL_RGBA8 }, true));
+  image->allocate(request.width, request.height);
+  glDepthFunc(GL_LEQUAL);
+
+  // simulate up to the last requested line and layer, all beads are kept
+  // in the store, each snapshot then draws the ones in its range
+  bool to_end                    = request.lines.empty() && request.layers.empty();
+  int  max_line                  = request.lines.empty()  ? -1 : *std::max_element(request.lines.begin(), request.lines.end());
+  int  max_layer                 = request.layers.empty() ? -1 : *std::max_element(request.layers.begin(), request.layers.end());
+  g_Sim->checkpoint_every_layers = 0; // no scrubbing
+  g_Sim->telemetry_record        = false;
+  g_Sim->show_trajectory         = false;
+  printer_reset();
+  g_Bead.clear();
+  Console::progressTextInit(g_Sim->last_line);
+  // decoding and motion run ahead on their own threads
+  sim_pipeline_run(g_Sim->gcode_source, g_Sim->filament_diameter, g_Sim->mm_step,
+    [&](const t_motion_sample& s, bool end_of_step) {
+      if (deposit_sample(s, true)) {
+        return true;
+      }
+      if (end_of_step) {
+        Console::progressTextUpdate(s.line);
+        return !to_end && s.line > max_line && g_Sim->num_layers > max_layer;
+      }
+      return false;
+    });
+  Console::progressTextEnd();
+
+  // snapshots, one per view and range
+  typedef struct {
+    std::string name;
+    int         clip[4]; // layer min, max, line min, max
+  } t_snapshot;
+  std::vector<t_snapshot> snapshots;
+  if (to_end) {
+    snapshots.push_back({ "", { INT_MIN, INT_MAX, INT_MIN, INT_MAX } });
+  }
+  for (int line : request.lines) {
+    snapshots.push_back({ "_line" + to_string(line), { INT_MIN, INT_MAX, INT_MIN, line } });
+  }
+  for (int layer : request.layers) {
+    snapshots.push_back({ "_layer" + to_string(layer), { INT_MIN, layer, INT_MIN, INT_MAX } });
+  }
+  // frame the printed part (bounds of the gcode, in printer coordinates), or the bed
+  AAB<3> bx;
+  const AAB<3>& part = g_Sim->hfield_box;
+  if (part.minCorner()[0] <= part.maxCorner()[0]) {
+    bx.addPoint(v3f(printer_position(v3d(part.minCorner()), 0)));
+    bx.addPoint(v3f(printer_position(v3d(part.maxCorner()), 0)));
+  } else {
+    bx.addPoint(v3f(0.0f));
+    bx.addPoint(v3f(g_Sim->bed_size[0], g_Sim->bed_size[1], 0.0f));
+  }
+  const float fov = (float)M_PI / 6.0f;
+  m4x4f proj = perspectiveMatrixGL<float>(fov, (float)request.width / (float)request.height, ZNear, ZFar);
+  std::vector<uchar> px;
+  int num_written = 0;
+  for (int v : request.views) {
+    if (!view_select(v)) {
+      std::cerr << Console::red << "view " << v << " not found (trackball.F0" << v << ")" << Console::gray << std::endl;
+      continue;
+    }
+    m4x4f view = trackball_view(bx);
+    for (const t_snapshot& snap : snapshots) {
+      render_snapshot(proj, view, fov, snap.clip, *image, px);
+      std::string fname = (std::filesystem::path(request.folder) / ("view" + to_string(v) + snap.name + ".png")).string();
+      if (write_png_rgb(fname, px, request.width, request.height)) {
+        num_written++;
+      } else {
+        std::cerr << Console::red << "cannot write " << fname << Console::gray << std::endl;
+      }
+    }
+  }
+  std::cout << num_written << " snapshots written to " << request.folder << std::endl;
+
+  image       = GLTarget_Ptr();
+  g_GBuffer   = GLTarget_Ptr();
+  g_DepthBlur = GLTarget_Ptr();
+  g_Bead.terminate();
+  headless_context_destroy();
+  return true;
+}
+
+#endif
+
+// ----------------------------------------------------------------
+
 void printer_reset()
 {
+  g_Sim->pipeline.stop(); // restarts from the new state on next step
   // TODO: track state of gcode (if different, make a 1st pass link in session_start() to correctly fetch extruder number)
   gcode_reset();
-  g_PrevPos      = v3d(0.0);
-  g_PrevPrevPos  = v3d(0.0);
+  g_Sim->prev_pos                    = v3d(0.0);
+  g_Sim->prev_prev_pos               = v3d(0.0);
+  g_Sim->prev_was_travel_or_dangling = false;
+  g_Sim->prev_thickness              = 0.0;
+  g_Sim->simulated_time              = 0.0;
+  g_Sim->current_layer_z             = 0.0;
+  g_Sim->num_layers                  = 0;
+  g_Sim->finished                    = false;
+
+  g_Sim->num_extruders = gcode_extruders() > 0 ? gcode_extruders() : 1;
+  g_Sim->extruders_offset.clear();
+
+  g_Sim->trajectory.clear();
+  g_Sim->height_segments.clear();
+  g_Sim->deposition_length = 0.0f;
+
+  // checkpoints recorded with other settings are useless
+  std::string settings = simulation_settings();
+  if (settings != g_Sim->checkpoint_settings) {
+    checkpoints_clear();
+    g_Sim->checkpoint_settings = settings;
+  }
+
+  if (!g_Sim->use_brickmap && checkpoint_restore(g_Sim->start_at_line)) {
+    // replay the (short) tail up to the start line, not drawn
+    g_Sim->state_exact = true;
+    g_Bead.closeAny();
+    bool dump = g_Sim->dump_hfield, pause = g_Sim->auto_pause;
+    g_Sim->dump_hfield = g_Sim->auto_pause = false;
+    while (gcode_line() < g_Sim->start_at_line) {
+      if (step_simulation(false)) break;
+    }
+    g_Sim->dump_hfield = dump;
+    g_Sim->auto_pause  = pause;
+    g_Sim->trajectory.clear();
+    g_Sim->dump_last_z = g_Sim->current_layer_z;
+  } else {
+    // deposit everything before the start line, not drawn, no stats
+    heightfield_fill(0.0f);
+    g_Sim->brickmap.clear();
+    printer_fast_forward(g_Sim->start_at_line);
+    // thicknesses are approximated, do not record checkpoints from there
+    g_Sim->state_exact = (g_Sim->start_at_line == 0);
+    g_Sim->dump_last_z = g_Sim->current_layer_z;
+    motion_reset(g_Sim->filament_diameter);
+  }
+  g_Sim->dump_last_len = g_Sim->deposition_length;
 
-  g_NumExtruders = gcode_extruders() > 0 ? gcode_extruders() : 1;
-  g_Extruders_offset.clear();
+  // stats
+  g_Sim->dangling_trajectory.clear();
+  g_Sim->in_dangling = false;
+  g_Sim->in_dangling_bridging = false;
+  g_Sim->dangling_histo.clear();
+  g_Sim->in_overlap = false;
+  g_Sim->overlap_histo.clear();
+  g_Sim->feature_stats.clear();
+  if (g_Sim->telemetry_record) {
+    telemetry_clear(g_Sim->simulated_time);
+  }
+  g_Sim->current_line = gcode_line();
+  g_Sim->current_pos  = v3d(motion_get_current_pos());
+}
 
-  g_Trajectory.clear();
-  g_HeightSegments.clear();
-  g_GlobalDepositionLength = 0.0f;
+// ----------------------------------------------------------------
 
-  double prev_z   = 0.0;
-  double curr_z   = 0.0;
-  while (gcode_line() < g_StartAtLine) {
-    gcode_advance();
-    if (gcode_next_pos()[2] > curr_z) {
-      prev_z = curr_z;
-      curr_z = gcode_next_pos()[2];
+void printer_fast_forward(int line)
+{
+  const size_t c_BatchSize = 1 << 20; // segments
+  std::vector<t_height_segment> segs;
+  double cs      = M_PI * g_Sim->filament_diameter * g_Sim->filament_diameter / 4.0; // mm^2
+  double below_z = 0.0; // top of the layer below
+  double th      = g_Sim->prev_thickness;
+  while (gcode_line() < line) {
+    v4d prev = gcode_next_pos();
+    if (!gcode_advance()) break;
+    v4d next = gcode_next_pos();
+    double len     = length(v3d(next) - v3d(prev));
+    double delta_e = next[3] - prev[3];
+    if (len < 1e-6 || abs(delta_e) < 1e-6) {
+      continue; // travel, or extrusion only
+    }
+    // thickness from the layer below, the height field is not queried
+    if (next[2] > g_Sim->current_layer_z + c_ThicknessEpsilon) {
+      below_z                = g_Sim->current_layer_z;
+      g_Sim->current_layer_z = next[2];
+      g_Sim->num_layers++;
+    }
+    if (next[2] - below_z >= c_ThicknessEpsilon) {
+      th = next[2] - below_z;
+    }
+    // same bead size as step_simulation
+    double sa = (delta_e / len) * cs;
+    double r  = sqrt(sa / M_PI);
+    double rs = disk_squashed_radius(r, min(th / 2.0, r));
+    // fixed size for this segment only, th follows the layers as in deposit_sample
+    double seg_th = th;
+    if (!g_Sim->auto_deposition_hw) {
+      seg_th = g_Sim->deposition_height;
+      rs     = g_Sim->deposition_width;
+    }
+    t_height_segment seg;
+    seg.a         = printer_position(v3d(next), gcode_current_extruder());
+    seg.b         = printer_position(v3d(prev), gcode_current_extruder());
+    seg.radius    = rs;
+    seg.thickness = seg_th;
+    g_Sim->deposition_length += len;
+    seg.deplength = g_Sim->deposition_length;
+    segs.push_back(seg);
+    if (segs.size() >= c_BatchSize) {
+      rasterizeSegmentsParallel(segs);
+      segs.clear();
     }
   }
-  g_HeightField.fill((float)prev_z);
+  rasterizeSegmentsParallel(segs);
+  g_Sim->prev_thickness = th;
+}
 
-  motion_reset(g_FilamentDiameter);
+// ----------------------------------------------------------------
 
-  // stats
-  g_DanglingTrajectory.clear();
-  g_InDangling = false;
-  g_InDanglingBridging = false;
-  g_DanglingHisto.clear();
-  g_InOverlap = false;
-  g_OverlapHisto.clear();
+void sim_bind(t_sim_context *sim)
+{
+  g_Sim = sim;
+  gcode_bind(sim != NULL ? &sim->gcode : NULL);
+  motion_bind(sim != NULL ? &sim->motion : NULL);
+}
+
+// ----------------------------------------------------------------
+
+bool sim_settings_equal(const t_sim_settings& a, const t_sim_settings& b)
+{
+  // all the members of t_sim_settings
+  return a.bed_size[0] == b.bed_size[0] && a.bed_size[1] == b.bed_size[1]
+    && a.filament_diameter       == b.filament_diameter
+    && a.nozzle_diameter         == b.nozzle_diameter
+    && a.is_centered             == b.is_centered
+    && a.num_extruders           == b.num_extruders
+    && a.extruders_offset        == b.extruders_offset
+    && a.auto_hfield_step        == b.auto_hfield_step
+    && a.hfield_step             == b.hfield_step
+    && a.mm_step                 == b.mm_step
+    && a.use_brickmap            == b.use_brickmap
+    && a.brickmap_budget_mb      == b.brickmap_budget_mb
+    && a.start_at_line           == b.start_at_line
+    && a.show_trajectory         == b.show_trajectory
+    && a.auto_deposition_hw      == b.auto_deposition_hw
+    && a.deposition_height       == b.deposition_height
+    && a.deposition_width        == b.deposition_width
+    && a.auto_pause              == b.auto_pause
+    && a.auto_pause_dangling_len == b.auto_pause_dangling_len
+    && a.auto_pause_overlap_len  == b.auto_pause_overlap_len
+    && a.dump_hfield             == b.dump_hfield
+    && a.dump_every_mm           == b.dump_every_mm
+    && a.checkpoint_every_layers == b.checkpoint_every_layers
+    && a.checkpoint_every_sec    == b.checkpoint_every_sec
+    && a.stats_height_thres      == b.stats_height_thres
+    && a.telemetry_record        == b.telemetry_record
+    && a.verbose                 == b.verbose;
 }
 
 // ----------------------------------------------------------------
 
 void session_start()
 {
-  gcode_start(g_GCode_string.c_str());
+  g_Sim->pipeline.stop();
+  gcode_start(g_Sim->gcode_source);
 
   // build path box (traverses the entire gcode ... a bit sad, but ...)
-  g_HeightFieldBox = AAB<3>();
+  g_Sim->hfield_box = AAB<3>();
   while (gcode_advance()) {
 #if 0
     // we ignore first layers due to purge. should be fine? hmmm
-    if (gcode_next_pos()[3] > 0.0f && gcode_next_pos()[2] > g_StatsHeightThres) { 
-      g_HeightFieldBox.addPoint(v3f(gcode_next_pos()));
+    if (gcode_next_pos()[3] > 0.0f && gcode_next_pos()[2] > g_Sim->stats_height_thres) { 
+      g_Sim->hfield_box.addPoint(v3f(gcode_next_pos()));
     }
 #else
-    g_HeightFieldBox.addPoint(v3f(gcode_next_pos()));
+    g_Sim->hfield_box.addPoint(v3f(gcode_next_pos()));
 #endif
   }
-  g_LastLine = gcode_line();
-  std::cout << "gcode has " << g_LastLine << " line(s)" << std::endl;
+  g_Sim->last_line = gcode_line();
+  if (g_Sim->verbose) {
+    std::cout << "gcode has " << g_Sim->last_line << " line(s)" << std::endl;
+  }
+
+  g_Sim->filament_diameter = (float)gcode_filament_dia();
+
+  session_prepare();
+
+  // reset printer
+  //printer_reset();
+}
+
+// ----------------------------------------------------------------
 
+void session_prepare()
+{
   // get the number of extruders used
-  g_NumExtruders = gcode_extruders() > 0 ? gcode_extruders() : 1;
+  g_Sim->num_extruders = gcode_extruders() > 0 ? gcode_extruders() : 1;
   // prepare the extruders offsets
-  g_Extruders_offset.resize(g_NumExtruders);
-  for (auto i = 0; i != g_Extruders_offset.size(); i++) {
-    g_Extruders_offset[i].first = 0.0f;
-    g_Extruders_offset[i].second = 0.0f;
+  g_Sim->extruders_offset.resize(g_Sim->num_extruders);
+  for (auto i = 0; i != g_Sim->extruders_offset.size(); i++) {
+    g_Sim->extruders_offset[i].first = 0.0f;
+    g_Sim->extruders_offset[i].second = 0.0f;
   }
 
-  g_FilamentDiameter = (float)gcode_filament_dia();
-
   // height field
-  int hszx = (int)ceil(g_HeightFieldBox.extent()[0] / c_HeightFieldStep);
-  int hszy = (int)ceil(g_HeightFieldBox.extent()[1] / c_HeightFieldStep);
-  std::cout << "Allocated height field " << printByteSize(hszx * hszy * sizeof(float)) << std::endl;
-  g_HeightField.allocate(hszx, hszy);
+  heightfield_allocate();
+  checkpoints_clear();
+}
+
+// ----------------------------------------------------------------
+
+void heightfield_allocate()
+{
+  // the simulation step follows the nozzle too
+  g_Sim->mm_step = g_Sim->nozzle_diameter * 0.5f;
+  if (g_Sim->auto_hfield_step) {
+    g_Sim->hfield_step = g_Sim->nozzle_diameter * c_HeightFieldStepRatio;
+  }
+  g_Sim->hfield_step = std::clamp(g_Sim->hfield_step, c_HeightFieldStepMin, c_HeightFieldStepMax);
+  int hszx = max(1, (int)ceil(g_Sim->hfield_box.extent()[0] / g_Sim->hfield_step));
+  int hszy = max(1, (int)ceil(g_Sim->hfield_box.extent()[1] / g_Sim->hfield_step));
+  if (g_Sim->verbose) {
+    std::cout << "Allocated height field " << hszx << "x" << hszy
+              << " (" << g_Sim->hfield_step << " mm) "
+              << printByteSize((size_t)hszx * (size_t)hszy * sizeof(float)) << std::endl;
+  }
+  g_Sim->hfield.allocate(hszx, hszy);
+  heightfield_fill(0.0f);
+  checkpoints_clear();
+  // sparse voxels, same cell size
+  if (g_Sim->use_brickmap) {
+    g_Sim->brickmap.allocate(g_Sim->hfield_box, g_Sim->hfield_step, (size_t)g_Sim->brickmap_budget_mb << 20);
+  } else {
+    g_Sim->brickmap.clear();
+  }
+}
+
+// ----------------------------------------------------------------
+
+void heightfield_fill(float z)
+{
+  g_Sim->hfield.fill(z, g_Sim->hfield_epoch);
+}
+
+// ----------------------------------------------------------------
+
+void heightfield_snapshot(const v3d& pos)
+{
+  t_hfield_snapshot_info info;
+  info.line      = g_Sim->current_line;
+  info.deplength = g_Sim->deposition_length;
+  info.z         = pos[2];
+  info.step      = g_Sim->hfield_step;
+  info.zmax      = (float)g_Sim->hfield_box.maxCorner()[2];
+  hfield_export_snapshot(g_Sim->hfield, g_Sim->hfield_epoch, info);
+  // later modifications belong to the next epoch
+  g_Sim->hfield_epoch++;
+  g_Sim->dump_last_len = g_Sim->deposition_length;
+  g_Sim->dump_last_z   = pos[2];
+}
+
+// ----------------------------------------------------------------
+
+std::string simulation_settings()
+{
+  std::string str = sprint("%f %f %f %d %f %f %d %f %f %f %d",
+    g_Sim->filament_diameter, g_Sim->nozzle_diameter, g_Sim->hfield_step,
+    (int)g_Sim->auto_deposition_hw, g_Sim->deposition_height, g_Sim->deposition_width,
+    (int)g_Sim->is_centered, g_Sim->bed_size[0], g_Sim->bed_size[1], g_Sim->mm_step, g_Sim->num_extruders);
+  for (const auto& o : g_Sim->extruders_offset) {
+    str += sprint(" %f %f", o.first, o.second);
+  }
+  return str;
+}
+
+// ----------------------------------------------------------------
+
+void checkpoints_clear()
+{
+  g_Sim->checkpoints.clear();
+  g_Sim->checkpoint_stride = 1;
+}
+
+// ----------------------------------------------------------------
+
+void checkpoint_record()
+{
+  t_gcode_state  gstate;
+  t_motion_state mstate;
+  gcode_save(gstate);
+  motion_save(mstate);
+  checkpoint_record(gstate, mstate);
+}
+
+// ----------------------------------------------------------------
+
+void checkpoint_record(const t_gcode_state& gstate, const t_motion_state& mstate)
+{
+  if (!g_Sim->state_exact || g_Sim->use_brickmap || g_Sim->checkpoint_every_layers <= 0) {
+    return; // the sparse voxels are not shared copy-on-write
+  }
+  if (!g_Sim->checkpoints.empty()) {
+    const t_checkpoint& last = g_Sim->checkpoints.back();
+    if (gstate.line <= last.gcode.line) {
+      return; // replaying, already recorded
+    }
+    if ( g_Sim->num_layers - last.num_layers < g_Sim->checkpoint_every_layers * g_Sim->checkpoint_stride
+      && g_Sim->simulated_time - last.sim_time < g_Sim->checkpoint_every_sec * 1000.0 * g_Sim->checkpoint_stride) {
+      return;
+    }
+  } else if ( g_Sim->num_layers < g_Sim->checkpoint_every_layers
+           && g_Sim->simulated_time < g_Sim->checkpoint_every_sec * 1000.0) {
+    return;
+  }
+  g_Sim->checkpoints.push_back(t_checkpoint());
+  t_checkpoint& cp = g_Sim->checkpoints.back();
+  cp.gcode             = gstate;
+  cp.motion            = mstate;
+  cp.prev_pos          = g_Sim->prev_pos;
+  cp.prev_prev_pos     = g_Sim->prev_prev_pos;
+  cp.prev_was_travel_or_dangling = g_Sim->prev_was_travel_or_dangling;
+  cp.prev_thickness    = g_Sim->prev_thickness;
+  cp.deposition_length = g_Sim->deposition_length;
+  cp.sim_time          = g_Sim->simulated_time;
+  cp.layer_z           = g_Sim->current_layer_z;
+  cp.num_layers        = g_Sim->num_layers;
+  cp.height_segments.resize(g_Sim->height_segments.size());
+  ForIndex(i, (int)g_Sim->height_segments.size()) {
+    cp.height_segments[i] = g_Sim->height_segments[i];
+  }
+  cp.tiles = g_Sim->hfield.tiles();
+  // too many? keep every other one and space the next ones further apart
+  if ((int)g_Sim->checkpoints.size() > c_MaxCheckpoints) {
+    std::vector<t_checkpoint> kept;
+    for (size_t i = 0; i < g_Sim->checkpoints.size(); i += 2) {
+      kept.push_back(std::move(g_Sim->checkpoints[i]));
+    }
+    g_Sim->checkpoints.swap(kept);
+    g_Sim->checkpoint_stride *= 2;
+  }
+}
+
+// ----------------------------------------------------------------
+
+bool checkpoint_restore(int line)
+{
+  // last checkpoint at or before line
+  auto it = std::upper_bound(g_Sim->checkpoints.begin(), g_Sim->checkpoints.end(), line,
+    [](int l, const t_checkpoint& cp) { return l < cp.gcode.line; });
+  if (it == g_Sim->checkpoints.begin()) {
+    return false;
+  }
+  const t_checkpoint& cp = *(--it);
+  gcode_restore(cp.gcode);
+  motion_restore(cp.motion);
+  g_Sim->prev_pos                    = cp.prev_pos;
+  g_Sim->prev_prev_pos               = cp.prev_prev_pos;
+  g_Sim->prev_was_travel_or_dangling = cp.prev_was_travel_or_dangling;
+  g_Sim->prev_thickness              = cp.prev_thickness;
+  g_Sim->deposition_length           = cp.deposition_length;
+  g_Sim->simulated_time              = cp.sim_time;
+  g_Sim->current_layer_z             = cp.layer_z;
+  g_Sim->num_layers                  = cp.num_layers;
+  g_Sim->height_segments.clear();
+  for (const auto& seg : cp.height_segments) {
+    g_Sim->height_segments.push_back(seg);
+  }
+  g_Sim->hfield.restore(cp.tiles, g_Sim->hfield_epoch);
+  return true;
+}
+
+// ----------------------------------------------------------------
 
-  // reset printer
-  //printer_reset();
+size_t checkpoints_byte_size()
+{
+  std::vector<const TiledHeightField::t_tiles*> all;
+  for (const auto& cp : g_Sim->checkpoints) {
+    all.push_back(&cp.tiles);
+  }
+  return TiledHeightField::byteSize(all);
 }
 
 // ----------------------------------------------------------------
@@ -440,53 +1545,145 @@ m4x4f alignAlongSegment(const v3f& p0, const v3f& p1)
 
 // ----------------------------------------------------------------
 
-void rasterizeDiskInHeightField(const v2i& p,float z,float r)
+v3d printer_position(v3d pos, int extruder)
+{
+  // applying extruders offsets to pos
+  if (g_Sim->num_extruders > 1 && extruder < (int)g_Sim->extruders_offset.size()) {
+    pos[0] = pos[0] + g_Sim->extruders_offset[extruder].first;
+    pos[1] = pos[1] + g_Sim->extruders_offset[extruder].second;
+  }
+  // appliying offsets for centered bed (center of the bed is (0,0) )
+  if (g_Sim->is_centered) {
+    pos[0] = pos[0] + g_Sim->bed_size[0]/2;
+    pos[1] = pos[1] + g_Sim->bed_size[1]/2;
+  }
+  return pos;
+}
+
+v2i heightFieldCell(const v3f& a)
+{
+  return v2i(
+    (int)round((a[0] - g_Sim->hfield_box.minCorner()[0]) / g_Sim->hfield_step),
+    (int)round((a[1] - g_Sim->hfield_box.minCorner()[1]) / g_Sim->hfield_step));
+}
+
+void rasterizeDiskInHeightField(TiledHeightField& hfield,const v2i& p,float z,float r,int j_min,int j_max)
 {
-  int N = (int)round(r / c_HeightFieldStep);
+  int N = (int)round(r / g_Sim->hfield_step);
+  const t_disk_table& disk = diskTable(N);
+  hfield.touch(p[0] - N, max(p[1] - N, j_min), p[0] + N, min(p[1] + N, j_max), g_Sim->hfield_epoch);
   ForRange(nj, -N, N) {
-    ForRange(ni, -N, N) {
-      if (ni * ni + nj * nj < N*N) {
-        float& h = g_HeightField.at<Clamp>(p[0] + ni, p[1] + nj)[0];
-        h = max(h, z);
-      }
+    int j = std::clamp(p[1] + nj, 0, hfield.ysize() - 1);
+    if (j < j_min || j > j_max) continue;
+    int w = disk.spans[nj + N];
+    ForRange(ni, -w, w) {
+      float& h = hfield.ref(p[0] + ni, j);
+      h = max(h, z);
     }
   }
 }
 
-void rasterizeInHeightField(v3f a, const v3f&b, float r)
+void rasterizeInHeightField(TiledHeightField& hfield, v3f a, const v3f&b, float r, int j_min, int j_max)
 {
   v3f cur(a);
   v3f step = v3f(b - a);
   float len = length(v2f(step));
   if (len < 1e-6f) {
-    v2i p = v2i(
-      (int)round((a[0] - g_HeightFieldBox.minCorner()[0]) / c_HeightFieldStep), 
-      (int)round((a[1] - g_HeightFieldBox.minCorner()[1]) / c_HeightFieldStep));
-    rasterizeDiskInHeightField(p, max(a[2],b[2]), r);
+    rasterizeDiskInHeightField(hfield, heightFieldCell(a), max(a[2],b[2]), r, j_min, j_max);
     return;
   }
   step = step / len;
   float l = 0.0f;
   while (l < len) {
-    v2i p = v2i(
-      (int)round((cur[0] - g_HeightFieldBox.minCorner()[0]) / c_HeightFieldStep),
-      (int)round((cur[1] - g_HeightFieldBox.minCorner()[1]) / c_HeightFieldStep));
-    rasterizeDiskInHeightField(p, cur[2], r);
-    cur += step * c_HeightFieldStep;
-    l   += c_HeightFieldStep;
+    rasterizeDiskInHeightField(hfield, heightFieldCell(cur), cur[2], r, j_min, j_max);
+    cur += step * g_Sim->hfield_step;
+    l   += g_Sim->hfield_step;
+  }
+}
+
+void rasterizeSegmentsParallel(const std::vector<t_height_segment>& segs)
+{
+#ifdef EMSCRIPTEN
+  int num_threads = 1;
+#else
+  int num_threads = max(1, (int)std::thread::hardware_concurrency());
+#endif
+  int tile_size = TiledHeightField::c_TileSize;
+  int num_bands = g_Sim->hfield.tilesY();
+  // workers help the simulation of the caller
+  t_sim_context *sim = g_Sim;
+  auto job = [&, sim, num_threads, num_bands, tile_size](int t) {
+    sim_bind(sim);
+    TiledHeightField& hfield = sim->hfield;
+    if (sim->use_brickmap) {
+      // the sparse voxels are thread safe, split the segments
+      for (size_t i = t; i < segs.size(); i += num_threads) {
+        const t_height_segment& S = segs[i];
+        sim->brickmap.rasterizeSegment(v3f(S.a), v3f(S.b), (float)S.radius, (float)S.thickness);
+      }
+      return;
+    }
+    // each thread owns bands of tile rows, the result does not depend on the
+    // order segments are rasterized in (max), so it is the same as sequential
+    for (int band = t; band < num_bands; band += num_threads) {
+      int j_min = band * tile_size;
+      int j_max = min(hfield.ysize(), j_min + tile_size) - 1;
+      for (const auto& S : segs) {
+        // skip segments not overlapping the band (rows outside the field are clamped to the border bands)
+        float r  = (float)S.radius + sim->hfield_step;
+        int   j0 = heightFieldCell(v3f(0.0f, (float)min(S.a[1], S.b[1]) - r, 0.0f))[1];
+        int   j1 = heightFieldCell(v3f(0.0f, (float)max(S.a[1], S.b[1]) + r, 0.0f))[1];
+        if (j1 < j_min && band > 0) continue;
+        if (j0 > j_max && band < num_bands - 1) continue;
+        rasterizeInHeightField(hfield, v3f(S.a), v3f(S.b), (float)S.radius, j_min, j_max);
+      }
+    }
+  };
+  if (num_threads == 1 || segs.size() < 1024) {
+    ForIndex(t, num_threads) {
+      job(t);
+    }
+    return;
+  }
+  std::vector<std::thread> threads;
+  ForIndex(t, num_threads) {
+    threads.push_back(std::thread(job, t));
+  }
+  for (auto& th : threads) {
+    th.join();
+  }
+}
+
+void flushHeightSegments(size_t n)
+{
+  // ready segments form a prefix of the queue, rasterize them as a batch
+  const t_height_segment *spans[2];
+  size_t                  sizes[2];
+  g_Sim->height_segments.spans(n, spans[0], sizes[0], spans[1], sizes[1]);
+  ForIndex(s, 2) {
+    ForIndex(i, (int)sizes[s]) {
+      const t_height_segment& S = spans[s][i];
+      if (g_Sim->use_brickmap) {
+        g_Sim->brickmap.rasterizeSegment(v3f(S.a), v3f(S.b), (float)S.radius, (float)S.thickness);
+      } else {
+        rasterizeInHeightField(g_Sim->hfield, v3f(S.a), v3f(S.b), (float)S.radius /*- raster_erode*/); // uncomment to visualize raster erode
+      }
+    }
   }
+  g_Sim->height_segments.pop_front(n);
 }
 
 float heightAt(v3f a, float r)
 {
+  if (g_Sim->use_brickmap) {
+    return g_Sim->brickmap.heightAt(a, r);
+  }
   float h = 0.0f;
-  int   N = max(1,round(r / c_HeightFieldStep));
-  v2i   p = v2i(
-    (int)round((a[0] - g_HeightFieldBox.minCorner()[0]) / c_HeightFieldStep),
-    (int)round((a[1] - g_HeightFieldBox.minCorner()[1]) / c_HeightFieldStep));
+  int   N = max(1, (int)round(r / g_Sim->hfield_step));
+  v2i   p = heightFieldCell(a);
   ForRange(nj, -N, N) {
     ForRange(ni, -N, N) {
-        float v = g_HeightField.at<Clamp>(p[0] + ni, p[1] + nj)[0];
+        float v = g_Sim->hfield.at(p[0] + ni, p[1] + nj);
         if (v < a[2] - c_ThicknessEpsilon) { // ignore values at same height, these are due to aliasing
           h = max(h, v);
         }
@@ -497,277 +1694,521 @@ float heightAt(v3f a, float r)
 
 float danglingAt(float max_th,const v3f &a, float r)
 {
+  if (g_Sim->use_brickmap) {
+    return g_Sim->brickmap.danglingAt(max_th, a, r);
+  }
   float d = 0.0f;
-  int   N = max(1, round(r / c_HeightFieldStep));
-  int num = 0;
-  v2i p = v2i(
-    (int)round((a[0] - g_HeightFieldBox.minCorner()[0]) / c_HeightFieldStep),
-    (int)round((a[1] - g_HeightFieldBox.minCorner()[1]) / c_HeightFieldStep));
+  int   N = max(1, (int)round(r / g_Sim->hfield_step));
+  v2i   p = heightFieldCell(a);
+  const t_disk_table& disk = diskTable(N);
   ForRange(nj, -N, N) {
-    ForRange(ni, -N, N) {
-      if (ni * ni + nj * nj < N * N) {
-        float v = g_HeightField.at<Clamp>(p[0] + ni, p[1] + nj)[0];
-        if (v + max_th + 0.05f < a[2]) {
-          d += 1.0f;
-        }
-        num++;
+    int w = disk.spans[nj + N];
+    ForRange(ni, -w, w) {
+      float v = g_Sim->hfield.at(p[0] + ni, p[1] + nj);
+      if (v + max_th + 0.05f < a[2]) {
+        d += 1.0f;
       }
     }
   }
-  return d / (float)(num);
+  return d / (float)(disk.num);
 }
 
 float overlapAt(float th, const v3f &a, float r)
 {
+  if (g_Sim->use_brickmap) {
+    return g_Sim->brickmap.overlapAt(th, a, r);
+  }
   float o = 0.0f;
-  int   N = max(1, round(r / c_HeightFieldStep));
-  int num = 0;
-  v2i   p = v2i(
-    (int)round((a[0] - g_HeightFieldBox.minCorner()[0]) / c_HeightFieldStep),
-    (int)round((a[1] - g_HeightFieldBox.minCorner()[1]) / c_HeightFieldStep));
+  int   N = max(1, (int)round(r / g_Sim->hfield_step));
+  v2i   p = heightFieldCell(a);
+  const t_disk_table& disk = diskTable(N);
   ForRange(nj, -N, N) {
-    ForRange(ni, -N, N) {
-      if (ni * ni + nj * nj < N * N) {
-        float v = g_HeightField.at<Clamp>(p[0] + ni, p[1] + nj)[0];
-        if (v + 0.01f > a[2]) {
-          o += 1.0f;
-        }
-        num++;
+    int w = disk.spans[nj + N];
+    ForRange(ni, -w, w) {
+      float v = g_Sim->hfield.at(p[0] + ni, p[1] + nj);
+      if (v + 0.01f > a[2]) {
+        o += 1.0f;
       }
     }
   }
-  return o / (float)(num);
+  return o / (float)(disk.num);
 }
 
 // ----------------------------------------------------------------
 
-bool step_simulation(bool gpu_draw)
+bool deposit_sample(const t_motion_sample& s, bool gpu_draw)
 {
-  float raster_erode = c_HeightFieldStep * sqrt(2.0f);
+  float raster_erode = g_Sim->hfield_step * sqrt(2.0f);
 
-  double step_ms = g_MmStep / (gcode_speed() / 1000.0);
-  while (step_ms > 0.0f) {
-    // step motion
-    bool  done;
-    double delta_ms = motion_step(step_ms, done);
-    // accumulate step time
-    step_ms -= delta_ms;
+  g_Sim->current_line = s.line;
+  g_Sim->current_pos  = v3d(s.pos);
 
-    if (done) {
-      return true;
-    }
+  // accumulate step time
+  g_Sim->simulated_time += s.delta_ms;
+  g_Sim->layer_stats.addTime(s.delta_ms);
+  if (g_Sim->telemetry_record) {
+    telemetry_step(s.delta_ms, s.flow * 1000.0, s.speed);
+  }
+
+  if (s.done) {
+    return true;
+  }
 
-    if (gcode_error()) {
+  if (s.error) {
 #ifdef EMSCRIPTEN
-      std::string command = "errorLine(" + to_string(gcode_line()) + ");";
-      emscripten_run_script(command.c_str());
+    std::string command = "errorLine(" + to_string(s.line) + ");";
+    emscripten_run_script(command.c_str());
 #endif
-      return true;
-    }
+    return true;
+  }
 
-    // line highlighting
+  // line highlighting
 #ifdef EMSCRIPTEN
-    static int last_line = -1;
-    if (gcode_line() != last_line) {
-      std::string command = "highlightLine(" + to_string(gcode_line()) + ");";
-      emscripten_run_script(command.c_str());
-      last_line = gcode_line();
-    }
+  static int last_line = -1;
+  if (s.line != last_line) {
+    std::string command = "highlightLine(" + to_string(s.line) + ");";
+    emscripten_run_script(command.c_str());
+    last_line = s.line;
+  }
 #endif
-    // current position
-    v3d pos   = v3d(motion_get_current_pos());
-    // applying extruders offsets to pos
-    if (g_NumExtruders > 1) {
-      pos[0] = pos[0] + g_Extruders_offset[gcode_current_extruder()].first;
-      pos[1] = pos[1] + g_Extruders_offset[gcode_current_extruder()].second;
-    }
-    // appliying offsets for centered bed (center of the bed is (0,0) )
-    if (g_isCentered) {
-      pos[0] = pos[0] + g_BedSize[0]/2;
-      pos[1] = pos[1] + g_BedSize[1]/2;
-    }
-
-    // pushed material volume during time interval
-    float h   = heightAt(v3f(pos), g_NozzleDiameter / 2.0f);
-
-    static double th_prev = 0.0;
-    double th = pos[2] - h;
-    if (th < c_ThicknessEpsilon) {
-      // cerr << 'e';
-      th = th_prev;
-    } else {
-      th_prev = th;
-    }
+  // current position
+  v3d pos   = printer_position(v3d(s.pos), s.extruder);
 
-    if (g_ShowTrajectory) {
-      g_Trajectory.push_back(pos);
-    }
-
-    double len     = length(pos - g_PrevPos);
-    float dangling = 0.0f;
-    float overlap  = 0.0f;
+  // pushed material volume during time interval
+  float h   = heightAt(v3f(pos), g_Sim->nozzle_diameter / 2.0f);
 
-    TrajPoint tj   = TrajPoint(pos, (float)th, (float)0.0f, dangling, overlap);
+  double th = pos[2] - h;
+  if (th < c_ThicknessEpsilon) {
+    // cerr << 'e';
+    th = g_Sim->prev_thickness;
+  } else {
+    g_Sim->prev_thickness = th;
+  }
 
-    if (len > 1e-6 && !motion_is_travel()) {
-      // print move
-      double cs = M_PI * g_FilamentDiameter * g_FilamentDiameter / 4.0f; // mm^2
-      double sa = motion_get_current_e_per_xyz() * cs;   // vf / len;
-      double r  = sqrt(sa / M_PI); // sa = pi*r^2
-      double squash_t = min(th / 2.0, r);
-      double rs = disk_squashed_radius(r, squash_t);
-      double max_th = sa / g_NozzleDiameter;
+  if (g_Sim->show_trajectory) {
+    g_Sim->trajectory.push_back(pos);
+  }
 
-      if (!g_AutoDepositionHW) { // fixed th and radius
-        th       = g_DepositionHeight;
-        squash_t = th;
-        rs       = g_DepositionWidth;
-      }
+  double len     = length(pos - g_Sim->prev_pos);
+  float dangling = 0.0f;
+  float overlap  = 0.0f;
+
+  TrajPoint tj   = TrajPoint(pos, (float)th, (float)0.0f, dangling, overlap);
+
+  if (len > 1e-6 && !s.travel) {
+    // print move
+    double cs = M_PI * g_Sim->filament_diameter * g_Sim->filament_diameter / 4.0f; // mm^2
+    double sa = s.e_per_xyz * cs;   // vf / len;
+    double r  = sqrt(sa / M_PI); // sa = pi*r^2
+    double squash_t = min(th / 2.0, r);
+    double rs = disk_squashed_radius(r, squash_t);
+    double max_th = sa / g_Sim->nozzle_diameter;
+
+    if (!g_Sim->auto_deposition_hw) { // fixed th and radius
+      th       = g_Sim->deposition_height;
+      squash_t = th;
+      rs       = g_Sim->deposition_width;
+    }
 
 #if 0
-      if (rs > 0.3f) {
-        std::cerr << sprint("z %.6f th %.6f th_prev %.6f rs %.6f \n", (float)pos[2], (float)th, (float)th_prev, (float)rs);
-        sl_assert(false);
-      }
+    if (rs > 0.3f) {
+      std::cerr << sprint("z %.6f th %.6f th_prev %.6f rs %.6f \n", (float)pos[2], (float)th, (float)g_Sim->prev_thickness, (float)rs);
+      sl_assert(false);
+    }
 #endif
-      tj = TrajPoint(pos, (float)th, (float)r, dangling, overlap);
+    tj = TrajPoint(pos, (float)th, (float)r, dangling, overlap);
 
-      // stats
-      if (pos[2] > g_StatsHeightThres) {
-        dangling = danglingAt((float)max_th, v3f(pos), (float)rs);
-        overlap  = overlapAt((float)th, v3f(pos), (float)rs - raster_erode);
+    // stats
+    if (pos[2] > g_Sim->stats_height_thres) {
+      dangling = danglingAt((float)max_th, v3f(pos), (float)rs);
+      overlap  = overlapAt((float)th, v3f(pos), (float)rs - raster_erode);
+
+      // dangling only if > 60%
+      dangling = max(dangling - 0.6f, 0.0f) / 0.4f;
+      // overlap only if > 40%
+      overlap = max(overlap - 0.4f, 0.0f) / 0.6f;
+    }
 
-        // dangling only if > 60%
-        dangling = max(dangling - 0.6f, 0.0f) / 0.4f;
-        // overlap only if > 40%
-        overlap = max(overlap - 0.4f, 0.0f) / 0.6f;
-      }
+    // add segment to global length
+    g_Sim->deposition_length += len;
 
-      // add segment to global length
-      g_GlobalDepositionLength += len;
+    // new layer?
+    if (pos[2] > g_Sim->current_layer_z + c_ThicknessEpsilon) {
+      g_Sim->current_layer_z = pos[2];
+      g_Sim->num_layers++;
+      g_Sim->layer_stats.newLayer(pos[2]);
+      g_Sim->heatmap.newLayer(pos[2]);
+    }
 
-      // add pos to dangling section if potentially bridging
-      if (g_InDangling) {
-        g_DanglingTrajectory.push_back(tj);
-      }
+    if (g_Sim->heatmap.isOpen()) {
+      g_Sim->heatmap.add(pos, len, dangling, overlap);
+    }
+    if (g_Sim->layer_stats.isOpen()) {
+      g_Sim->layer_stats.addDeposition(len, s.flow, s.extruder);
+      if (dangling > 0.0f) g_Sim->layer_stats.addDangling(len);
+      if (overlap > 0.0f)  g_Sim->layer_stats.addOverlap(len);
+    }
+    g_Sim->feature_stats.addDeposition(s.extruder, s.role, len, s.delta_ms, s.flow * 1000.0);
+    if (dangling > 0.0f) g_Sim->feature_stats.at(s.extruder, s.role).dangling += len;
+    if (overlap > 0.0f)  g_Sim->feature_stats.at(s.extruder, s.role).overlap  += len;
 
-      if (gpu_draw) {
-        g_Bead.addPoint(v3f(pos), (float)th, (float)r, dangling, overlap, gcode_current_extruder());
-      }
+    // add pos to dangling section if potentially bridging
+    if (g_Sim->in_dangling) {
+      g_Sim->dangling_trajectory.push_back(tj);
+    }
 
-      // update height field
-      t_height_segment seg;
-      seg.a = pos;
-      seg.b = g_PrevPos;
-      seg.deplength = g_GlobalDepositionLength;
-      seg.radius = rs;
-      g_HeightSegments.push_back(seg);
-    
-    } else {
-      if (gpu_draw) {
-        g_Bead.closeAny();
-      }
+    if (gpu_draw) {
+      g_Bead.setSource(s.line, g_Sim->num_layers);
+      g_Bead.addPoint(v3f(pos), (float)th, (float)r, dangling, overlap, s.extruder);
     }
 
-    bool is_travel_or_dangling = motion_is_travel() || (dangling > 0.0);
+    // update height field
+    t_height_segment seg;
+    seg.a = pos;
+    seg.b = g_Sim->prev_pos;
+    seg.deplength = g_Sim->deposition_length;
+    seg.radius = rs;
+    seg.thickness = th;
+    g_Sim->height_segments.push_back(seg);
+  
+  } else {
+    if (gpu_draw) {
+      g_Bead.closeAny();
+    }
+  }
 
-    // stats
-    if (g_InDangling && dangling == 0.0f) {
-      // exit dangling
-      g_InDangling = false;
-      double dangling_len = (g_GlobalDepositionLength - g_InDanglingStart);
-      if (g_AutoPause && dangling_len >= g_AutoPauseDanglingLen) {
-        g_Paused = true;
-      }
-      dangling_len = round(dangling_len / 0.1); // quantize
-      g_DanglingHisto[(int)dangling_len] += 1.0f;
-      // bridge?
-      bool is_bridge = false;
-      if (!motion_is_travel() && g_InDanglingBridging  // attached on both ends
-        && g_DanglingTrajectory.size() >= 2) {
-        is_bridge = true;
-        // verify deviation
-        v2d delta = normalize_safe(v2d(g_DanglingTrajectory.back().pos - g_DanglingTrajectory.front().pos));
-        v2d nrm   = v2d(-delta[1], delta[0]);
-        for (auto p : g_DanglingTrajectory) {
-          float dev = dot(normalize_safe(v2d(p.pos - g_DanglingTrajectory.front().pos)), nrm);
-          if (abs(dev) > g_NozzleDiameter / 10.0f) {
-            is_bridge = false; break;
-          }
+  bool is_travel_or_dangling = s.travel || (dangling > 0.0);
+
+  // stats
+  if (g_Sim->in_dangling && dangling == 0.0f) {
+    // exit dangling
+    g_Sim->in_dangling = false;
+    double dangling_len = (g_Sim->deposition_length - g_Sim->in_dangling_start);
+    if (g_Sim->auto_pause && dangling_len >= g_Sim->auto_pause_dangling_len) {
+      g_Sim->paused = true;
+    }
+    g_Sim->dangling_histo.add(dangling_len);
+    g_Sim->feature_stats.at(s.extruder, s.role).dangling_spans++;
+    // bridge?
+    bool is_bridge = false;
+    if (!s.travel && g_Sim->in_dangling_bridging  // attached on both ends
+      && g_Sim->dangling_trajectory.size() >= 2) {
+      is_bridge = true;
+      // verify deviation
+      v2d delta = normalize_safe(v2d(g_Sim->dangling_trajectory.back().pos - g_Sim->dangling_trajectory.front().pos));
+      v2d nrm   = v2d(-delta[1], delta[0]);
+      for (auto p : g_Sim->dangling_trajectory) {
+        float dev = dot(normalize_safe(v2d(p.pos - g_Sim->dangling_trajectory.front().pos)), nrm);
+        if (abs(dev) > g_Sim->nozzle_diameter / 10.0f) {
+          is_bridge = false; break;
         }
-        if (is_bridge) {
-          //g_Paused = true;
-          //g_Trajectory.clear();
-          //for (auto p : g_DanglingTrajectory) {
-          //  g_Trajectory.push_back(p.pos);
-          //}
-          if (gpu_draw) {
-            // redraw orange
-            g_Bead.closeAny();
-            g_Bead.setIsBridge(true);
-            for (auto p : g_DanglingTrajectory) {
-              g_Bead.addPoint(v3f(p.pos), (float)p.th, (float)p.r, 0.0f, 0.0f, gcode_current_extruder());
-            }
-            g_Bead.closeAny();
-            g_Bead.setIsBridge(false);
+      }
+      if (is_bridge) {
+        g_Sim->layer_stats.addBridge();
+        g_Sim->feature_stats.at(s.extruder, s.role).bridges++;
+        //g_Sim->paused = true;
+        //g_Sim->trajectory.clear();
+        //for (auto p : g_Sim->dangling_trajectory) {
+        //  g_Sim->trajectory.push_back(p.pos);
+        //}
+        if (gpu_draw) {
+          // redraw orange
+          g_Bead.closeAny();
+          g_Bead.setIsBridge(true);
+          for (auto p : g_Sim->dangling_trajectory) {
+            g_Bead.addPoint(v3f(p.pos), (float)p.th, (float)p.r, 0.0f, 0.0f, s.extruder);
           }
+          g_Bead.closeAny();
+          g_Bead.setIsBridge(false);
         }
       }
-      g_DanglingTrajectory.clear();
-    }
-    if (g_InOverlap && overlap == 0.0f) {
-      // exit overlap
-      g_InOverlap = false;
-      double overlap_len = (g_GlobalDepositionLength - g_InOverlapStart);
-      if (g_AutoPause && overlap_len >= g_AutoPauseOverlapLen) {
-        g_Paused = true;
-      }
-      overlap_len = round(overlap_len / 0.1); // quantize
-      g_OverlapHisto[(int)overlap_len] += 1.0f;
     }
-    if (!g_InDangling && dangling > 0.0) {
-      // enter dangling
-      g_DanglingTrajectory.clear();
-      // PB FIXME: this assert should be needed , but is disabled to comply with etruders offsets
-      //sl_assert(tj.r > 0.0f);
-      g_DanglingTrajectory.push_back(tj);
-      g_InDangling          = true;
-      g_InDanglingStart     = g_GlobalDepositionLength;
-      g_InDanglingBridging  = !g_PrevWasTravelOrDangling;
-    }
-    if (!g_InOverlap && overlap > 0.0) {
-      // enter overlap
-      g_InOverlap      = true;
-      g_InOverlapStart = g_GlobalDepositionLength;
+    g_Sim->dangling_trajectory.clear();
+  }
+  if (g_Sim->in_overlap && overlap == 0.0f) {
+    // exit overlap
+    g_Sim->in_overlap = false;
+    double overlap_len = (g_Sim->deposition_length - g_Sim->in_overlap_start);
+    if (g_Sim->auto_pause && overlap_len >= g_Sim->auto_pause_overlap_len) {
+      g_Sim->paused = true;
     }
+    g_Sim->overlap_histo.add(overlap_len);
+    g_Sim->feature_stats.at(s.extruder, s.role).overlap_spans++;
+  }
+  if (!g_Sim->in_dangling && dangling > 0.0) {
+    // enter dangling
+    g_Sim->dangling_trajectory.clear();
+    // PB FIXME: this assert should be needed , but is disabled to comply with etruders offsets
+    //sl_assert(tj.r > 0.0f);
+    g_Sim->dangling_trajectory.push_back(tj);
+    g_Sim->in_dangling          = true;
+    g_Sim->in_dangling_start    = g_Sim->deposition_length;
+    g_Sim->in_dangling_bridging = !g_Sim->prev_was_travel_or_dangling;
+  }
+  if (!g_Sim->in_overlap && overlap > 0.0) {
+    // enter overlap
+    g_Sim->in_overlap       = true;
+    g_Sim->in_overlap_start = g_Sim->deposition_length;
+  }
 
 #if 1
-    // height segments (with delay)
-    auto S = g_HeightSegments.begin();
-    while (S != g_HeightSegments.end()) {
-      if ( S->deplength + max((double)g_NozzleDiameter,g_MmStep) * 4.0 < g_GlobalDepositionLength
-        || max(S->a[2],S->b[2]) < pos[2]
-        ) {
-        rasterizeInHeightField(v3f(S->a), v3f(S->b), (float)S->radius /*- raster_erode*/); // uncomment to visualize raster erode
-        S = g_HeightSegments.erase(S);
-      } else {
-        // S++;
-        break; // monotonous so no need to continue
-      }
+  // height segments (with delay)
+  size_t num_ready = 0;
+  while (num_ready < g_Sim->height_segments.size()) {
+    const t_height_segment& S = g_Sim->height_segments[num_ready];
+    if ( S.deplength + max((double)g_Sim->nozzle_diameter,g_Sim->mm_step) * 4.0 < g_Sim->deposition_length
+      || max(S.a[2],S.b[2]) < pos[2]
+      ) {
+      num_ready++;
+    } else {
+      break; // monotonous so no need to continue
     }
+  }
+  flushHeightSegments(num_ready);
 #endif
 
-    // prepare next
-    g_PrevWasTravelOrDangling = is_travel_or_dangling;
-    g_PrevPrevPos = g_PrevPos;
-    g_PrevPos = pos;
+  // height field export, once per layer or every N mm
+  if (g_Sim->dump_hfield && g_Sim->deposition_length > g_Sim->dump_last_len) {
+    bool capture = g_Sim->dump_every_mm > 0.0f
+      ? g_Sim->deposition_length - g_Sim->dump_last_len >= g_Sim->dump_every_mm
+      : pos[2] > g_Sim->dump_last_z + c_ThicknessEpsilon;
+    if (capture) {
+      heightfield_snapshot(pos);
+    }
+  }
+
+  // prepare next
+  g_Sim->prev_was_travel_or_dangling = is_travel_or_dangling;
+  g_Sim->prev_prev_pos = g_Sim->prev_pos;
+  g_Sim->prev_pos = pos;
 
-  } // iter
   return false;
 }
 
 // ----------------------------------------------------------------
 
+bool step_simulation(bool gpu_draw)
+{
+  bool done = motion_simulation_step(g_Sim->mm_step, [gpu_draw](const t_motion_sample& s, bool) {
+    return deposit_sample(s, gpu_draw);
+  });
+  if (done) {
+    return true;
+  }
+  // steps are complete, a replay from here is identical
+  checkpoint_record();
+  return false;
+}
+
+// ----------------------------------------------------------------
+
+bool step_simulation_pipelined(bool gpu_draw)
+{
+  if (!g_Sim->pipeline.running()) {
+    g_Sim->pipeline.start(g_Sim->gcode_source, g_Sim->filament_diameter, g_Sim->mm_step);
+  }
+  t_pipeline_sample s;
+  while (g_Sim->pipeline.pop(s)) {
+    if (deposit_sample(s.motion, gpu_draw)) {
+      return true;
+    }
+    if (s.end_of_step) {
+      checkpoint_record(s.gcode_state, s.motion_state);
+      return false;
+    }
+  }
+  // no sample: finished only if the last one was popped, not if stopped
+  return g_Sim->pipeline.ended();
+}
+
+// ----------------------------------------------------------------
+
+void step_simulation_frame()
+{
+  typedef std::chrono::steady_clock t_clock;
+  static double step_cost_ms = 0.0; // running average of the cost of a step
+  static t_time tm_window    = milliseconds();
+  static int    window_steps = 0;
+
+  int n = g_MaxSpeed ? INT_MAX : max(1, (int)round(g_UserMmStep / g_Sim->mm_step));
+  int num_steps = 0;
+  double spent_ms = 0.0;
+  t_clock::time_point tm_start = t_clock::now();
+  while (num_steps < n && !g_Sim->paused) {
+    bool done = step_simulation(true);
+    if (done) {
+      break; // done
+    }
+    num_steps++;
+    spent_ms = std::chrono::duration<double, std::milli>(t_clock::now() - tm_start).count();
+    // stop if the next step is not expected to fit in the budget
+    if (spent_ms + step_cost_ms > g_FrameBudgetMs) {
+      break;
+    }
+  }
+  if (num_steps > 0) {
+    step_cost_ms = step_cost_ms * 0.75 + (spent_ms / num_steps) * 0.25;
+  }
+
+  // throughput, over about a second
+  window_steps += num_steps;
+  t_time tm_now = milliseconds();
+  if (tm_now - tm_window >= 1000) {
+    g_StepsPerSecond = window_steps * 1000.0 / (double)(tm_now - tm_window);
+    window_steps = 0;
+    tm_window    = tm_now;
+  }
+}
+
+// ----------------------------------------------------------------
+
+void sim_publish()
+{
+  // the render thread fades the trajectory out, the last positions are enough
+  if (g_Sim->trajectory.size() > c_TrajectoryLength) {
+    g_Sim->trajectory.erase(g_Sim->trajectory.begin(), g_Sim->trajectory.end() - c_TrajectoryLength);
+  }
+  t_sim_snapshot s;
+  s.current_line      = g_Sim->current_line;
+  s.current_pos       = g_Sim->current_pos;
+  s.num_layers        = g_Sim->num_layers;
+  s.paused            = g_Sim->paused;
+  s.finished          = g_Sim->finished;
+  s.num_checkpoints   = (int)g_Sim->checkpoints.size();
+  s.checkpoints_bytes = checkpoints_byte_size();
+  s.voxels_bytes      = g_Sim->use_brickmap ? g_Sim->brickmap.byteSize() : 0;
+  s.voxels_saturated  = g_Sim->use_brickmap && g_Sim->brickmap.saturated();
+  s.dangling_histo    = g_Sim->dangling_histo;
+  s.overlap_histo     = g_Sim->overlap_histo;
+  s.feature_stats     = g_Sim->feature_stats;
+  s.trajectory        = g_Sim->trajectory;
+  s.steps_per_second  = g_StepsPerSecond;
+  std::lock_guard<std::mutex> lock(g_SnapshotMutex);
+  std::swap(g_Snapshot, s);
+  g_SnapshotVersion++;
+}
+
+// ----------------------------------------------------------------
+
+bool sim_snapshot_read(t_sim_snapshot& _snapshot, int& _version)
+{
+  std::lock_guard<std::mutex> lock(g_SnapshotMutex);
+  if (_version == g_SnapshotVersion) {
+    return false;
+  }
+  _snapshot = g_Snapshot;
+  _version  = g_SnapshotVersion;
+  return true;
+}
+
+// ----------------------------------------------------------------
+
+#ifndef EMSCRIPTEN
+
+static void sim_thread_main(t_sim_context *sim)
+{
+  sim_bind(sim);
+  t_time tm_publish   = milliseconds();
+  t_time tm_window    = tm_publish;
+  int    window_steps = 0;
+  int    frame        = g_SimFrame.load();
+  int    frame_steps  = 0;
+  while (!g_SimStop.load()) {
+    // no more steps per frame than granted (the chosen speed)
+    if (frame != g_SimFrame.load()) {
+      frame       = g_SimFrame.load();
+      frame_steps = 0;
+    }
+    if (frame_steps >= g_SimStepsPerFrame.load()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    if (step_simulation_pipelined(true)) {
+      g_Sim->finished = true;
+      break;
+    }
+    frame_steps++;
+    window_steps++;
+    if (g_Sim->paused) {
+      break; // auto pause
+    }
+    // throughput, over about a second
+    t_time tm_now = milliseconds();
+    if (tm_now - tm_window >= 1000) {
+      g_StepsPerSecond = window_steps * 1000.0 / (double)(tm_now - tm_window);
+      window_steps = 0;
+      tm_window    = tm_now;
+    }
+    if (tm_now - tm_publish >= c_SnapshotEveryMs) {
+      sim_publish();
+      tm_publish = tm_now;
+    }
+  }
+  sim_publish();
+  g_SimExited = true;
+}
+
+#endif
+
+// ----------------------------------------------------------------
+
+void sim_thread_update()
+{
+#ifdef EMSCRIPTEN
+  bool running = !g_Sim->paused;
+  if (running) {
+    step_simulation_frame();
+    sim_publish();
+  }
+#else
+  g_SimStepsPerFrame = g_MaxSpeed ? INT_MAX : max(1, (int)round(g_UserMmStep / g_Sim->mm_step));
+  g_SimFrame++;
+  if (g_SimThread.joinable() && g_SimExited.load()) {
+    sim_thread_stop(); // paused or finished
+  }
+  if (!g_SimThread.joinable() && !g_Sim->paused && !g_Sim->finished) {
+    if (!g_BeadQueue) {
+      g_BeadQueue = std::unique_ptr<SpscQueue<BeadStore::t_segment> >(new SpscQueue<BeadStore::t_segment>(c_BeadQueueSize));
+    }
+    g_SimStop   = false;
+    g_SimExited = false;
+    g_Bead.setQueue(g_BeadQueue.get());
+    g_SimThread = std::thread(sim_thread_main, g_Sim);
+  }
+  g_Bead.drain();
+  bool running = g_SimThread.joinable();
+#endif
+  // changed while the simulation was stopped, a running one publishes by itself
+  if (g_SimRepublish && !running) {
+    sim_publish();
+  }
+  g_SimRepublish = false;
+}
+
+// ----------------------------------------------------------------
+
+void sim_thread_stop()
+{
+  g_SimRepublish = true;
+#ifndef EMSCRIPTEN
+  if (!g_SimThread.joinable()) {
+    return;
+  }
+  g_SimStop = true;
+  // the thread may be waiting for room in the bead queue
+  while (!g_SimExited.load()) {
+    if (g_Bead.drain() == 0) {
+      std::this_thread::yield();
+    }
+  }
+  g_SimThread.join();
+  g_Bead.drain();
+  g_Bead.setQueue(NULL);
+#endif
+}
+
+// ----------------------------------------------------------------
+
 #ifdef EMSCRIPTEN
 
 bool fileChanged(std::string file, time_t& _last)
@@ -792,10 +2233,8 @@ void mainWindowReshape(uint w, uint h) {
   g_ScreenHeight = h;
   g_RenderWidth = w - g_UIWidth;
   g_RenderHeight = h;
+  // the render targets follow on next frame (mainRender), the retained beads are drawn again
 
-  printer_reset();
-  g_ForceRedraw = true;
-  
   /*
   std::cerr << Console::green << w << " x " << h << " size on listener" << Console::gray << std::endl;
   std::cerr << Console::blue << g_ScreenWidth << " x " << g_ScreenHeight << " screen size" << Console::gray << std::endl;
@@ -804,6 +2243,83 @@ void mainWindowReshape(uint w, uint h) {
   */
 }
 
+m4x4f trackball_view(const AAB<3>& bx)
+{
+  float ex = tupleMax(bx.extent());
+  TrackballUI::trackball().setRadius(ex / (g_Zoom*g_Zoom));
+  return translationMatrix(v3f(0, 0, g_Zoom))
+    * TrackballUI::matrix()
+    * translationMatrix(-bx.center());
+}
+
+// ----------------------------------------------------------------
+
+AutoBindShader::deposition& deposition_begin(const m4x4f& proj, const m4x4f& view, float fov, int render_h, const int clip[4])
+{
+  AutoBindShader::deposition& shader_deposition = g_BeadImpostors ? g_ShaderDepositionImpostor : g_ShaderDeposition;
+  g_Bead.setImpostors(g_BeadImpostors);
+  shader_deposition.begin();
+  shader_deposition.u_projection.set(proj);
+  shader_deposition.u_view.set(view);
+  shader_deposition.u_ZNear.set(ZNear);
+  shader_deposition.u_ZFar.set(ZFar);
+  shader_deposition.u_clip_layer_min.set(clip[0]);
+  shader_deposition.u_clip_layer_max.set(clip[1]);
+  shader_deposition.u_clip_line_min.set(clip[2]);
+  shader_deposition.u_clip_line_max.set(clip[3]);
+  g_Bead.setClip(clip[0], clip[1], clip[2], clip[3]);
+  g_Bead.setView(proj * view, (float)render_h / (2.0f * tan(fov / 2.0f)));
+  return shader_deposition;
+}
+
+// ----------------------------------------------------------------
+
+void gbuffer_shade(int x, int w, int h, GLTarget *target)
+{
+  // ambient occlusion, horizontal pass (the vertical one is in the final pass)
+  const int ao_steps[] = { 0, 3, 2, 1 };
+  int ao_step = ao_steps[std::clamp(g_AOQuality, 0, 3)];
+  if (ao_step > 0) {
+    g_DepthBlur->bind();
+    glViewport(0, 0, w, h);
+    g_ShaderDepthBlur.begin();
+    g_ShaderDepthBlur.u_projview.set(orthoMatrixGL(0.0f, 1.0f, 0.0f, 1.0f, -1.0f, 1.0f));
+    g_ShaderDepthBlur.u_depth.set(0);
+    g_ShaderDepthBlur.u_pixsz.set(v3f(1.0f / (float)w, 1.0f / (float)h, 0.0f));
+    g_ShaderDepthBlur.u_step.set(ao_step);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, g_GBuffer->texture(0));
+    g_GPUMesh_quad->render();
+    g_ShaderDepthBlur.end();
+    if (target != nullptr) {
+      target->bind();
+    } else {
+      g_DepthBlur->unbind();
+    }
+    glViewport(x, 0, w, h);
+  }
+
+  // final pass
+  g_ShaderFinal.begin();
+  g_ShaderFinal.u_projview.set(orthoMatrixGL(0.0f, 1.0f, 0.0f, 1.0f, -1.0f, 1.0f));
+  g_ShaderFinal.u_depth.set(0);
+  g_ShaderFinal.u_attr.set(2);
+  g_ShaderFinal.u_pixsz.set(v3f(1.0f / (float)w, 1.0f / (float)h, 0.0f));
+  g_ShaderFinal.u_color_overhangs.set(g_ColorOverhangs ? 1 : 0);
+  g_ShaderFinal.u_depthavg.set(1);
+  g_ShaderFinal.u_ao_step.set(ao_step);
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D, g_GBuffer->texture(1));
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, g_DepthBlur->texture(0));
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, g_GBuffer->texture(0));
+  g_GPUMesh_quad->render();
+  g_ShaderFinal.end();
+}
+
+// ----------------------------------------------------------------
+
 void mainRender()
 {
   static t_time tm_lastChange = milliseconds();
@@ -814,9 +2330,9 @@ void mainRender()
 
 #ifdef EMSCRIPTEN
   if (fileChanged("/icesl.gcode", g_FileStamp)) {
-    g_GCode_string = loadFileIntoString("/icesl.gcode");
+    gcode_load(g_Sim->gcode_source, loadFileIntoString("/icesl.gcode"));
     session_start();
-    motion_start(g_FilamentDiameter);
+    motion_start(g_Sim->filament_diameter);
     g_ForceRedraw = true;
   }
 #endif
@@ -827,16 +2343,13 @@ void mainRender()
     bx.addPoint(-v3f(100.0));
     bx.addPoint( v3f(100.0));
     float ex = tupleMax(bx.extent());
-    m4x4f proj = perspectiveMatrixGL<float>((float)M_PI / 6.0f, 1.0f, ZNear, ZFar);
+    const float fov = (float)M_PI / 6.0f;
+    m4x4f proj = perspectiveMatrixGL<float>(fov, 1.0f, ZNear, ZFar);
 
     g_Zoom = g_Zoom + 0.1f * (g_ZoomTarget - g_Zoom);
-    TrackballUI::trackball().setRadius(ex / (g_Zoom*g_Zoom));
 
     // view matrix
-    m4x4f view =
-        translationMatrix(v3f(0, 0, g_Zoom))
-      * TrackballUI::matrix()
-      * translationMatrix(-bx.center());
+    m4x4f view = trackball_view(bx);
 
     // should we redraw?
     bool redraw = true;
@@ -845,53 +2358,70 @@ void mainRender()
     }
     g_LastView = view;
 
+    // (re)allocate the render targets, beads are drawn again
+    if (g_GBuffer->w() != g_RenderWidth || g_GBuffer->h() != g_RenderHeight) {
+      g_GBuffer->allocate(g_RenderWidth, g_RenderHeight);
+      g_DepthBlur->allocate(g_RenderWidth, g_RenderHeight);
+      g_RedrawBeads = true;
+    }
+
     // offscreen rendering
-    g_RT->bind();
+    g_GBuffer->bind();
     glViewport(0, 0, g_RenderWidth, g_RenderHeight);
 
-    if (redraw || g_ForceRedraw) {
+    bool redraw_beads = false;
+    if (g_ForceRedraw) {
       // clear on redraw
       g_ForceRedraw = false;
       LibSL::GPUHelpers::clearScreen(LIBSL_COLOR_BUFFER | LIBSL_DEPTH_BUFFER, 0.0f, 0.0f, 0.0f);
       // reset motion
+      sim_thread_stop();
       printer_reset();
+      g_Bead.clear();
       // unpause
-      g_Paused = false;
+      g_Sim->paused = false;
+    } else if (redraw || g_RedrawBeads) {
+      // view change only: the beads deposited so far are drawn again, the simulation goes on
+      LibSL::GPUHelpers::clearScreen(LIBSL_COLOR_BUFFER | LIBSL_DEPTH_BUFFER, 0.0f, 0.0f, 0.0f);
+      redraw_beads = true;
     }
+    g_RedrawBeads = false;
     if (g_ForceClear) {
       // clear
       g_ForceClear = false;
       LibSL::GPUHelpers::clearScreen(LIBSL_COLOR_BUFFER | LIBSL_DEPTH_BUFFER, 0.0f, 0.0f, 0.0f);
+      sim_thread_stop();
+      g_Bead.clear();
+      redraw_beads = false;
     }
 
     glEnable(GL_CULL_FACE);
 
-    g_ShaderDeposition.begin();
-    g_ShaderDeposition.u_projection.set(proj);
-    g_ShaderDeposition.u_view.set(view);
-    g_ShaderDeposition.u_ZNear.set(ZNear);
-    g_ShaderDeposition.u_ZFar.set(ZFar);
-
-    if (!g_Paused) {
-      int n = max(1,(int)round(g_UserMmStep / g_MmStep));
-      ForIndex(sub, n) {
-        step_simulation(true);
-        if (g_Paused) break;
-      }
+    int clip[4] = {
+      g_ClipMode == 1 ? g_ClipFrom : INT_MIN, g_ClipMode == 1 ? g_ClipTo : INT_MAX, // layers
+      g_ClipMode == 2 ? g_ClipFrom : INT_MIN, g_ClipMode == 2 ? g_ClipTo : INT_MAX  // lines
+    };
+    AutoBindShader::deposition& shader_deposition = deposition_begin(proj, view, fov, g_RenderHeight, clip);
+
+    // the simulation runs on its own thread, adds the beads it deposited
+    sim_thread_update();
+    sim_snapshot_read(g_Shown, g_ShownVersion);
+
+    // draw the beads of this frame, or all of them after a view change
+    if (redraw_beads) {
+      g_Bead.redraw();
+    } else {
+      g_Bead.flush();
     }
 
-    g_ShaderDeposition.end();
+    shader_deposition.end();
 
-    g_RT->unbind();
+    g_GBuffer->unbind();
 
-    if (g_ShowTrajectory) {
-      // trajectory
-      while (g_Trajectory.size() > 256) {
-        g_Trajectory.erase(g_Trajectory.begin());
-      }
-      // erase one each time
-      if (!g_Trajectory.empty()) {
-        g_Trajectory.erase(g_Trajectory.begin());
+    if (g_Sim->show_trajectory) {
+      // trajectory (last positions, see sim_publish), erase one each time
+      if (!g_Shown.trajectory.empty()) {
+        g_Shown.trajectory.erase(g_Shown.trajectory.begin());
       }
     }
 
@@ -903,23 +2433,11 @@ void mainRender()
     glViewport(g_UIWidth, 0, g_RenderWidth, g_RenderHeight);
     LibSL::GPUHelpers::clearScreen(LIBSL_COLOR_BUFFER | LIBSL_DEPTH_BUFFER, 0.1f, 0.1f, 0.1f);
 
-    // final pass
-    g_ShaderFinal.begin();
-    g_ShaderFinal.u_projview.set(orthoMatrixGL(0.0f, 1.0f, 0.0f, 1.0f, -1.0f, 1.0f));
-    g_ShaderFinal.u_texpts.set(0);
-    g_ShaderFinal.u_pixsz.set(v3f(1.0f / (float)g_RTWidth, 1.0f / (float)g_RTWidth, 0.0f)); // squared and power of 2 tex to increase compatibility
-    g_ShaderFinal.u_texscl.set(v2f(g_RenderWidth / (float)g_RTWidth, g_RenderHeight / (float)g_RTHeight)); // to adapt screen texture to the tex coord. one above
-    g_ShaderFinal.u_ZNear.set(0.01f);
-    g_ShaderFinal.u_ZFar.set(1000.0f);
-    g_ShaderFinal.u_color_overhangs.set(g_ColorOverhangs ? 1 : 0);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, g_RT->texture());
-    g_GPUMesh_quad->render();
-    g_ShaderFinal.end();
+    gbuffer_shade(g_UIWidth, g_RenderWidth, g_RenderHeight, nullptr);
 
     // render trajectory
-    if (g_ShowTrajectory && !g_Trajectory.empty()) {
-    // if (!g_Trajectory.empty()) {
+    if (g_Sim->show_trajectory && !g_Shown.trajectory.empty()) {
+    // if (!g_Shown.trajectory.empty()) {
       glEnable(GL_BLEND);
       glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
       glDisable(GL_DEPTH_TEST);
@@ -927,10 +2445,10 @@ void mainRender()
       g_ShaderSimple.u_projection.set(proj);
       g_ShaderSimple.u_view.set(view);
       g_ShaderSimple.u_color.set(v4f(0, 1, 0, 1));
-      v3d prev = g_Trajectory.front();
-      ForRange(t, 1, (int)g_Trajectory.size() - 1) {
-        g_ShaderSimple.u_alpha.set(t / (float)((int)g_Trajectory.size() - 1));
-        v3d pos = g_Trajectory[t];
+      v3d prev = g_Shown.trajectory.front();
+      ForRange(t, 1, (int)g_Shown.trajectory.size() - 1) {
+        g_ShaderSimple.u_alpha.set(t / (float)((int)g_Shown.trajectory.size() - 1));
+        v3d pos = g_Shown.trajectory[t];
         // draw cylinder
         g_ShaderSimple.u_view.set(
           view
@@ -944,27 +2462,12 @@ void mainRender()
       glEnable(GL_DEPTH_TEST);
     }
 
-    if (g_DumpHeightField) {
-      ImageRGB img(g_HeightField.xsize(), g_HeightField.ysize());
-      ForImage((&img), i, j) {
-        img.pixel(i, j) = uchar(frac(g_HeightField.at(i, j)[0]) * 255.0f);
-      }
-      static int cnt = 0;
-      // Warning! the folder must be prepared !
-      // Note: shouldn't it be tied to line number / layer height?
-      saveImage(sprint("%s_dump\\hfield_%04d.png", g_GCode_path.c_str(), cnt++), &img);
-      std::cerr << "Height Fields dumped at : " << g_GCode_path << "_dump\\" << std::endl;
-      if (g_GlobalDepositionLength - g_DumpHeightFieldStartLen > 10.0f) {
-        g_DumpHeightField = false;
-      }
-    }
-
 #if 0
     //////////////////////////////////////////////////////////////
     glViewport(g_UIWidth, 0, g_RenderWidth /4, g_RenderHeight /4);
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, g_RT->texture());
-    AutoPtr<Tex2DLum32F> texh(new Tex2DLum32F(g_HeightField));
+    glBindTexture(GL_TEXTURE_2D, g_GBuffer->texture(0));
+    AutoPtr<Tex2DLum32F> texh(new Tex2DLum32F(g_Sim->hfield));
     LIBSL_GL_CHECK_ERROR;
     g_ShaderSimple.begin();
     g_ShaderSimple.u_projection.set(proj);
@@ -987,7 +2490,7 @@ void mainRender()
 #endif
 
     // render bed
-    bed_render(proj,view,g_BedSize[0], g_BedSize[1]);
+    bed_render(proj,view,g_Sim->bed_size[0], g_Sim->bed_size[1]);
 
     // render axis
     {
@@ -1083,12 +2586,14 @@ void ImGuiPanel()
     ImGui::SetNextTreeNodeOpen(true);
     if (ImGui::CollapsingHeader("File")) {
       if (ImGui::Button("Load a new Gcode")) {
+        sim_thread_stop();
+        g_Sim->pipeline.stop(); // decodes g_Sim->gcode_source
         load_gcode();
-        g_GCode_string = loadFileIntoString(g_GCode_path.c_str());
-        g_FilamentDiameter = 1.75f;
-        g_NozzleDiameter = 0.4f;
+        gcode_load(g_Sim->gcode_source, loadFileIntoString(g_GCode_path.c_str()));
+        g_Sim->filament_diameter = 1.75f;
+        g_Sim->nozzle_diameter = 0.4f;
         session_start();
-        motion_start(g_FilamentDiameter);
+        motion_start(g_Sim->filament_diameter);
         printer_reset();
         g_ForceRedraw = true;
       }
@@ -1106,46 +2611,103 @@ void ImGuiPanel()
     */
 #endif
 
+    // settings are edited on a copy, applied once the simulation thread is
+    // stopped (see below), the state shown is the one it published
+    t_sim_settings ui = *g_Sim;
+
     // printer setup section
     ImGui::SetNextTreeNodeOpen(true);
     if (ImGui::CollapsingHeader("Printer")) {
       // filament diameter
-      ImGui::InputFloat("Filament diameter", &g_FilamentDiameter, 0.0f, 0.0f, 3);
-      g_FilamentDiameter = std::clamp(g_FilamentDiameter, 0.1f, 10.0f);
+      ImGui::InputFloat("Filament diameter", &ui.filament_diameter, 0.0f, 0.0f, 3);
+      ui.filament_diameter = std::clamp(ui.filament_diameter, 0.1f, 10.0f);
       // nozzle diameter
-      ImGui::InputFloat("Nozzle diameter", &g_NozzleDiameter, 0.0f, 0.0f, 3);
-      g_NozzleDiameter = std::clamp(g_NozzleDiameter, c_HeightFieldStep * 2.0f, 10.0f);
+      bool hfield_changed = false;
+      // applied on enter, not on each keystroke (the height field follows the nozzle)
+      if (ImGui::InputFloat("Nozzle diameter", &ui.nozzle_diameter, 0.0f, 0.0f, "%.3f", ImGuiInputTextFlags_EnterReturnsTrue)) {
+        ui.nozzle_diameter = std::clamp(ui.nozzle_diameter, c_HeightFieldStepMin * 2.0f, 10.0f);
+        hfield_changed     = ui.auto_hfield_step;
+      }
+      // height field resolution
+      hfield_changed = ImGui::Checkbox("Automatic height field resolution", &ui.auto_hfield_step) || hfield_changed;
+      ImGui::SameLine(); HelpMarker("Cell size of the height field used for overlap and overhang detection. When automatic, it is a fraction of the nozzle diameter. Smaller is more accurate but slower and uses more memory.");
+      if (!ui.auto_hfield_step) {
+        hfield_changed = ImGui::InputFloat("Height field step (mm)", &ui.hfield_step, 0.0f, 0.0f, "%.3f", ImGuiInputTextFlags_EnterReturnsTrue) || hfield_changed;
+      }
+      hfield_changed = ImGui::Checkbox("Sparse voxels", &ui.use_brickmap) || hfield_changed;
+      ImGui::SameLine(); HelpMarker("Track deposited material with sparse voxels instead of a height field. Slower, but supports z-hops, sequential and non-planar printing.");
+      if (ui.use_brickmap) {
+        if (g_Shown.voxels_saturated) {
+          ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "Voxels: %s (full!)", printByteSize(g_Shown.voxels_bytes).c_str());
+          ImGui::SameLine(); HelpMarker("The voxel memory budget is reached: material deposited from now on is ignored, overhangs and overlaps are no longer accurate.");
+        } else {
+          ImGui::Text("Voxels: %s", printByteSize(g_Shown.voxels_bytes).c_str());
+        }
+      }
+      ImGui::Text("Beads: %d (%s)", (int)g_Bead.store().size(), printByteSize(g_Bead.store().byteSize()).c_str());
+      ImGui::SameLine(); HelpMarker("Segments kept to redraw the print when the view changes, without simulating again.");
+      ImGui::Text("Chunks drawn: %d / %d (%d simplified)", g_Bead.renderer().numDrawn(), g_Bead.store().numChunks(), g_Bead.renderer().numSimplified());
+      if (hfield_changed) {
+        sim_thread_stop();
+        static_cast<t_sim_settings&>(*g_Sim) = ui;
+        heightfield_allocate();
+        printer_reset();
+        ui = *g_Sim;
+        g_ForceRedraw = true;
+      }
       // extruders
-      ImGui::InputInt("Number of extruders", &g_NumExtruders, 1, 1);
-      if (g_NumExtruders > 1) {
-        ImGui::Text("Extruders detected: %d", g_NumExtruders);
+      ImGui::InputInt("Number of extruders", &ui.num_extruders, 1, 1);
+      if (ui.num_extruders > 1) {
+        ImGui::Text("Extruders detected: %d", ui.num_extruders);
         // extruders offsets (extruder 0 is ommited, as it should be the reference)
-        for (int i = 1; i != g_NumExtruders; i++) {
+        for (int i = 1; i != ui.num_extruders; i++) {
           if (ImGui::TreeNode(("Offsets for Extruder " + std::to_string(i)).c_str())) {
-            ImGui::InputFloat("X Offset", &g_Extruders_offset[i].first, 0.1f, 0.5f, "%.3f");
-            ImGui::InputFloat("Y Offset", &g_Extruders_offset[i].second, 0.1f, 0.5f, "%.3f");
+            ImGui::InputFloat("X Offset", &ui.extruders_offset[i].first, 0.1f, 0.5f, "%.3f");
+            ImGui::InputFloat("Y Offset", &ui.extruders_offset[i].second, 0.1f, 0.5f, "%.3f");
             ImGui::TreePop();
           }
         }
       }
       // bed dimmensions
-      ImGui::InputFloat("Bed X size", &g_BedSize[0], 0.5f, 1.0f, "%.3f");
-      ImGui::InputFloat("Bed Y size", &g_BedSize[1], 0.5f, 1.0f, "%.3f");
+      ImGui::InputFloat("Bed X size", &ui.bed_size[0], 0.5f, 1.0f, "%.3f");
+      ImGui::InputFloat("Bed Y size", &ui.bed_size[1], 0.5f, 1.0f, "%.3f");
       // volumetric extrusion
-      ImGui::Checkbox("Bed center is (0,0)", &g_isCentered);
+      ImGui::Checkbox("Bed center is (0,0)", &ui.is_centered);
     }
 
     // control
     ImGui::SetNextTreeNodeOpen(true);
     if (ImGui::CollapsingHeader("Control")) {
       // start line
-      ImGui::InputInt("Start at GCode line", &g_StartAtLine);
-      g_StartAtLine = max(0, min(g_StartAtLine, g_LastLine - 1));
+      ImGui::InputInt("Start at GCode line", &ui.start_at_line);
+      ui.start_at_line = max(0, min(ui.start_at_line, g_Sim->last_line - 1));
+      // scrubbing, restarts from the closest checkpoint
+      if (ImGui::SliderInt("Scrub", &ui.start_at_line, 0, max(0, g_Sim->last_line - 1))) {
+        g_ForceRedraw = true;
+      }
+      ImGui::SameLine(); HelpMarker("Checkpoints are recorded while simulating, restarting after a checkpoint only replays the lines since. Without checkpoint the material below the start line is approximated by a flat layer.");
+      ImGui::Text("Checkpoints: %d (%s)", g_Shown.num_checkpoints, printByteSize(g_Shown.checkpoints_bytes).c_str());
+      if (ImGui::InputInt("Checkpoint every (layers)", &ui.checkpoint_every_layers)) {
+        sim_thread_stop();
+        checkpoints_clear();
+      }
+      ui.checkpoint_every_layers = max(1, ui.checkpoint_every_layers);
       // animation step (mm/step)
       ImGui::SliderFloat("Step (mm)", &g_UserMmStep, 0.001f, 1000.0f, "%.3f", 3.0f);
+      ImGui::Checkbox("Max speed", &g_MaxSpeed);
+#ifdef EMSCRIPTEN
+      ImGui::SameLine(); HelpMarker("Simulates as many steps per frame as the budget allows, the step length is ignored");
+      ImGui::SliderFloat("Frame budget (ms)", &g_FrameBudgetMs, 1.0f, 100.0f, "%.0f");
+#else
+      ImGui::SameLine(); HelpMarker("Simulates as fast as the simulation thread goes, the step length is ignored");
+#endif
+      ImGui::Text("Speed: %.0f steps/s (%.1f mm/s)", g_Shown.steps_per_second, g_Shown.steps_per_second * ui.mm_step);
       // control buttons
       if (ImGui::Button("Reset")) {
+        sim_thread_stop();
+        static_cast<t_sim_settings&>(*g_Sim) = ui;
         printer_reset();
+        ui = *g_Sim;
         g_ForceRedraw = true;
       }
       ImGui::SameLine();
@@ -1154,41 +2716,87 @@ void ImGuiPanel()
       }
 #ifndef EMSCRIPTEN
       ImGui::SameLine();
-      if (ImGui::Button("Dump")) {
-        g_DumpHeightField = true;
-        g_DumpHeightFieldStartLen = g_GlobalDepositionLength;
+      if (!ui.dump_hfield) {
+        if (ImGui::Button("Dump")) {
+          sim_thread_stop();
+          // portable path, folder is created if needed
+          ui.dump_hfield       = hfield_export_start(g_GCode_path + "_dump", (e_HFieldExportFormat)g_DumpFormat);
+          g_Sim->dump_last_len = g_Sim->deposition_length;
+          g_Sim->dump_last_z   = g_Sim->current_pos[2];
+        }
+      } else {
+        if (ImGui::Button("Stop dump")) {
+          sim_thread_stop();
+          hfield_export_stop();
+          ui.dump_hfield = false;
+        }
+        ImGui::SameLine(); ImGui::Text("%d", hfield_export_written());
+      }
+      if (!ui.dump_hfield) {
+        ImGui::Combo("Dump format", &g_DumpFormat, "16 bits png\0raw float\0");
+        ImGui::InputFloat("Dump every (mm)", &ui.dump_every_mm, 1.0f, 10.0f, "%.1f");
+        ui.dump_every_mm = max(0.0f, ui.dump_every_mm);
+        ImGui::SameLine(); HelpMarker("Height field snapshots are written in the background, every N mm of deposition or once per layer when 0");
       }
 #endif
       // pause button
-      if (g_Paused) {
+      if (g_Shown.paused) {
         if (ImGui::Button("Resume")) {
-          g_Paused = false;
+          sim_thread_stop();
+          g_Sim->paused = false;
         }
       } else {
         if (ImGui::Button("Pause")) {
-          g_Paused = true;
+          sim_thread_stop();
+          g_Sim->paused = true;
         }
       }
       // auto pause
       ImGui::SameLine();
-      ImGui::Checkbox("Auto pause", &g_AutoPause);
-      if (g_AutoPause) {
-        ImGui::InputFloat("Overhang >", &g_AutoPauseDanglingLen, 1.0f, 1000.0f);
+      ImGui::Checkbox("Auto pause", &ui.auto_pause);
+      if (ui.auto_pause) {
+        ImGui::InputFloat("Overhang >", &ui.auto_pause_dangling_len, 1.0f, 1000.0f);
         ImGui::SameLine(); HelpMarker("Will auto-pause when the detected overhang value is higher than the threshold");
-        ImGui::InputFloat("Overlap >", &g_AutoPauseOverlapLen, 1.0f, 1000.0f);
+        ImGui::InputFloat("Overlap >", &ui.auto_pause_overlap_len, 1.0f, 1000.0f);
         ImGui::SameLine(); HelpMarker("Will auto-pause when the detected overlap value is higher than the threshold");
       }
       // show trajectory (virtual nozzle)
-      ImGui::Checkbox("Show trajectory", &g_ShowTrajectory);
+      ImGui::Checkbox("Show trajectory", &ui.show_trajectory);
       // show overlaps
       ImGui::Checkbox("Show overlaps and overhangs", &g_ColorOverhangs);
       ImGui::SameLine(); HelpMarker("Overlaps -> blue \nOverhangs -> red");
+      // ray cast beads
+      if (ImGui::Checkbox("Ray cast beads", &g_BeadImpostors)) {
+        g_RedrawBeads = true;
+      }
+      ImGui::SameLine(); HelpMarker("Draws each bead as a box in which its exact shape is ray cast, instead of a cylinder and two spheres. Fewer vertices and smoother beads.");
+      // ambient occlusion
+      const char *ao_qualities[] = { "None", "Fast", "Balanced", "Full" };
+      ImGui::Combo("Occlusion", &g_AOQuality, ao_qualities, 4);
+      ImGui::SameLine(); HelpMarker("Quality of the shading of concave regions. Lower is faster, helps with large windows and software rendering.");
+      // clipping
+      const char *clip_modes[] = { "None", "Layers", "GCode lines" };
+      bool clip_changed = ImGui::Combo("Clip", &g_ClipMode, clip_modes, 3);
+      ImGui::SameLine(); HelpMarker("Only shows the beads deposited within a range of layers or gcode lines, without simulating again.");
+      if (g_ClipMode != 0) {
+        int range_max  = g_ClipMode == 1 ? g_Shown.num_layers : g_Sim->last_line;
+        if (clip_changed) { // everything, then narrowed down
+          g_ClipFrom = 0;
+          g_ClipTo   = range_max;
+        }
+        clip_changed   = ImGui::SliderInt("From", &g_ClipFrom, 0, range_max) || clip_changed;
+        clip_changed   = ImGui::SliderInt("To", &g_ClipTo, 0, range_max) || clip_changed;
+        g_ClipTo       = max(g_ClipFrom, g_ClipTo);
+      }
+      if (clip_changed) {
+        g_RedrawBeads = true;
+      }
 
-      ImGui::Checkbox("Automatic deposition height & width", &g_AutoDepositionHW);
+      ImGui::Checkbox("Automatic deposition height & width", &ui.auto_deposition_hw);
       ImGui::SameLine(); HelpMarker("The deposition height & width will be automatically processed depending on coordinates, flow, filament diameter and nozzle diameter");
-      if (!g_AutoDepositionHW) {
-        ImGui::InputFloat("Deposition Height", &g_DepositionHeight, 0.0f, 0.0f, 3);
-        ImGui::InputFloat("Deposition Width", &g_DepositionWidth, 0.0f, 0.0f, 3);
+      if (!ui.auto_deposition_hw) {
+        ImGui::InputFloat("Deposition Height", &ui.deposition_height, 0.0f, 0.0f, 3);
+        ImGui::InputFloat("Deposition Width", &ui.deposition_width, 0.0f, 0.0f, 3);
       }
     }
 
@@ -1196,63 +2804,64 @@ void ImGuiPanel()
     ImGui::SetNextTreeNodeOpen(true);
     if (ImGui::CollapsingHeader("Status")) {
       // current gcode line
-      int line = gcode_line();
+      int line = g_Shown.current_line;
       ImGui::InputInt("GCode line", &line, 1, 100, ImGuiInputTextFlags_ReadOnly);
       // current gcode pos
       static v3f pos;
-      pos = v3f(motion_get_current_pos());
+      pos = v3f(g_Shown.current_pos);
       ImGui::InputFloat3("XYZ (mm)", &pos[0]);
-      // flow graph
-      double flow = motion_get_current_flow() * 1000.0;
-      g_FlowsSample += (float)flow;
-      g_FlowsCount++;
-      if (g_FlowsCount == 32) {
-        g_FlowsSample /= (float)g_FlowsCount;
-        g_Flows.erase(g_Flows.begin());
-        g_Flows.push_back(g_FlowsSample);
-        g_FlowsCount = 0;
-        g_FlowsSample = 0.0f;
-      }
-      ImGui::PlotLines("Flow (mm^3/sec)", &g_Flows[0], (int)g_Flows.size());
-      // speed graph
-      float speed = (float)gcode_speed();
-      g_SpeedsSample += speed;
-      g_SpeedsCount++;
-      if (g_SpeedsCount == 32) {
-        g_SpeedsSample /= (float)g_SpeedsCount;
-        g_Speeds.erase(g_Speeds.begin());
-        g_Speeds.push_back(g_SpeedsSample);
-        g_SpeedsCount = 0;
-        g_SpeedsSample = 0.0f;
+      // telemetry graphs, over simulated time
+      {
+        const char *spans[] = { "100 sec", "14 min", "2 hours", "15 hours" };
+        ImGui::Combo("Graphs span", &g_TelemetryLevel, spans, TelemetrySeries::c_Levels);
+        static std::vector<float> samples;
+        telemetry_read(Telemetry_Flow, g_TelemetryLevel, TelemetrySeries::c_Capacity, samples);
+        ImGui::PlotLines("Flow (mm^3/sec)", samples.empty() ? nullptr : &samples[0], (int)samples.size());
+        telemetry_read(Telemetry_Speed, g_TelemetryLevel, TelemetrySeries::c_Capacity, samples);
+        ImGui::PlotLines("Speed (mm/sec)", samples.empty() ? nullptr : &samples[0], (int)samples.size());
+        telemetry_read(Telemetry_Rate, g_TelemetryLevel, TelemetrySeries::c_Capacity, samples);
+        ImGui::PlotLines("Sim. rate (x real time)", samples.empty() ? nullptr : &samples[0], (int)samples.size());
+#ifndef EMSCRIPTEN
+        if (ImGui::Button("Export graphs (telemetry.csv)")) {
+          telemetry_export_csv("telemetry.csv", g_TelemetryLevel);
+        }
+#endif
       }
-      ImGui::PlotLines("Speed (mm/sec)", &g_Speeds[0], (int)g_Speeds.size());
       // dangling histogram
       {
-        static std::vector<float> histo; /// oh this is ugly, very ugly
-        int maxv = 0;
-        for (auto h : g_DanglingHisto) {
-          maxv = max(maxv, h.first);
-        }
-        histo.resize(maxv + 1);
-        for (auto h : g_DanglingHisto) {
-          histo[h.first] = h.second;
+        static std::vector<float> histo;
+        histo.assign(max(1, g_Shown.dangling_histo.numBuckets()), 0.0f);
+        ForIndex(b, g_Shown.dangling_histo.numBuckets()) {
+          histo[b] = (float)g_Shown.dangling_histo.bucket(b);
         }
         ImGui::PlotHistogram("dangling (red) ", &histo[0], (int)histo.size());
       }
       // overlap histogram
       {
-        static std::vector<float> histo; /// oh this is ugly, very ugly
-        int maxv = 0;
-        for (auto h : g_OverlapHisto) {
-          maxv = max(maxv, h.first);
-        }
-        histo.resize(maxv + 1);
-        for (auto h : g_OverlapHisto) {
-          histo[h.first] = h.second;
+        static std::vector<float> histo;
+        histo.assign(max(1, g_Shown.overlap_histo.numBuckets()), 0.0f);
+        ForIndex(b, g_Shown.overlap_histo.numBuckets()) {
+          histo[b] = (float)g_Shown.overlap_histo.bucket(b);
         }
         ImGui::PlotHistogram("overlaps (blue)", &histo[0], (int)histo.size());
       }
     }
+    // per tool and feature role
+    if (ImGui::CollapsingHeader("Per tool and feature")) {
+      ImGui::Text("tool role: deposition / dangling / overlap (mm)");
+      for (const auto& kv : g_Shown.feature_stats.entries()) {
+        const FeatureStats::t_entry& e = kv.second;
+        if (e.deposition <= 0.0) continue;
+        std::string role = gcode_role_name(kv.first.second);
+        ImGui::Text("T%d %s: %.0f / %.1f / %.1f", kv.first.first, role.empty() ? "(none)" : role.c_str(),
+                    e.deposition, e.dangling, e.overlap);
+      }
+    }
+    // edited settings, the simulation thread restarts with them on next frame
+    if (!sim_settings_equal(ui, *g_Sim)) {
+      sim_thread_stop();
+      static_cast<t_sim_settings&>(*g_Sim) = ui;
+    }
     ImGui::End();
   }
   else { // fatal error
@@ -27,6 +27,12 @@ LIBSL_WIN32_FIX;
 
 #include <imgui.h>
 
+#include <atomic>
+#include <climits>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #ifdef EMSCRIPTEN
   #include <emscripten.h>
   #include <emscripten/html5.h>
@@ -42,6 +48,21 @@ LIBSL_WIN32_FIX;
 #endif
 
 #include "sphere_squash.h"
+#include "ring_buffer.h"
+#include "disk_table.h"
+#include "brickmap.h"
+#include "heightfield.h"
+#include "layer_stats.h"
+#include "length_histogram.h"
+#include "feature_stats.h"
+#include "heatmap.h"
+#include "bead_store.h"
+#include "bead_renderer.h"
+#include "gl_target.h"
+#include "telemetry.h"
+#include "gcode.h"
+#include "motion.h"
+#include "sim_pipeline.h"
 
 // ----------------------------------------------------------------
 using namespace std;
@@ -65,6 +86,7 @@ typedef struct
 {
   double deplength;
   double radius;
+  double thickness;
   v3d   a;
   v3d   b;
 } t_height_segment;
@@ -72,9 +94,8 @@ typedef struct
 // ----------------------------------------------------------------
 
 // file handling
-std::string   g_GCode_path;
-std::string   g_GCode_string;
-time_t        g_FileStamp;
+std::string                g_GCode_path;
+time_t                     g_FileStamp;
 
 bool          g_Downloading = false;
 float         g_DownloadProgress = 0.0f;
@@ -88,54 +109,28 @@ const int     g_UIWidth = 300; // imgui panel width
 int           g_RenderWidth = g_ScreenWidth - g_UIWidth;
 int           g_RenderHeight = g_ScreenHeight;
 
-int           g_RTWidth = 2048; // note: should be based on screen size ?
-int           g_RTHeight = 2048;
-
-// virtual printer settings
-v2f                        g_BedSize(200.0f, 200.0f);
-float                      g_FilamentDiameter = 1.75f;
-float                      g_NozzleDiameter = 0.4f;
-bool                       g_isCentered = false;
-int                        g_NumExtruders = 1;
-vector<pair<float, float>> g_Extruders_offset;
-
 // deposition track
-const float   c_HeightFieldStep = 0.04f; // mm
+const float   c_HeightFieldStepRatio = 0.1f;    // default cell size, as a fraction of the nozzle diameter
+const float   c_HeightFieldStepMin   = 0.005f;  // mm
+const float   c_HeightFieldStepMax   = 0.5f;    // mm
 const float   c_ThicknessEpsilon = 0.001f; // 1 um
 
-float         g_MmStep = g_NozzleDiameter * 0.5f;
-float         g_UserMmStep = 100.0f;
+float                      g_UserMmStep = 100.0f;
+bool                       g_MaxSpeed = false;      // as many steps per frame as the budget allows
+float                      g_FrameBudgetMs = 12.0f; // simulation time per frame, keeps the UI responsive
+double                     g_StepsPerSecond = 0.0;  // measured, shown in the UI
 
 // controls
-int           g_StartAtLine = 0;
-int           g_LastLine = 0;
-
-bool          g_ShowTrajectory = true;
-bool          g_ColorOverhangs = false;
-
-bool          g_AutoDepositionHW = true;
-float         g_DepositionHeight = g_NozzleDiameter / 2.0f;
-float         g_DepositionWidth = g_NozzleDiameter / 2.0f;
-
-bool          g_Paused = false;
-bool          g_AutoPause = false;
-float         g_AutoPauseDanglingLen = 5.0f;
-float         g_AutoPauseOverlapLen = 5.0f;
-
-bool          g_InDangling = false;
-double        g_InDanglingStart = 0.0;
-bool          g_InDanglingBridging = false;
-
-bool          g_InOverlap = false;
-double        g_InOverlapStart = 0.0;
-
-bool          g_DumpHeightField = false;
-double        g_DumpHeightFieldStartLen = 0.0;
+bool                       g_ColorOverhangs = false;
+bool                       g_BeadImpostors = false; // ray cast beads instead of meshes
+int                        g_AOQuality = 3; // ambient occlusion, 0: none, 1: fast, 2: balanced, 3: full
+bool                       g_RedrawBeads = false;   // draws all beads again on next frame
+int                        g_ClipMode = 0;          // drawn beads, 0: all, 1: layer range, 2: gcode line range
+int                        g_ClipFrom = 0;          // inclusive range of layers or lines
+int                        g_ClipTo = 0;
 
-// simulation handling
-v3d           g_PrevPos(0.0);
-v3d           g_PrevPrevPos(0.0);
-bool          g_PrevWasTravelOrDangling = false;
+int                        g_DumpFormat = 0;        // see e_HFieldExportFormat
+int                        g_TelemetryLevel = 0;    // telemetry resolution shown in the UI
 
 bool          g_ForceRedraw = true;
 bool          g_ForceClear = false;
@@ -143,26 +138,182 @@ bool          g_FatalError = false;
 bool          g_FatalErrorAllowRestart = false;
 string        g_FatalErrorMessage = "unkonwn error";
 
-std::vector<v3d>            g_Trajectory;
-std::list<t_height_segment> g_HeightSegments;
-AAB<3>                      g_HeightFieldBox;
-Array2D<Tuple<float, 1> >   g_HeightField;
+// checkpoints, to restart from any line without replaying the whole gcode
+typedef struct
+{
+  t_gcode_state                 gcode;
+  t_motion_state                motion;
+  v3d                           prev_pos;
+  v3d                           prev_prev_pos;
+  bool                          prev_was_travel_or_dangling;
+  double                        prev_thickness;
+  double                        deposition_length;
+  double                        sim_time;
+  double                        layer_z;
+  int                           num_layers;
+  std::vector<t_height_segment> height_segments; // not yet in the height field
+  TiledHeightField::t_tiles     tiles;           // shared copy-on-write with the height field
+} t_checkpoint;
+
+const int                                 c_MaxCheckpoints = 64;      // beyond, every other checkpoint is dropped
+
+// Printer settings and simulation state of a simulation. Each simulation
+// (the viewer, a job of the batch mode, a side of the compare mode) has its
+// own context, the simulation functions work on the context bound to the
+// calling thread (see sim_bind). Threads helping a simulation bind its
+// context, threads running another simulation bind their own.
+
+// settings, copied to start a simulation with the same ones
+struct t_sim_settings
+{
+  // virtual printer
+  v2f                        bed_size = v2f(200.0f, 200.0f);
+  float                      filament_diameter = 1.75f;
+  float                      nozzle_diameter = 0.4f;
+  bool                       is_centered = false;
+  int                        num_extruders = 1;
+  vector<pair<float, float>> extruders_offset;
+
+  bool          auto_hfield_step = true; // derive the cell size from the nozzle diameter
+  float         hfield_step = nozzle_diameter * c_HeightFieldStepRatio; // mm
+  float         mm_step = nozzle_diameter * 0.5f;
+
+  bool          use_brickmap = false;     // sparse voxels instead of the height field (non-monotonic z)
+  int           brickmap_budget_mb = 2048; // memory cap of the sparse voxels
+
+  // controls
+  int           start_at_line = 0;
+  bool          show_trajectory = true;
+
+  bool          auto_deposition_hw = true;
+  float         deposition_height = nozzle_diameter / 2.0f;
+  float         deposition_width = nozzle_diameter / 2.0f;
+
+  bool          auto_pause = false;
+  float         auto_pause_dangling_len = 5.0f;
+  float         auto_pause_overlap_len = 5.0f;
+
+  bool          dump_hfield = false;
+  float         dump_every_mm = 0.0f;    // snapshot every N mm of deposition, 0 for once per layer
+
+  int           checkpoint_every_layers = 10; // 0 disables checkpoints
+  float         checkpoint_every_sec = 60.0f; // simulated time
+
+  float         stats_height_thres = 1.2f; // mm, ignored everything below regarding overlaps and dangling
+  bool          telemetry_record = false;  // flow, speed and simulation rate (see telemetry.h), a single simulation records
+  bool          verbose = true;            // false in batch workers, keeps the console readable
+};
+
+struct t_sim_context : t_sim_settings
+{
+  t_sim_context() {}
+  t_sim_context(const t_sim_settings& settings) : t_sim_settings(settings) {}
+
+  t_gcode_source             gcode_source; // text and line index, once per load
+  t_gcode_context            gcode;  // interpreter
+  t_motion_context           motion;
+  int                        last_line = 0;
+
+  bool          paused = false;
+  bool          finished = false; // the gcode ended, cleared on reset
+
+  bool          in_dangling = false;
+  double        in_dangling_start = 0.0;
+  bool          in_dangling_bridging = false;
+
+  bool          in_overlap = false;
+  double        in_overlap_start = 0.0;
+
+  double        dump_last_len = 0.0;
+  double        dump_last_z = 0.0;
+
+  // simulation handling
+  v3d           prev_pos = v3d(0.0);
+  v3d           prev_prev_pos = v3d(0.0);
+  bool          prev_was_travel_or_dangling = false;
+  double        prev_thickness = 0.0;
+  double        simulated_time = 0.0;  // ms, since the start of the gcode
+  double        current_layer_z = 0.0;
+  int           num_layers = 0;        // layers started since the start of the gcode
+  int           current_line = 0;      // gcode line of the last deposited sample
+  v3d           current_pos = v3d(0.0); // position of the last deposited sample
+  SimPipeline   pipeline;              // decoding and motion ahead of the deposition (see step_simulation_pipelined)
+
+  std::vector<v3d>             trajectory;
+  RingBuffer<t_height_segment> height_segments;
+  AAB<3>                       hfield_box;
+  TiledHeightField             hfield;
+  BrickMap                     brickmap;
+  int                          hfield_epoch = 0;     // tiles are stamped with the epoch of their last modification
+
+  // checkpoints
+  int                          checkpoint_stride = 1;     // doubles each time checkpoints are decimated
+  bool                         state_exact = false;       // false after a flat fill, checkpoints would be wrong
+  std::string                  checkpoint_settings;       // settings the checkpoints were recorded with
+  std::vector<t_checkpoint>    checkpoints;               // sorted by gcode line
+
+  // stats
+  double                       deposition_length = 0.0;
+  std::vector<TrajPoint>       dangling_trajectory;
+  LengthHistogram              dangling_histo;
+  LengthHistogram              overlap_histo;
+  FeatureStats                 feature_stats; // per tool and feature role
+  LayerStatsSink               layer_stats;   // per layer records, when open
+  StatsHeatmap                 heatmap;       // dangling and overlap maps, when open
+};
+
+t_sim_context                             g_ViewerSim;     // simulation of the viewer
+thread_local t_sim_context               *g_Sim = NULL;    // simulation of the calling thread
 
-// stats
-float         g_StatsHeightThres = 1.2f; // mm, ignored everything below regarding overlaps and dangling
-double        g_GlobalDepositionLength = 0.0;
+// binds a simulation context (and its interpreter and motion) to the calling thread
+void sim_bind(t_sim_context *sim);
 
-std::vector<TrajPoint> g_DanglingTrajectory;
+// true if the settings are the same
+bool sim_settings_equal(const t_sim_settings& a, const t_sim_settings& b);
 
-std::map<int, float> g_DanglingHisto;
-std::map<int, float> g_OverlapHisto;
+// Viewer simulation thread: decoding, motion and deposition run off the
+// render thread. Segments of beads reach the render thread through a queue
+// (see GPUBead::drain), the state shown by the UI through a snapshot. The
+// render thread only changes the viewer simulation once the thread is
+// stopped (see sim_thread_stop), the UI edits a copy of the settings.
 
-std::vector<float> g_Flows(64, 0.0f);
-int                g_FlowsCount = 0;
-float              g_FlowsSample = 0.0f;
-std::vector<float> g_Speeds(64, 0.0f);
-int                g_SpeedsCount = 0;
-float              g_SpeedsSample = 0.0f;
+// state of the viewer simulation shown by the UI
+typedef struct
+{
+  int                 current_line = 0;
+  v3d                 current_pos = v3d(0.0);
+  int                 num_layers = 0;
+  bool                paused = false;
+  bool                finished = false;
+  int                 num_checkpoints = 0;
+  size_t              checkpoints_bytes = 0;
+  size_t              voxels_bytes = 0;
+  bool                voxels_saturated = false;
+  LengthHistogram     dangling_histo;
+  LengthHistogram     overlap_histo;
+  FeatureStats        feature_stats;
+  std::vector<v3d>    trajectory;     // last positions, when shown
+  double              steps_per_second = 0.0;
+} t_sim_snapshot;
+
+const int                                 c_SnapshotEveryMs = 30;      // publication period of the simulation thread
+const size_t                              c_TrajectoryLength = 256;    // positions shown
+const size_t                              c_BeadQueueSize   = 1 << 16; // segments between the simulation and the render thread
+
+#ifndef EMSCRIPTEN
+std::thread                               g_SimThread;
+std::atomic<bool>                         g_SimStop(false);      // asks the thread to stop after its current step
+std::atomic<bool>                         g_SimExited(false);    // the thread returned (stopped, paused or finished)
+std::atomic<int>                          g_SimStepsPerFrame(1); // steps granted per frame, INT_MAX at max speed
+std::atomic<int>                          g_SimFrame(0);         // frames rendered, counts the grants
+std::unique_ptr<SpscQueue<BeadStore::t_segment> > g_BeadQueue;
+#endif
+bool                                      g_SimRepublish = true; // the viewer simulation changed while stopped
+std::mutex                                g_SnapshotMutex;
+t_sim_snapshot                            g_Snapshot;            // last published, under g_SnapshotMutex
+int                                       g_SnapshotVersion = 0; // under g_SnapshotMutex
+t_sim_snapshot                            g_Shown;               // copy of the render thread
+int                                       g_ShownVersion = -1;
 
 // ----------------------------------------------------------------
 
@@ -172,8 +323,15 @@ AutoBindShader::simple     g_ShaderSimple;
 AutoBindShader::final      g_ShaderFinal;
 #include "deposition.h"
 AutoBindShader::deposition g_ShaderDeposition;
+AutoBindShader::deposition g_ShaderDepositionImpostor; // same shader, ray cast beads (IMPOSTOR defined)
+#include "depth_blur.h"
+AutoBindShader::depth_blur g_ShaderDepthBlur;
 
-RenderTarget2DRGBA_Ptr g_RT;
+// g-buffer at the size of the render area, written by deposition.fp
+//  0: normalized view depth, coverage (RG32F)
+//  1: view normal xy, stats, tool (RGBA16F)
+GLTarget_Ptr           g_GBuffer;
+GLTarget_Ptr           g_DepthBlur; // horizontal depth sums for the ambient occlusion (RG32F, same size)
 
 typedef GPUMESH_MVF1(mvf_vertex_3f)      mvf_mesh;
 typedef GPUMesh_VertexBuffer<mvf_mesh>   SimpleMesh;
@@ -181,7 +339,6 @@ typedef GPUMesh_VertexBuffer<mvf_mesh>   SimpleMesh;
 AutoPtr<SimpleMesh>                      g_GPUMesh_quad;
 AutoPtr<SimpleMesh>                      g_GPUMesh_axis;
 
-AutoPtr<MeshRenderer<mvf_mesh> >         g_GPUMesh_sphere;
 AutoPtr<MeshRenderer<mvf_mesh> >         g_GPUMesh_cylinder;
 
 m4x4f  g_LastView = m4x4f::identity();
@@ -246,9 +403,25 @@ void addBar(AutoPtr<T_Mesh> gpumesh, v3f a, v3f b, pair<v3f, v3f> uv, float sz =
 
 void mainRender();
 void makeAxisMesh();
+// creates the shaders, meshes and render targets, requires a GL context
+void render_init();
+// default view of the trackball, or a predefined one (trackball.F0N files, 1 to 7)
+// returns false if the view file is missing
+bool view_select(int view);
+// view matrix of the trackball, bx is the box of the scene
+m4x4f trackball_view(const AAB<3>& bx);
+// binds the deposition shader for the view, the beads out of clip are not
+// drawn (layer min, max, line min, max, inclusive), returns the bound shader
+AutoBindShader::deposition& deposition_begin(const m4x4f& proj, const m4x4f& view, float fov, int render_h, const int clip[4]);
+// ambient occlusion and shading of the g-buffer in the viewport (x, 0, w, h)
+// of target, or of the screen if null
+void gbuffer_shade(int x, int w, int h, GLTarget *target);
 m4x4f alignAlongSegment(const v3f& p0, const v3f& p1);
-void rasterizeDiskInHeightField(const v2i& p, float z, float r);
-void rasterizeInHeightField(v3f a, const v3f& b, float r);
+v2i  heightFieldCell(const v3f& a);
+// rows outside [j_min,j_max] are left untouched, so that bands can be rasterized in parallel
+void rasterizeDiskInHeightField(TiledHeightField& hfield, const v2i& p, float z, float r, int j_min = 0, int j_max = INT_MAX);
+void rasterizeInHeightField(TiledHeightField& hfield, v3f a, const v3f& b, float r, int j_min = 0, int j_max = INT_MAX);
+void flushHeightSegments(size_t n);
 
 float heightAt(v3f a, float r);
 float danglingAt(float max_th, const v3f& a, float r);
@@ -257,8 +430,35 @@ float overlapAt(float th, const v3f& a, float r);
 // ----------------------------------------------------------------
 // Simulation
 
+// deposits material for a motion sample, updates stats
+// returns true once the gcode is done (or on error)
+bool deposit_sample(const t_motion_sample& s, bool gpu_draw);
+
+// simulates the next step of mm_step millimeters, returns true once done
 bool step_simulation(bool gpu_draw);
 
+// same as step_simulation, but decoding and motion run ahead on their own
+// threads (pipeline of the context), only the deposition runs on the calling thread
+// returns false if the pipeline was stopped before the end of the gcode
+bool step_simulation_pipelined(bool gpu_draw);
+
+// simulates the steps of a frame: g_UserMmStep millimeters, or as many steps
+// as possible in max speed mode, within g_FrameBudgetMs in both cases
+// (web build, which simulates on the render thread)
+void step_simulation_frame();
+
+// called by the render thread once per frame: grants the steps of the frame,
+// (re)starts the simulation thread unless paused or finished, and adds the
+// beads it deposited to g_Bead
+void sim_thread_update();
+// stops the simulation thread after its current step, its beads are added
+// to g_Bead, the viewer simulation can then be changed
+void sim_thread_stop();
+// publishes the state of the simulation bound to the calling thread
+void sim_publish();
+// copies the last published state if it changed since _version, returns true if so
+bool sim_snapshot_read(t_sim_snapshot& _snapshot, int& _version);
+
 // ----------------------------------------------------------------
 // UI
 
@@ -272,11 +472,58 @@ void mainMouseWheel(int incr);
 // utilities
 
 void session_start();
+// prepares the printer once the gcode box, extruders and filament are known (see session_start)
+void session_prepare();
+void heightfield_allocate();
+void heightfield_fill(float z);
+void heightfield_snapshot(const v3d& pos);
+// settings affecting the deposition, checkpoints are only valid for these
+std::string simulation_settings();
+void checkpoints_clear();
+void checkpoint_record();
+// same, from the interpreter and motion states at the end of a step
+void checkpoint_record(const t_gcode_state& gstate, const t_motion_state& mstate);
+bool checkpoint_restore(int line);
+size_t checkpoints_byte_size();
 void printer_reset();
+void printer_fast_forward(int line);
+v3d  printer_position(v3d pos, int extruder);
+void rasterizeSegmentsParallel(const std::vector<t_height_segment>& segs);
 void load_gcode(std::string file = std::string()); // load a gcode file and return it as a string
-void gen_histogram(std::map<int, float> &map, Histogram &histo, float filter = 1.0f);
-void export_histogram(std::string fname, Histogram &h);
+void export_histogram(std::string fname, const LengthHistogram &h, float filter = 1.0f);
 string getFileName(const string& s);
+#ifndef EMSCRIPTEN
+// optional outputs of the stats modes
+typedef struct
+{
+  std::string layers;                // per layer records (--layers)
+  std::string heatmap;               // heatmaps base name (--heatmap)
+  float       heatmap_cell   = 1.0f; // mm
+  bool        heatmap_layers = false;
+  std::string features;              // per tool and feature role table (--features), a single file in batch mode
+} t_stats_outputs;
+// in batch mode, outputs are named after the gcode file
+void stats_outputs_open(const t_stats_outputs& outputs, const std::string& batch_file = std::string());
+void stats_outputs_close();
+void batch_stats(const std::string& input, const std::string& output, int num_threads, float export_filter, const t_stats_outputs& outputs);
+// simulates file_a and file_b (possibly the same) concurrently, file_b under
+// settings_b (key=value list, eg. "nozzle=0.6,resolution=0.05"), reports
+// the differences and writes them per layer to output
+void compare_stats(const std::string& file_a, const std::string& file_b, const std::string& settings_b, const std::string& output);
+// headless render mode (--render)
+typedef struct
+{
+  std::string      folder;        // where the png snapshots are written
+  std::vector<int> views;         // trackball.F0N view files, 0 for the default view
+  std::vector<int> lines;         // a snapshot of the beads up to each of these gcode lines
+  std::vector<int> layers;        // and up to each of these layers, a single one of the whole print if none
+  int              width  = 800;
+  int              height = 600;
+} t_render_request;
+// simulates the gcode with an offscreen context (see headless.h), no window
+// and no TrackballUI loop, returns false if no context can be created
+bool render_snapshots(const t_render_request& request);
+#endif
 
 #ifdef EMSCRIPTEN
 void onLoadedData(const char* arg) { }
@@ -349,38 +596,35 @@ private:
   v3f   m_LastPos;
   bool  m_IsBridge = false;
   int   m_Extruder = 0;
+  int   m_Line = 0;
+  int   m_Layer = 0;
+
+  // segments drawn since the last clear
+  BeadStore    m_Store;
+  BeadRenderer m_Renderer;
+
+  // when set, segments go through the queue instead of to the store
+  SpscQueue<BeadStore::t_segment> *m_Queue = NULL;
 
   void drawSegment(v3f a, v3f b, float th, float r, float dg, float ov, int e)
   {
-    double squash_t = min(th / 2.0, r); // min dimension on the edge sphere
-    double rs = disk_squashed_radius(r, squash_t); // squashed to preserve area or rectable (th * r)
-    g_ShaderDeposition.u_height.set((float)b[2]);
-    g_ShaderDeposition.u_thickness.set((float)th);
-    g_ShaderDeposition.u_radius.set((float)r);
-    g_ShaderDeposition.u_dangling.set(dg);
-    g_ShaderDeposition.u_overlap.set(ov);
-    g_ShaderDeposition.u_extruder.set(float(e + 1));
-    g_ShaderDeposition.u_bridge.set(m_IsBridge ? 1.0f : 0.0f);
-    // add cylinder from previous
-    g_ShaderDeposition.u_model.set(
-      translationMatrix(v3f(0, 0, -(float)squash_t))
-      * alignAlongSegment(v3f(a), v3f(b))
-      * scaleMatrix(v3f((float)rs, (float)rs, 1))
-    );
-    g_GPUMesh_cylinder->render();
-    // add spheres
-    g_ShaderDeposition.u_model.set(
-      translationMatrix(v3f(a))
-      * translationMatrix(v3f(0, 0, -(float)squash_t))
-      * scaleMatrix(v3f((float)rs))
-    );
-    g_GPUMesh_sphere->render();
-    g_ShaderDeposition.u_model.set(
-      translationMatrix(v3f(b))
-      * translationMatrix(v3f(0, 0, -(float)squash_t))
-      * scaleMatrix(v3f((float)rs))
-    );
-    g_GPUMesh_sphere->render();
+    BeadStore::t_segment s;
+    s.a        = a;
+    s.b        = b;
+    s.th       = th;
+    s.r        = r;
+    s.rs       = (float)disk_squashed_radius(r, min(th / 2.0, (double)r)); // squashed to preserve area or rectable (th * r)
+    s.dangling = dg;
+    s.overlap  = ov;
+    s.extruder = (short)e;
+    s.bridge   = m_IsBridge ? 1 : 0;
+    s.line     = m_Line;
+    s.layer    = m_Layer;
+    if (m_Queue) {
+      m_Queue->push(s);
+    } else {
+      m_Store.add(s);
+    }
   }
 
 public:
@@ -426,6 +670,82 @@ public:
     m_IsBridge = b;
   }
 
+  // gcode line and layer of the next segments
+  void setSource(int line, int layer) {
+    m_Line  = line;
+    m_Layer = layer;
+  }
+
+  // with a queue, points are added on the simulation thread and the segments
+  // reach the store on the render thread (see drain), NULL adds them directly
+  void setQueue(SpscQueue<BeadStore::t_segment> *queue)
+  {
+    m_Queue = queue;
+  }
+
+  // adds the segments waiting in the queue to the store, does not wait
+  // returns the number of segments added
+  size_t drain()
+  {
+    size_t n = 0;
+    BeadStore::t_segment s;
+    while (m_Queue && m_Queue->try_pop(s)) {
+      m_Store.add(s);
+      n++;
+    }
+    return n;
+  }
+
+  void init()
+  {
+    m_Renderer.init();
+  }
+
+  void terminate()
+  {
+    m_Renderer.terminate();
+  }
+
+  // beads as ray cast boxes, the impostor deposition shader has to be bound
+  void setImpostors(bool b)
+  {
+    m_Renderer.setMesh(b ? BeadRenderer::Mesh_Box : BeadRenderer::Mesh_Bead);
+  }
+
+  // view and clipping range used to cull chunks in redraw (see BeadRenderer)
+  void setView(const m4x4f& projview, float focal_pixels)
+  {
+    m_Renderer.setView(projview, focal_pixels);
+  }
+
+  void setClip(int layer_min, int layer_max, int line_min, int line_max)
+  {
+    m_Renderer.setClip(layer_min, layer_max, line_min, line_max);
+  }
+
+  // draws the segments added since the last flush (the deposition shader is bound)
+  void flush()
+  {
+    m_Renderer.drawNew(m_Store);
+  }
+
+  // draws all segments added since the last clear (the deposition shader is bound)
+  void redraw()
+  {
+    m_Renderer.drawAll(m_Store);
+  }
+
+  // forgets the drawn segments
+  void clear()
+  {
+    m_Store.clear();
+    m_Renderer.reset();
+    closeAny();
+  }
+
+  const BeadStore&    store()    const { return m_Store; }
+  const BeadRenderer& renderer() const { return m_Renderer; }
+
 };
 
 // ----------------------------------------------------------------
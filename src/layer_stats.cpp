@@ -0,0 +1,146 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "layer_stats.h"
+
+#include <cctype>
+#include <iomanip>
+
+// --------------------------------------------------------------
+
+bool LayerStatsSink::open(const std::string& fname)
+{
+  close();
+  m_File.open(fname);
+  if (!m_File) {
+    std::cerr << Console::red << "Unable to write " << fname << Console::gray << std::endl;
+    return false;
+  }
+  std::string ext = fname.size() > 4 ? fname.substr(fname.size() - 4) : std::string();
+  for (auto& c : ext) {
+    c = (char)tolower((unsigned char)c);
+  }
+  m_CSV   = (ext == ".csv");
+  m_Index = -1;
+  // fixed notation in both formats: no exponents, flows are small numbers
+  m_File << std::fixed << std::setprecision(6);
+  clearLayer(0.0, 0.0);
+  if (m_CSV) {
+    m_File << "layer,z_mm,deposition_mm,dangling_mm,overlap_mm,bridges,start_s,time_s,flow_min,flow_mean,flow_max,extruders" << std::endl;
+  }
+  return true;
+}
+
+// --------------------------------------------------------------
+
+void LayerStatsSink::close()
+{
+  if (!m_File.is_open()) return;
+  if (m_Index >= 0) {
+    write();
+  }
+  m_File.close();
+}
+
+// --------------------------------------------------------------
+
+void LayerStatsSink::clearLayer(double z, double start_time)
+{
+  m_Layer.z          = z;
+  m_Layer.deposition = 0.0;
+  m_Layer.dangling   = 0.0;
+  m_Layer.overlap    = 0.0;
+  m_Layer.bridges    = 0;
+  m_Layer.start_time = start_time;
+  m_Layer.time       = 0.0;
+  m_Layer.flow_min   = 0.0;
+  m_Layer.flow_max   = 0.0;
+  m_Layer.flow_sum   = 0.0;
+  m_Layer.extruders.clear();
+}
+
+// --------------------------------------------------------------
+
+void LayerStatsSink::write()
+{
+  const t_layer& L = m_Layer;
+  double flow_mean = L.deposition > 0.0 ? L.flow_sum / L.deposition : 0.0;
+  if (m_CSV) {
+    m_File << m_Index << ',' << L.z << ',' << L.deposition << ',' << L.dangling << ',' << L.overlap
+           << ',' << L.bridges << ',' << L.start_time / 1000.0 << ',' << L.time / 1000.0
+           << ',' << L.flow_min << ',' << flow_mean << ',' << L.flow_max << ',';
+    bool first = true;
+    for (const auto& e : L.extruders) {
+      m_File << (first ? "" : ";") << e.first << ':' << e.second;
+      first = false;
+    }
+    m_File << '\n';
+  } else {
+    m_File << "{\"layer\":" << m_Index << ",\"z\":" << L.z << ",\"deposition\":" << L.deposition
+           << ",\"dangling\":" << L.dangling << ",\"overlap\":" << L.overlap
+           << ",\"bridges\":" << L.bridges << ",\"start\":" << L.start_time / 1000.0
+           << ",\"time\":" << L.time / 1000.0
+           << ",\"flow\":{\"min\":" << L.flow_min << ",\"mean\":" << flow_mean << ",\"max\":" << L.flow_max << "}"
+           << ",\"extruders\":{";
+    bool first = true;
+    for (const auto& e : L.extruders) {
+      m_File << (first ? "" : ",") << '"' << e.first << "\":" << e.second;
+      first = false;
+    }
+    m_File << "}}\n";
+  }
+  m_File.flush();
+}
+
+// --------------------------------------------------------------
+
+void LayerStatsSink::newLayer(double z)
+{
+  if (!m_File.is_open()) return;
+  if (m_Index >= 0) {
+    write();
+  }
+  m_Index++;
+  clearLayer(z, m_Layer.start_time + m_Layer.time);
+}
+
+// --------------------------------------------------------------
+
+void LayerStatsSink::addTime(double ms)
+{
+  m_Layer.time += ms;
+}
+
+// --------------------------------------------------------------
+
+void LayerStatsSink::addDeposition(double len, double flow, int extruder)
+{
+  if (m_Layer.deposition == 0.0) {
+    m_Layer.flow_min = m_Layer.flow_max = flow;
+  } else {
+    m_Layer.flow_min = std::min(m_Layer.flow_min, flow);
+    m_Layer.flow_max = std::max(m_Layer.flow_max, flow);
+  }
+  m_Layer.deposition += len;
+  m_Layer.flow_sum   += flow * len;
+  m_Layer.extruders[extruder] += len;
+}
+
+// --------------------------------------------------------------
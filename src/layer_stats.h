@@ -0,0 +1,80 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+
+#include <fstream>
+#include <map>
+
+// ----------------------------------------------------------------
+
+// Per layer statistics, streamed to a file.
+// One record is written each time the simulation starts a new layer
+// (and for the last one on close), the file is flushed after each record
+// so it can be tailed. Only the current layer is kept in memory.
+// The format is CSV if the file name ends with .csv, JSON Lines otherwise.
+class LayerStatsSink
+{
+private:
+
+  typedef struct {
+    double z;
+    double deposition; // mm
+    double dangling;   // mm
+    double overlap;    // mm
+    int    bridges;
+    double start_time; // ms, simulated
+    double time;       // ms, simulated
+    double flow_min;   // mm^3/s
+    double flow_max;
+    double flow_sum;   // flow x length, for the mean
+    std::map<int, double> extruders; // deposited mm per extruder
+  } t_layer;
+
+  std::ofstream m_File;
+  bool          m_CSV   = false;
+  int           m_Index = -1; // -1 before the first layer
+  t_layer       m_Layer;
+
+  void write();
+  void clearLayer(double z, double start_time);
+
+public:
+
+  LayerStatsSink() {}
+
+  bool open(const std::string& fname);
+  void close();
+  bool isOpen() const { return m_File.is_open(); }
+
+  // starts a new layer, writes the previous one
+  void newLayer(double z);
+  // simulated time
+  void addTime(double ms);
+  // print move of length len (mm), at a given flow (mm^3/s)
+  void addDeposition(double len, double flow, int extruder);
+  void addDangling(double len) { m_Layer.dangling += len; }
+  void addOverlap(double len)  { m_Layer.overlap += len; }
+  void addBridge()             { m_Layer.bridges++; }
+};
+
+// ----------------------------------------------------------------
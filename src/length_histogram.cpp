@@ -0,0 +1,108 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "length_histogram.h"
+
+// --------------------------------------------------------------
+
+void LengthHistogram::merge(const LengthHistogram& h)
+{
+  ForIndex(b, h.numBuckets()) {
+    m_Counts[b] += h.m_Counts[b];
+  }
+  m_Count += h.m_Count;
+  m_Total += h.m_Total;
+  m_Max    = std::max(m_Max, h.m_Max);
+  m_Last   = std::max(m_Last, h.m_Last);
+}
+
+// --------------------------------------------------------------
+
+void LengthHistogram::clear()
+{
+  std::fill(m_Counts.begin(), m_Counts.begin() + numBuckets(), 0);
+  m_Count = 0;
+  m_Total = 0.0;
+  m_Max   = 0.0;
+  m_Last  = -1;
+}
+
+// --------------------------------------------------------------
+
+double LengthHistogram::percentile(double p) const
+{
+  if (m_Count == 0) return 0.0;
+  double target = std::clamp(p, 0.0, 1.0) * m_Count;
+  uint   cumul  = 0;
+  ForIndex(b, numBuckets()) {
+    cumul += m_Counts[b];
+    if (cumul >= target && cumul > 0) {
+      return bucketLength(b);
+    }
+  }
+  return bucketLength(m_Last);
+}
+
+// --------------------------------------------------------------
+
+void LengthHistogram::print(std::ostream& out) const
+{
+  out << sprint("count %u, total %.1f mm, mean %.2f mm, p50 %.1f mm, p90 %.1f mm, p99 %.1f mm, max %.2f mm",
+    m_Count, m_Total, mean(), percentile(0.5), percentile(0.9), percentile(0.99), m_Max) << std::endl;
+  uint peak = 0;
+  ForIndex(b, numBuckets()) {
+    peak = std::max(peak, m_Counts[b]);
+  }
+  ForIndex(b, numBuckets()) {
+    if (m_Counts[b] == 0) continue;
+    int bar = (int)ceil(40.0 * m_Counts[b] / peak);
+    out << sprint("%7.1f mm %8u ", bucketLength(b), m_Counts[b]) << std::string(bar, '#') << std::endl;
+  }
+}
+
+// --------------------------------------------------------------
+
+void LengthHistogram::exportCSV(std::ostream& out) const
+{
+  out << "length_mm,count\n";
+  ForIndex(b, numBuckets()) {
+    if (m_Counts[b] == 0) continue;
+    out << bucketLength(b) << ',' << m_Counts[b] << '\n';
+  }
+}
+
+// --------------------------------------------------------------
+
+void LengthHistogram::exportTex(std::ostream& out, const std::string& y_label, float filter) const
+{
+  out << "\\begin{tikzpicture}\n"
+      << "\\begin{axis}[ybar, xlabel={length (mm)}, ylabel={" << y_label << "}]\n"
+      << "\\addplot coordinates {";
+  ForIndex(b, numBuckets()) {
+    if (m_Counts[b] == 0) continue;
+    if ((double)m_Counts[b] / (double)m_Count <= 1.0 - filter) continue;
+    out << " (" << bucketLength(b) << "," << m_Counts[b] << ")";
+  }
+  out << " };\n"
+      << "\\end{axis}\n"
+      << "\\end{tikzpicture}\n";
+}
+
+// --------------------------------------------------------------
@@ -0,0 +1,84 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+
+#include <iostream>
+#include <vector>
+
+// ----------------------------------------------------------------
+
+// Histogram of lengths (dangling, overlaps) in fixed size buckets.
+// Insertion is O(1), counts are integers so merging histograms of several
+// threads or files is exact. The last bucket gathers all longer lengths.
+class LengthHistogram
+{
+public:
+
+  static constexpr double c_BucketSize = 0.1;  // mm
+  static const int        c_NumBuckets = 1024; // up to ~100 mm
+
+private:
+
+  std::vector<uint> m_Counts;
+  uint              m_Count = 0;
+  double            m_Total = 0.0; // sum of the lengths (mm), not quantized
+  double            m_Max   = 0.0;
+  int               m_Last  = -1;  // last non empty bucket
+
+public:
+
+  LengthHistogram() : m_Counts(c_NumBuckets, 0) {}
+
+  void   add(double len)
+  {
+    int b = std::clamp((int)round(len / c_BucketSize), 0, c_NumBuckets - 1);
+    m_Counts[b]++;
+    m_Count++;
+    m_Total += len;
+    m_Max    = std::max(m_Max, len);
+    m_Last   = std::max(m_Last, b);
+  }
+  void   merge(const LengthHistogram& h);
+  void   clear();
+
+  bool   empty()           const { return m_Count == 0; }
+  uint   count()           const { return m_Count; }
+  double total()           const { return m_Total; }
+  double maxLength()       const { return m_Max; }
+  double mean()            const { return m_Count > 0 ? m_Total / m_Count : 0.0; }
+  int    numBuckets()      const { return m_Last + 1; } // up to the last non empty bucket
+  uint   bucket(int b)     const { return m_Counts[b]; }
+  double bucketLength(int b) const { return b * c_BucketSize; }
+
+  // length (mm, bucket resolution) below which a fraction p of the lengths fall
+  double percentile(double p) const;
+
+  // text summary and buckets
+  void   print(std::ostream& out) const;
+  // buckets as csv (length_mm,count)
+  void   exportCSV(std::ostream& out) const;
+  // pgfplots bar chart, buckets holding at most a fraction 1-filter of the lengths are omitted
+  void   exportTex(std::ostream& out, const std::string& y_label, float filter = 1.0f) const;
+};
+
+// ----------------------------------------------------------------
@@ -24,14 +24,15 @@
 
 // --------------------------------------------------------------
 
-bool   g_IsTravel     = false;
+// motion of the calling thread
+static thread_local t_motion_context *g_Ctx = NULL;
 
-v4d    g_PrevGcodePos = v4d(0);
-v4d    g_CurrentPos   = v4d(0);
-
-double g_Current_EperXYZ = 0.0;
+// --------------------------------------------------------------
 
-double g_FilamentDiamenter = 1.75;
+void motion_bind(t_motion_context *ctx)
+{
+  g_Ctx = ctx;
+}
 
 // --------------------------------------------------------------
 
@@ -45,34 +46,34 @@ void motion_start(double filament_diameter_mm)
 
 void motion_reset(double filament_diameter_mm)
 {
-  g_FilamentDiamenter = filament_diameter_mm;
+  g_Ctx->filament_diameter = filament_diameter_mm;
 
-  g_IsTravel = false;
+  g_Ctx->is_travel = false;
   
-  g_PrevGcodePos = gcode_next_pos();
-  g_CurrentPos = gcode_next_pos();
-  g_Current_EperXYZ = 0.0;
+  g_Ctx->prev_gcode_pos = gcode_next_pos();
+  g_Ctx->current_pos = gcode_next_pos();
+  g_Ctx->current_e_per_xyz = 0.0;
 }
 
 // --------------------------------------------------------------
 
 v4d motion_get_current_pos()
 {
-  return v4d(g_CurrentPos);
+  return v4d(g_Ctx->current_pos);
 }
 
 // --------------------------------------------------------------
 
 double motion_get_current_e_per_xyz() // (ratio) mm / mm
 {
-  return g_Current_EperXYZ;
+  return g_Ctx->current_e_per_xyz;
 }
 
 // --------------------------------------------------------------
 
 static double e_from_volumetric(double e_vol)
 {
-  return e_vol / (pow(g_FilamentDiamenter / 2, 2) * M_PI);
+  return e_vol / (pow(g_Ctx->filament_diameter / 2, 2) * M_PI);
 }
 
 // --------------------------------------------------------------
@@ -85,12 +86,12 @@ static double filament_cross_section(double filament_diameter) {
 
 static double e_per_xyz() // (ratio) mm / mm
 {
-  double ln = length(v3d(gcode_next_pos()) - v3d(g_PrevGcodePos));
+  double ln = length(v3d(gcode_next_pos()) - v3d(g_Ctx->prev_gcode_pos));
   if (ln < 1e-6) {
     return 0.0;
   }
 
-  double delta_e = gcode_next_pos()[3] - g_PrevGcodePos[3];
+  double delta_e = gcode_next_pos()[3] - g_Ctx->prev_gcode_pos[3];
 
   double e = delta_e / ln;
 
@@ -101,15 +102,15 @@ static double e_per_xyz() // (ratio) mm / mm
 
 double motion_get_current_flow() // mm^3 / sec
 {
-  double delta_e = gcode_next_pos()[3] - g_PrevGcodePos[3];
+  double delta_e = gcode_next_pos()[3] - g_Ctx->prev_gcode_pos[3];
 
-  double vl = delta_e * filament_cross_section(g_FilamentDiamenter);
+  double vl = delta_e * filament_cross_section(g_Ctx->filament_diameter);
 
   if (gcode_speed() < 1) {
     return 0.0;
   }
 
-  double ln = length(v3d(gcode_next_pos()) - v3d(g_PrevGcodePos));
+  double ln = length(v3d(gcode_next_pos()) - v3d(g_Ctx->prev_gcode_pos));
   double tm = ln / gcode_speed();
   if (tm < 1e-6f) {
     return 0.0;
@@ -122,7 +123,27 @@ double motion_get_current_flow() // mm^3 / sec
 
 bool motion_is_travel()
 {
-  return g_IsTravel;
+  return g_Ctx->is_travel;
+}
+
+// --------------------------------------------------------------
+
+void motion_save(t_motion_state& _state)
+{
+  _state.travel         = g_Ctx->is_travel;
+  _state.prev_gcode_pos = g_Ctx->prev_gcode_pos;
+  _state.current_pos    = g_Ctx->current_pos;
+  _state.e_per_xyz      = g_Ctx->current_e_per_xyz;
+}
+
+// --------------------------------------------------------------
+
+void motion_restore(const t_motion_state& state)
+{
+  g_Ctx->is_travel         = state.travel;
+  g_Ctx->prev_gcode_pos    = state.prev_gcode_pos;
+  g_Ctx->current_pos       = state.current_pos;
+  g_Ctx->current_e_per_xyz = state.e_per_xyz;
 }
 
 // --------------------------------------------------------------
@@ -131,15 +152,15 @@ double motion_step(double delta_ms, bool& _done)
 {
   _done           = false;
   bool advance    = false;
-  v3d delta_pos   = v3d(gcode_next_pos()) - v3d(g_CurrentPos);
+  v3d delta_pos   = v3d(gcode_next_pos()) - v3d(g_Ctx->current_pos);
   double len      = length(delta_pos);
-  double delta_e  = gcode_next_pos()[3] - g_CurrentPos[3];
+  double delta_e  = gcode_next_pos()[3] - g_Ctx->current_pos[3];
   double step_e   = 0.0;
   v3d    step_pos = 0.0;
 
-  g_Current_EperXYZ = e_per_xyz();
+  g_Ctx->current_e_per_xyz = e_per_xyz();
 
-  g_IsTravel = abs(delta_e) < 1e-6;
+  g_Ctx->is_travel = abs(delta_e) < 1e-6;
 
   double len_step = delta_ms * gcode_speed() / 1000.0;
   if (abs(len) < 1e-6 && abs(delta_e) > 1e-6) { // E motion only - do not overshot!
@@ -172,7 +193,7 @@ double motion_step(double delta_ms, bool& _done)
   std::cout << Console::green << "step_pos: " << step_pos
             << Console::magenta << " step_e: " << step_e
             << Console::yellow << " delta_e: " << delta_e
-            << Console::cyan << " next_e: " << gcode_next_pos()[3] << " current_e: " << g_CurrentPos[3]
+            << Console::cyan << " next_e: " << gcode_next_pos()[3] << " current_e: " << g_Ctx->current_pos[3]
             << Console::gray << std::endl;
 #endif
 
@@ -180,15 +201,47 @@ double motion_step(double delta_ms, bool& _done)
   if (advance) { // reached current gcode position, advance!
     //std::cerr << 'a';
     // snap to exact pos
-    g_CurrentPos   = gcode_next_pos();
-    g_PrevGcodePos = gcode_next_pos();
-    _done          = !gcode_advance();
+    g_Ctx->current_pos    = gcode_next_pos();
+    g_Ctx->prev_gcode_pos = gcode_next_pos();
+    _done                 = !gcode_advance();
   } else {
     //std::cerr << '_';
-    g_CurrentPos += v4d(step_pos, step_e);
+    g_Ctx->current_pos += v4d(step_pos, step_e);
   }
 
   return delta_ms;
 }
 
 // --------------------------------------------------------------
+
+void motion_sample(double delta_ms, t_motion_sample& _s)
+{
+  _s.delta_ms  = motion_step(delta_ms, _s.done);
+  _s.error     = gcode_error();
+  _s.pos       = g_Ctx->current_pos;
+  _s.travel    = g_Ctx->is_travel;
+  _s.e_per_xyz = g_Ctx->current_e_per_xyz;
+  _s.flow      = motion_get_current_flow();
+  _s.speed     = gcode_speed();
+  _s.extruder  = gcode_current_extruder();
+  _s.role      = gcode_role();
+  _s.line      = gcode_line();
+}
+
+// --------------------------------------------------------------
+
+bool motion_simulation_step(double mm_step, const t_sample_func& sample)
+{
+  double step_ms = mm_step / (gcode_speed() / 1000.0);
+  while (step_ms > 0.0f) {
+    t_motion_sample s;
+    motion_sample(step_ms, s);
+    step_ms -= s.delta_ms;
+    if (sample(s, !(step_ms > 0.0f))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// --------------------------------------------------------------
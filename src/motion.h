@@ -23,6 +23,22 @@
 
 #include <LibSL.h>
 
+#include <functional>
+
+// motion state, one per simulation: the motion_ functions work on the
+// context bound to the calling thread (see motion_bind), as the interpreter
+struct t_motion_context
+{
+  bool   is_travel = false;
+  v4d    prev_gcode_pos = v4d(0.0);
+  v4d    current_pos = v4d(0.0);
+  double current_e_per_xyz = 0.0;
+  double filament_diameter = 1.75;
+};
+
+// binds a motion context to the calling thread
+void motion_bind(t_motion_context *ctx);
+
 // start motion, assumes gcode is ready (gcode_start has been called)
 void motion_start(double filament_diameter_mm);
 
@@ -44,3 +60,47 @@ double motion_get_current_e_per_xyz();
 
 // returns true if motion is a travel
 bool motion_is_travel();
+
+// motion state, saved alongside the gcode interpreter state
+typedef struct
+{
+  bool   travel;
+  v4d    prev_gcode_pos;
+  v4d    current_pos;
+  double e_per_xyz;
+} t_motion_state;
+
+// saves the motion state
+void motion_save(t_motion_state& _state);
+
+// restores a previously saved motion state (gcode_restore has to be called as well)
+void motion_restore(const t_motion_state& state);
+
+// result of a motion step, everything the deposition needs to know
+// (lets the deposition run on another thread than the motion)
+typedef struct
+{
+  double delta_ms;  // consumed time
+  bool   done;      // end of gcode
+  bool   error;     // gcode error
+  v4d    pos;       // motion_get_current_pos
+  bool   travel;    // motion_is_travel
+  double e_per_xyz; // motion_get_current_e_per_xyz
+  double flow;      // motion_get_current_flow
+  double speed;     // gcode_speed
+  int    extruder;  // gcode_current_extruder
+  int    role;      // gcode_role
+  int    line;      // gcode_line
+} t_motion_sample;
+
+// performs the next motion step (see motion_step) and returns its result
+void motion_sample(double delta_ms, t_motion_sample& _s);
+
+// called for each sample of a simulation step, in order, returns true to stop
+// end_of_step is true for the last sample of the step
+typedef std::function<bool(const t_motion_sample& s, bool end_of_step)> t_sample_func;
+
+// samples one simulation step of mm_step millimeters at the current speed
+// (the stepping of the viewer, the pipeline and the comparisons)
+// returns true once sample returned true
+bool motion_simulation_step(double mm_step, const t_sample_func& sample);
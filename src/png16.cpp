@@ -0,0 +1,126 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "png16.h"
+
+#include <fstream>
+
+#include <zlib.h>
+
+// --------------------------------------------------------------
+
+static void push_u32(std::vector<uchar>& v, uint x)
+{
+  v.push_back((uchar)(x >> 24)); v.push_back((uchar)(x >> 16));
+  v.push_back((uchar)(x >>  8)); v.push_back((uchar)(x      ));
+}
+
+static void write_chunk(std::ofstream& f, const char *type, const std::vector<uchar>& data)
+{
+  std::vector<uchar> chunk;
+  push_u32(chunk, (uint)data.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  push_u32(chunk, (uint)crc32(0L, &chunk[4], (uInt)(chunk.size() - 4)));
+  f.write((const char*)chunk.data(), chunk.size());
+}
+
+// png of unfiltered scanlines (rows top to bottom, bpr bytes each), rows are
+// written with the 'up' filter (difference with the row above) which suits
+// smooth height fields and renderings, and deflated with zlib
+static bool write_png(const std::string& fname, int w, int h, uchar bit_depth, uchar color_type, const std::vector<uchar>& rows, size_t bpr)
+{
+  std::ofstream f(fname, std::ios::binary);
+  if (!f) return false;
+  const uchar sig[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  f.write((const char*)sig, 8);
+  // header
+  std::vector<uchar> ihdr;
+  push_u32(ihdr, (uint)w);
+  push_u32(ihdr, (uint)h);
+  ihdr.push_back(bit_depth);
+  ihdr.push_back(color_type);
+  ihdr.push_back(0); ihdr.push_back(0); ihdr.push_back(0);
+  write_chunk(f, "IHDR", ihdr);
+  // filtered scanlines
+  std::vector<uchar> raw((size_t)h * (1 + bpr));
+  ForIndex(j, h) {
+    uchar       *dst  = &raw[(size_t)j * (1 + bpr)];
+    const uchar *row  = &rows[(size_t)j * bpr];
+    dst[0] = (j == 0) ? 0 : 2; // none on the first row, up on the others
+    if (j == 0) {
+      std::copy(row, row + bpr, dst + 1);
+    } else {
+      const uchar *above = row - bpr;
+      for (size_t n = 0; n < bpr; n++) {
+        dst[1 + n] = (uchar)(row[n] - above[n]);
+      }
+    }
+  }
+  // zlib
+  uLongf             zsize = compressBound((uLong)raw.size());
+  std::vector<uchar> z(zsize);
+  if (compress2(z.data(), &zsize, raw.data(), (uLong)raw.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+    return false;
+  }
+  z.resize(zsize);
+  write_chunk(f, "IDAT", z);
+  write_chunk(f, "IEND", std::vector<uchar>());
+  return (bool)f;
+}
+
+// --------------------------------------------------------------
+
+bool write_png16(const std::string& fname, const std::vector<ushort>& px, int w, int h)
+{
+  // big endian samples, png rows go top to bottom
+  size_t bpr = 2 * (size_t)w;
+  std::vector<uchar> rows((size_t)h * bpr);
+  ForIndex(j, h) {
+    uchar *dst = &rows[(size_t)(h - 1 - j) * bpr];
+    ForIndex(i, w) {
+      ushort v = px[i + (size_t)j * w];
+      dst[2 * i    ] = (uchar)(v >> 8);
+      dst[2 * i + 1] = (uchar)(v & 255);
+    }
+  }
+  return write_png(fname, w, h, 16, 0 /*grayscale*/, rows, bpr);
+}
+
+// --------------------------------------------------------------
+
+bool write_png_rgb(const std::string& fname, const std::vector<uchar>& px, int w, int h)
+{
+  // alpha dropped, png rows go top to bottom
+  size_t bpr = 3 * (size_t)w;
+  std::vector<uchar> rows((size_t)h * bpr);
+  ForIndex(j, h) {
+    uchar *dst = &rows[(size_t)(h - 1 - j) * bpr];
+    ForIndex(i, w) {
+      const uchar *c = &px[4 * (i + (size_t)j * w)];
+      dst[3 * i    ] = c[0];
+      dst[3 * i + 1] = c[1];
+      dst[3 * i + 2] = c[2];
+    }
+  }
+  return write_png(fname, w, h, 8, 2 /*truecolor*/, rows, bpr);
+}
+
+// --------------------------------------------------------------
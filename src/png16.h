@@ -0,0 +1,33 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+
+#include <string>
+#include <vector>
+
+// writes a 16 bits grayscale png, px holds w x h samples with row 0 at the bottom
+// returns false if the file cannot be written
+bool write_png16(const std::string& fname, const std::vector<ushort>& px, int w, int h);
+// writes an 8 bits RGB png, px holds w x h RGBA pixels (alpha is dropped) with
+// row 0 at the bottom, as read back with glReadPixels
+bool write_png_rgb(const std::string& fname, const std::vector<uchar>& px, int w, int h);
@@ -0,0 +1,112 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cassert>
+
+// ----------------------------------------------------------------
+
+// Growable FIFO stored in a single contiguous array.
+// Capacity is always a power of two so that wrapping is a mask.
+// Memory is never released by pop/clear, so once the queue reached
+// its working size there is no allocator traffic anymore.
+template <typename T>
+class RingBuffer
+{
+private:
+
+  std::vector<T> m_Data;
+  size_t         m_Head = 0; // index of front element
+  size_t         m_Size = 0; // number of stored elements
+
+  size_t mask() const { return m_Data.size() - 1; }
+
+  void grow()
+  {
+    size_t cap = m_Data.empty() ? 64 : m_Data.size() * 2;
+    std::vector<T> data(cap);
+    // unwrap in order
+    for (size_t i = 0; i < m_Size; i++) {
+      data[i] = m_Data[(m_Head + i) & mask()];
+    }
+    m_Data.swap(data);
+    m_Head = 0;
+  }
+
+public:
+
+  RingBuffer() {}
+
+  size_t size()     const { return m_Size; }
+  bool   empty()    const { return m_Size == 0; }
+  size_t capacity() const { return m_Data.size(); }
+
+  void clear()
+  {
+    m_Head = 0;
+    m_Size = 0;
+  }
+
+  void push_back(const T& v)
+  {
+    if (m_Size == m_Data.size()) {
+      grow();
+    }
+    m_Data[(m_Head + m_Size) & mask()] = v;
+    m_Size++;
+  }
+
+  // i-th element from the front
+  const T& operator[](size_t i) const { assert(i < m_Size); return m_Data[(m_Head + i) & mask()]; }
+  T&       operator[](size_t i)       { assert(i < m_Size); return m_Data[(m_Head + i) & mask()]; }
+
+  const T& front() const { return (*this)[0]; }
+  const T& back()  const { return (*this)[m_Size - 1]; }
+
+  // removes the n first elements
+  void pop_front(size_t n = 1)
+  {
+    assert(n <= m_Size);
+    m_Size -= n;
+    m_Head  = m_Size == 0 ? 0 : ((m_Head + n) & mask());
+  }
+
+  // returns the n first elements as (at most) two contiguous spans
+  // the second span is empty unless the range wraps around the end of storage
+  void spans(size_t n, const T*& a, size_t& na, const T*& b, size_t& nb) const
+  {
+    assert(n <= m_Size);
+    if (n == 0) {
+      a = b = nullptr; na = nb = 0;
+      return;
+    }
+    na = std::min(n, m_Data.size() - m_Head);
+    nb = n - na;
+    a  = &m_Data[m_Head];
+    b  = nb > 0 ? &m_Data[0] : nullptr;
+  }
+
+};
+
+// ----------------------------------------------------------------
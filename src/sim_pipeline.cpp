@@ -0,0 +1,142 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "sim_pipeline.h"
+#include "gcode.h"
+#include "spsc_queue.h"
+
+#include <thread>
+
+// --------------------------------------------------------------
+
+const int c_PipelineQueueSize = 4096;
+
+// --------------------------------------------------------------
+
+void sim_pipeline_decode(const t_gcode_source& gcode, const t_gcode_state& state, const std::set<int>& extruders,
+                         const std::vector<t_gcode_feed*>& feeds)
+{
+  // the decoder thread runs its own interpreter
+  t_gcode_context ctx;
+  gcode_bind(&ctx);
+  gcode_start(gcode);
+  gcode_set_used_extruders(extruders);
+  gcode_restore(state);
+  std::vector<bool> open(feeds.size(), true);
+  int num_open = (int)feeds.size();
+  t_gcode_move m;
+  do {
+    bool more = gcode_advance();
+    gcode_move(more, m);
+    ForIndex(f, feeds.size()) {
+      if (open[f] && !feeds[f]->push(m)) {
+        open[f] = false; // closed downstream
+        num_open--;
+      }
+    }
+  } while (num_open > 0 && m.more && !m.error);
+  for (auto f : feeds) {
+    f->close();
+  }
+}
+
+// --------------------------------------------------------------
+
+static void motion_stage(const t_gcode_state& gstate, const t_motion_state& mstate, double filament_diameter, double mm_step,
+                         t_gcode_feed& _moves, SpscQueue<t_pipeline_sample>& _samples)
+{
+  // the motion thread interprets the decoded moves with its own contexts
+  t_gcode_context  gctx;
+  t_motion_context mctx;
+  gcode_bind(&gctx);
+  motion_bind(&mctx);
+  gcode_feed_start(&_moves, gstate);
+  motion_reset(filament_diameter);
+  motion_restore(mstate);
+  // same steps as step_simulation
+  auto push = [&_samples](const t_motion_sample& m, bool end_of_step) {
+    t_pipeline_sample s;
+    s.motion      = m;
+    s.end_of_step = end_of_step;
+    if (end_of_step) {
+      gcode_save(s.gcode_state);
+      motion_save(s.motion_state);
+    }
+    return !_samples.push(s) || m.done || m.error;
+  };
+  while (!motion_simulation_step(mm_step, push)) { }
+  _samples.close();
+  _moves.close(); // stops decoding if we stopped early
+  gcode_feed_stop();
+}
+
+// --------------------------------------------------------------
+
+void SimPipeline::start(const t_gcode_source& gcode, double filament_diameter, double mm_step)
+{
+  stop();
+  gcode_save(m_GCodeState);
+  motion_save(m_MotionState);
+  m_Extruders = gcode_used_extruders();
+  m_Moves     = std::unique_ptr<t_gcode_feed>(new t_gcode_feed(c_PipelineQueueSize));
+  m_Samples   = std::unique_ptr<SpscQueue<t_pipeline_sample> >(new SpscQueue<t_pipeline_sample>(c_PipelineQueueSize));
+  m_Feeds     = std::vector<t_gcode_feed*>(1, m_Moves.get());
+  m_Decoder   = std::thread(sim_pipeline_decode, std::cref(gcode), std::cref(m_GCodeState), std::cref(m_Extruders), std::cref(m_Feeds));
+  m_Motion    = std::thread(motion_stage, std::cref(m_GCodeState), std::cref(m_MotionState), filament_diameter, mm_step,
+                            std::ref(*m_Moves), std::ref(*m_Samples));
+  m_Running   = true;
+  m_Ended     = false;
+}
+
+// --------------------------------------------------------------
+
+bool SimPipeline::pop(t_pipeline_sample& _s)
+{
+  if (!m_Running || !m_Samples->pop(_s)) return false;
+  m_Ended = _s.motion.done || _s.motion.error;
+  return true;
+}
+
+// --------------------------------------------------------------
+
+void SimPipeline::stop()
+{
+  if (!m_Running) return;
+  // stops upstream stages, they may be waiting on a full queue
+  m_Samples->close();
+  m_Motion.join();
+  m_Decoder.join();
+  m_Running = false;
+}
+
+// --------------------------------------------------------------
+
+void sim_pipeline_run(const t_gcode_source& gcode, double filament_diameter, double mm_step, const t_deposit_func& deposit)
+{
+  SimPipeline pipeline;
+  pipeline.start(gcode, filament_diameter, mm_step);
+  t_pipeline_sample s;
+  while (pipeline.pop(s)) {
+    if (deposit(s.motion, s.end_of_step)) break;
+  }
+  pipeline.stop();
+}
+
+// --------------------------------------------------------------
@@ -0,0 +1,108 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "gcode.h"
+#include "motion.h"
+
+// ----------------------------------------------------------------
+
+// Simulation as a three stage pipeline, each stage on its own thread:
+//   decode (gcode parsing) -> motion (stepping) -> deposition (calling thread)
+// Stages are connected by bounded single producer single consumer queues,
+// so decoding and motion run ahead of the deposition. Only the deposition
+// stage touches the printer state (height field, stats, beads).
+
+// sample produced by the motion stage
+typedef struct {
+  t_motion_sample motion;
+  bool            end_of_step;  // last sample of a simulation step
+  // at the end of a step only: interpreter and motion states after the step,
+  // a replay from there is identical (see checkpoint_record)
+  t_gcode_state   gcode_state;
+  t_motion_state  motion_state;
+} t_pipeline_sample;
+
+// Decode and motion stages running ahead of a consumer popping samples at
+// its own pace, e.g. a frame budget worth of samples per frame in the viewer.
+// Starts from the current gcode and motion states of the calling thread
+// (which are not advanced), the stages run their own contexts.
+class SimPipeline
+{
+private:
+
+  std::unique_ptr<t_gcode_feed>                 m_Moves;
+  std::unique_ptr<SpscQueue<t_pipeline_sample> > m_Samples;
+  std::vector<t_gcode_feed*>                    m_Feeds;
+  t_gcode_state                                 m_GCodeState;
+  t_motion_state                                m_MotionState;
+  std::set<int>                                 m_Extruders;
+  std::thread                                   m_Decoder;
+  std::thread                                   m_Motion;
+  bool                                          m_Running = false;
+  bool                                          m_Ended = false;
+
+public:
+
+  SimPipeline() {}
+  ~SimPipeline() { stop(); }
+
+  // starts the stages, samples are steps of mm_step millimeters
+  void start(const t_gcode_source& gcode, double filament_diameter, double mm_step);
+
+  // next sample, waits for it if needed
+  // returns false once the last sample was popped (see ended), or if the
+  // stages were stopped
+  bool pop(t_pipeline_sample& _s);
+
+  // true once the last sample (end of the gcode, or error) was popped
+  bool ended() const { return m_Ended; }
+
+  // stops the stages, pending samples are dropped
+  void stop();
+
+  bool running() const { return m_Running; }
+};
+
+// called for each motion sample, in order, returns true to stop
+// end_of_step is true for the last sample of a simulation step
+typedef t_sample_func t_deposit_func;
+
+// simulates gcode from the current gcode and motion states of the calling
+// thread (which are not advanced), samples are steps of mm_step millimeters
+// returns once deposit returns true or the gcode ends
+void sim_pipeline_run(const t_gcode_source& gcode, double filament_diameter, double mm_step, const t_deposit_func& deposit);
+
+// decode stage alone (thread entry, binds its own interpreter):
+// interprets gcode from state and pushes each move to all feeds
+// (several simulations can consume a single decode, see gcode_feed_start)
+// extruders are the extruders used so far (see gcode_set_used_extruders)
+// a feed closed by its consumer is skipped, returns once all are closed or the gcode ends
+void sim_pipeline_decode(const t_gcode_source& gcode, const t_gcode_state& state, const std::set<int>& extruders,
+                         const std::vector<t_gcode_feed*>& feeds);
+
+// ----------------------------------------------------------------
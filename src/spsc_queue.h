@@ -0,0 +1,143 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ----------------------------------------------------------------
+
+// Bounded single producer, single consumer queue.
+// Capacity is a power of two so that wrapping is a mask. Push (resp. pop)
+// waits while the queue is full (resp. empty) unless the queue is closed:
+// it spins a little, then blocks until the other side makes progress.
+// Head and tail are on separate cache lines so that the producer and the
+// consumer do not contend.
+template <typename T>
+class SpscQueue
+{
+private:
+
+  std::vector<T>                  m_Data;
+  size_t                          m_Mask = 0;
+  alignas(64) std::atomic<size_t> m_Head; // next element to pop
+  alignas(64) std::atomic<size_t> m_Tail; // next element to push
+  alignas(64) std::atomic<bool>   m_Closed;
+  alignas(64) std::atomic<int>    m_Waiting; // sides blocked on m_Wake
+  std::mutex                      m_Mutex;
+  std::condition_variable         m_Wake;
+
+  // waits until ready() holds: yields a few times, then blocks, a stage
+  // waiting on a much slower one should not keep a core busy
+  template <typename F>
+  void wait(const F& ready)
+  {
+    for (int spins = 0; spins < 64; spins++) {
+      if (ready()) return;
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_Waiting.fetch_add(1);
+    // pairs with the fence in wake: either the other side sees us
+    // waiting, or we see its progress
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_Wake.wait(lock, ready);
+    m_Waiting.fetch_sub(1);
+  }
+
+  // wakes up the other side if it blocked
+  void wake()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_Waiting.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Wake.notify_all();
+    }
+  }
+
+public:
+
+  // capacity is rounded up to a power of two
+  SpscQueue(size_t capacity = 4096) : m_Head(0), m_Tail(0), m_Closed(false), m_Waiting(0)
+  {
+    size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    m_Data.resize(cap);
+    m_Mask = cap - 1;
+  }
+
+  // producer side, returns false if the queue was closed
+  bool push(const T& v)
+  {
+    size_t t = m_Tail.load(std::memory_order_relaxed);
+    wait([&]() {
+      return t - m_Head.load(std::memory_order_acquire) <= m_Mask || m_Closed.load(std::memory_order_acquire);
+    });
+    if (t - m_Head.load(std::memory_order_acquire) > m_Mask) return false; // closed
+    m_Data[t & m_Mask] = v;
+    m_Tail.store(t + 1, std::memory_order_release);
+    wake();
+    return true;
+  }
+
+  // consumer side, returns false if the queue is closed and empty
+  bool pop(T& _v)
+  {
+    size_t h = m_Head.load(std::memory_order_relaxed);
+    wait([&]() {
+      return m_Tail.load(std::memory_order_acquire) != h || m_Closed.load(std::memory_order_acquire);
+    });
+    // elements pushed before closing are still delivered
+    if (m_Tail.load(std::memory_order_acquire) == h) return false; // closed and empty
+    _v = m_Data[h & m_Mask];
+    m_Head.store(h + 1, std::memory_order_release);
+    wake();
+    return true;
+  }
+
+  // consumer side, does not wait: returns false if the queue is empty
+  // (for now, or for good if closed: see closed)
+  bool try_pop(T& _v)
+  {
+    size_t h = m_Head.load(std::memory_order_relaxed);
+    if (m_Tail.load(std::memory_order_acquire) == h) return false;
+    _v = m_Data[h & m_Mask];
+    m_Head.store(h + 1, std::memory_order_release);
+    wake();
+    return true;
+  }
+
+  // wakes up both sides: pending pushes fail, pops fail once empty
+  void close()
+  {
+    m_Closed.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Wake.notify_all();
+  }
+
+  bool closed() const { return m_Closed.load(std::memory_order_acquire); }
+};
+
+// ----------------------------------------------------------------
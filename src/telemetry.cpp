@@ -0,0 +1,207 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "telemetry.h"
+
+#include <fstream>
+
+// --------------------------------------------------------------
+
+const double c_TelemetryTickMs = 100.0; // simulated time per sample of level 0
+
+TelemetrySeries g_TelemetrySeries[Telemetry_Num];
+
+// writer side
+double          g_TelemetryStartMs   = 0.0; // simulated time of the first tick
+double          g_TelemetryTickTime  = 0.0; // simulated time accumulated in the current tick
+double          g_TelemetryTickFlow  = 0.0; // flow x time
+double          g_TelemetryTickSpeed = 0.0; // speed x time
+t_time          g_TelemetryTickWall  = 0;   // wall clock at the start of the current tick
+
+std::atomic<double> g_TelemetryOrigin(0.0); // published start time, for readers
+
+// --------------------------------------------------------------
+
+void TelemetrySeries::clear()
+{
+  ForIndex(l, c_Levels) {
+    m_Levels[l].count.store(0, std::memory_order_release);
+    m_Levels[l].sum = 0.0;
+    m_Levels[l].num = 0;
+  }
+}
+
+// --------------------------------------------------------------
+
+void TelemetrySeries::push(float v)
+{
+  ForIndex(l, c_Levels) {
+    t_level& lvl = m_Levels[l];
+    uint64_t n   = lvl.count.load(std::memory_order_relaxed);
+    lvl.samples[n & (c_Capacity - 1)].store(v, std::memory_order_relaxed);
+    lvl.count.store(n + 1, std::memory_order_release);
+    if (l + 1 == c_Levels) break;
+    // accumulate towards the next level
+    t_level& next = m_Levels[l + 1];
+    next.sum += v;
+    next.num++;
+    if (next.num < c_Factor) break;
+    v = (float)(next.sum / (double)next.num);
+    next.sum = 0.0;
+    next.num = 0;
+  }
+}
+
+// --------------------------------------------------------------
+
+uint64_t TelemetrySeries::read(int level, int max_n, std::vector<float>& _samples) const
+{
+  const t_level& lvl = m_Levels[level];
+  uint64_t end = lvl.count.load(std::memory_order_acquire);
+  uint64_t num = std::min<uint64_t>(end, (uint64_t)std::min(max_n, c_Capacity));
+  uint64_t beg = end - num;
+  _samples.resize((size_t)num);
+  ForIndex(i, (int)num) {
+    _samples[i] = lvl.samples[(beg + i) & (c_Capacity - 1)].load(std::memory_order_relaxed);
+  }
+  // samples written meanwhile may have overwritten the oldest copied ones
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t now = lvl.count.load(std::memory_order_relaxed);
+  if (now < end) {
+    // cleared during the copy
+    _samples.clear();
+    return 0;
+  }
+  if (now > c_Capacity && now - c_Capacity > beg) {
+    uint64_t drop = std::min<uint64_t>(num, now - c_Capacity - beg);
+    _samples.erase(_samples.begin(), _samples.begin() + (size_t)drop);
+    beg += drop;
+  }
+  return beg;
+}
+
+// --------------------------------------------------------------
+
+void telemetry_clear(double start_ms)
+{
+  ForIndex(s, Telemetry_Num) {
+    g_TelemetrySeries[s].clear();
+  }
+  g_TelemetryStartMs   = start_ms;
+  g_TelemetryTickTime  = 0.0;
+  g_TelemetryTickFlow  = 0.0;
+  g_TelemetryTickSpeed = 0.0;
+  g_TelemetryTickWall  = milliseconds();
+  g_TelemetryOrigin.store(start_ms, std::memory_order_release);
+}
+
+// --------------------------------------------------------------
+
+void telemetry_step(double delta_ms, double flow, double speed)
+{
+  while (delta_ms > 0.0) {
+    double dt = std::min(delta_ms, c_TelemetryTickMs - g_TelemetryTickTime);
+    g_TelemetryTickTime  += dt;
+    g_TelemetryTickFlow  += flow  * dt;
+    g_TelemetryTickSpeed += speed * dt;
+    delta_ms             -= dt;
+    if (g_TelemetryTickTime < c_TelemetryTickMs) break;
+    // tick completed
+    t_time now  = milliseconds();
+    double wall = (double)(now - g_TelemetryTickWall);
+    g_TelemetrySeries[Telemetry_Flow ].push((float)(g_TelemetryTickFlow  / c_TelemetryTickMs));
+    g_TelemetrySeries[Telemetry_Speed].push((float)(g_TelemetryTickSpeed / c_TelemetryTickMs));
+    // several ticks can complete within a millisecond, count them as one
+    g_TelemetrySeries[Telemetry_Rate ].push((float)(c_TelemetryTickMs / std::max(1.0, wall)));
+    g_TelemetryTickTime  = 0.0;
+    g_TelemetryTickFlow  = 0.0;
+    g_TelemetryTickSpeed = 0.0;
+    g_TelemetryTickWall  = now;
+  }
+}
+
+// --------------------------------------------------------------
+
+double telemetry_sample_ms(int level)
+{
+  double ms = c_TelemetryTickMs;
+  ForIndex(l, level) {
+    ms *= TelemetrySeries::c_Factor;
+  }
+  return ms;
+}
+
+// --------------------------------------------------------------
+
+int telemetry_full_level()
+{
+  ForIndex(l, TelemetrySeries::c_Levels) {
+    if (g_TelemetrySeries[Telemetry_Flow].count(l) <= TelemetrySeries::c_Capacity) {
+      return l;
+    }
+  }
+  return TelemetrySeries::c_Levels - 1;
+}
+
+// --------------------------------------------------------------
+
+double telemetry_read(e_Telemetry s, int level, int max_n, std::vector<float>& _samples)
+{
+  double   origin = g_TelemetryOrigin.load(std::memory_order_acquire);
+  uint64_t first  = g_TelemetrySeries[s].read(level, max_n, _samples);
+  return origin + (double)first * telemetry_sample_ms(level);
+}
+
+// --------------------------------------------------------------
+
+bool telemetry_export_csv(const std::string& fname, int level)
+{
+  if (level < 0) {
+    level = telemetry_full_level();
+  }
+  std::ofstream f(fname);
+  if (!f) {
+    std::cerr << Console::red << "Unable to write " << fname << Console::gray << std::endl;
+    return false;
+  }
+  // series are read one after the other, keep their common range
+  std::vector<float> samples[Telemetry_Num];
+  double             start[Telemetry_Num];
+  ForIndex(s, Telemetry_Num) {
+    start[s] = telemetry_read((e_Telemetry)s, level, TelemetrySeries::c_Capacity, samples[s]);
+  }
+  double dt  = telemetry_sample_ms(level);
+  double beg = std::max(start[0], std::max(start[1], start[2]));
+  double end = 1e30;
+  ForIndex(s, Telemetry_Num) {
+    end = std::min(end, start[s] + samples[s].size() * dt);
+  }
+  f << "time_s,flow_mm3_s,speed_mm_s,sim_rate\n";
+  for (double t = beg; t + dt * 0.5 < end; t += dt) {
+    f << t / 1000.0;
+    ForIndex(s, Telemetry_Num) {
+      f << ',' << samples[s][(size_t)((t - start[s]) / dt + 0.5)];
+    }
+    f << '\n';
+  }
+  return true;
+}
+
+// --------------------------------------------------------------
@@ -0,0 +1,100 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <LibSL.h>
+
+#include <atomic>
+#include <cstdint>
+
+// ----------------------------------------------------------------
+
+// Time series of a simulation measure, one value per tick of simulated time.
+// Several resolutions are kept: level l averages c_Factor^l ticks, so with
+// a fixed capacity the coarse levels still cover the whole print.
+// Storage never grows. There is a single writer (the simulation loop),
+// readers (UI, export) do not lock: they copy a range and drop the samples
+// the writer may have overwritten during the copy.
+class TelemetrySeries
+{
+public:
+
+  static const int c_Capacity = 1024; // samples per level, power of two
+  static const int c_Levels   = 4;
+  static const int c_Factor   = 8;    // ticks per sample ratio between levels
+
+private:
+
+  typedef struct {
+    std::atomic<float>    samples[c_Capacity];
+    std::atomic<uint64_t> count; // samples written since clear
+    double                sum;   // writer side, pending average of the level below
+    int                   num;
+  } t_level;
+
+  t_level m_Levels[c_Levels];
+
+public:
+
+  TelemetrySeries() { clear(); }
+
+  // writer side
+  void clear();
+  void push(float v);
+
+  // number of samples written to a level since clear
+  uint64_t count(int level) const { return m_Levels[level].count.load(std::memory_order_acquire); }
+
+  // copies the (at most max_n) most recent samples of a level, oldest first
+  // returns the index of the first copied sample
+  uint64_t read(int level, int max_n, std::vector<float>& _samples) const;
+};
+
+// ----------------------------------------------------------------
+
+typedef enum {
+  Telemetry_Flow  = 0, // mm^3/sec
+  Telemetry_Speed = 1, // mm/sec
+  Telemetry_Rate  = 2, // simulated time / wall clock time
+  Telemetry_Num   = 3
+} e_Telemetry;
+
+// clears all series, the simulation restarts at start_ms (simulated time)
+void telemetry_clear(double start_ms);
+
+// accounts for delta_ms of simulated time at a given flow and speed,
+// pushes one sample per completed tick
+void telemetry_step(double delta_ms, double flow, double speed);
+
+// simulated time covered by one sample of a level (ms)
+double telemetry_sample_ms(int level);
+
+// finest level covering the whole simulation so far
+int telemetry_full_level();
+
+// copies the (at most max_n) most recent samples of a series
+// returns the simulated time of the first sample (ms)
+double telemetry_read(e_Telemetry s, int level, int max_n, std::vector<float>& _samples);
+
+// writes all series at a given level as CSV (-1: finest level covering everything)
+bool telemetry_export_csv(const std::string& fname, int level = -1);
+
+// ----------------------------------------------------------------
@@ -0,0 +1,88 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Checks disk_squashed_radius (table) and disk_squashed_radius_newton
+// against the area they have to preserve, and their edge cases.
+// Built as the test_squash target and run by ctest (test "squash"), or
+// standalone: g++ -std=c++17 -O2 test_squash.cpp -o test_squash
+// With SQUASH_BENCH defined (test_squash_bench target, not run by ctest),
+// also times them against the reference bisection.
+
+#include <cstdio>
+#include <chrono>
+
+#include "sphere_squash.h"
+
+#ifdef SQUASH_BENCH
+static void bench(int N)
+{
+  double sum = 0.0;
+  auto time = [&](const char *name, double(*f)(double, double)) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int k = 0; k < N * 10; k++) {
+      double r = 0.2 + 0.0001 * (k % 100);
+      sum += f(r, r * (0.3 + 0.7 * (k % 997) / 997.0));
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    printf("%-10s %.1f ns/call\n", name, std::chrono::duration<double, std::nano>(t1 - t0).count() / (N * 10));
+  };
+  time("table",     disk_squashed_radius);
+  time("newton",    disk_squashed_radius_newton);
+  time("bisection", disk_squashed_radius_bisection);
+  printf("(%g)\n", sum);
+}
+#endif
+
+int main()
+{
+  const double radii[] = { 0.05, 0.1, 0.2, 0.4, 0.8, 1.6 };
+  const int    N       = 20000;
+
+  double max_err_table  = 0.0;
+  double max_err_newton = 0.0;
+  double max_err_bisect = 0.0;
+  for (double r : radii) {
+    for (int k = 0; k <= N; k++) {
+      double x = 0.08 + (1.0 - 0.08) * k / (double)N; // below, rs is capped to 10 r
+      double h = x * r;
+      double target = disk_area(r);
+      max_err_table  = std::max(max_err_table,  fabs(disk_clipped_area(disk_squashed_radius(r, h), h) - target) / target);
+      max_err_newton = std::max(max_err_newton, fabs(disk_clipped_area(disk_squashed_radius_newton(r, h), h) - target) / target);
+      max_err_bisect = std::max(max_err_bisect, fabs(disk_clipped_area(disk_squashed_radius_bisection(r, h), h) - target) / target);
+    }
+  }
+  printf("max relative area error: table %.3g, newton %.3g, bisection %.3g\n", max_err_table, max_err_newton, max_err_bisect);
+
+#ifdef SQUASH_BENCH
+  bench(N);
+#endif
+
+  bool ok = max_err_table < 1e-5 && max_err_newton < 1e-12
+         && disk_squashed_radius(0.2, 0.2) == 0.2            // not squashed
+         && disk_squashed_radius(0.2, 0.5) == 0.2            // thicker than the bead
+         && disk_squashed_radius(0.2, 0.0) == 2.0            // degenerate, capped
+         && disk_squashed_radius(0.0, 0.1) == 0.0
+         && disk_squashed_radius_newton(0.2, 0.2) == 0.2
+         && disk_squashed_radius_newton(0.2, 0.5) == 0.2
+         && disk_squashed_radius_newton(0.2, 0.0) == 2.0
+         && disk_squashed_radius_newton(0.0, 0.1) == 0.0;
+  printf(ok ? "passed\n" : "FAILED\n");
+  return ok ? 0 : 1;
+}
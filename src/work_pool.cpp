@@ -0,0 +1,101 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "work_pool.h"
+
+#include <thread>
+#include <algorithm>
+
+// --------------------------------------------------------------
+
+WorkStealingPool::WorkStealingPool(int num_threads)
+{
+  if (num_threads <= 0) {
+    num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+  }
+  for (int w = 0; w < num_threads; w++) {
+    m_Queues.push_back(std::unique_ptr<t_queue>(new t_queue()));
+  }
+}
+
+// --------------------------------------------------------------
+
+void WorkStealingPool::add(const t_task& task)
+{
+  t_queue& q = *m_Queues[m_Next];
+  m_Next     = (m_Next + 1) % numThreads();
+  std::unique_lock<std::mutex> lock(q.mutex);
+  q.tasks.push_back(task);
+}
+
+// --------------------------------------------------------------
+
+bool WorkStealingPool::pop(int w, t_task& _task)
+{
+  t_queue& q = *m_Queues[w];
+  std::unique_lock<std::mutex> lock(q.mutex);
+  if (q.tasks.empty()) return false;
+  _task = std::move(q.tasks.front());
+  q.tasks.pop_front();
+  return true;
+}
+
+// --------------------------------------------------------------
+
+bool WorkStealingPool::steal(int w, t_task& _task)
+{
+  for (int i = 1; i < numThreads(); i++) {
+    t_queue& q = *m_Queues[(w + i) % numThreads()];
+    std::unique_lock<std::mutex> lock(q.mutex);
+    if (!q.tasks.empty()) {
+      _task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+// --------------------------------------------------------------
+
+void WorkStealingPool::worker(int w)
+{
+  t_task task;
+  // tasks are all added before running, so once all queues are empty there is nothing left
+  while (pop(w, task) || steal(w, task)) {
+    task(w);
+  }
+}
+
+// --------------------------------------------------------------
+
+void WorkStealingPool::run()
+{
+  std::vector<std::thread> threads;
+  for (int w = 1; w < numThreads(); w++) {
+    threads.push_back(std::thread(&WorkStealingPool::worker, this, w));
+  }
+  worker(0); // the calling thread is worker 0
+  for (auto& th : threads) {
+    th.join();
+  }
+}
+
+// --------------------------------------------------------------
@@ -0,0 +1,72 @@
+/**
+  * IceSL-vrprinter, a tool to help simulate and visualize Gcode for 3D printers
+  * Copyright (C) 2021  Sylvain Lefebvre    sylvain.lefebvre@inria.fr
+  *                     Pierre Bedell       pierre.bedell@gmail.com
+  *                     Salim Perchy        salim.perchy@gmail.com
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU Affero General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU Affero General Public License for more details.
+  *
+  * You should have received a copy of the GNU Affero General Public License
+  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// ----------------------------------------------------------------
+
+// Runs a set of tasks on a pool of threads.
+// Each thread owns a queue of tasks, it takes tasks from the front of its
+// own queue and, once empty, steals from the front of the other queues:
+// tasks start in the order they were added, so adding the longest first
+// (eg. the largest gcodes) leaves the short ones to balance the end.
+// Tasks of very different durations are thus balanced without a central
+// queue being contended.
+class WorkStealingPool
+{
+public:
+
+  typedef std::function<void(int)> t_task; // receives the index of the worker thread
+
+private:
+
+  typedef struct {
+    std::mutex         mutex;
+    std::deque<t_task> tasks;
+  } t_queue;
+
+  std::vector<std::unique_ptr<t_queue> > m_Queues;
+  int                                    m_Next = 0;
+
+  bool pop(int w, t_task& _task);
+  bool steal(int w, t_task& _task);
+  void worker(int w);
+
+public:
+
+  // 0 threads: one per hardware thread
+  WorkStealingPool(int num_threads = 0);
+
+  int  numThreads() const { return (int)m_Queues.size(); }
+
+  // adds a task, tasks are spread round robin over the threads
+  void add(const t_task& task);
+
+  // runs all tasks, returns once they are all done
+  void run();
+};
+
+// ----------------------------------------------------------------